@@ -72,6 +72,7 @@
 #include "libavutil/dict.h"
 #include "libavutil/mem.h"
 #include "libavutil/time.h"
+#include "libavutil/trace.h"
 
 #include "libavformat/avformat.h"
 
@@ -308,6 +309,14 @@ const AVIOInterruptCB int_cb = { decode_interrupt_cb, NULL };
 
 static void ffmpeg_cleanup(int ret)
 {
+    if (trace_filename) {
+        int err = av_trace_stop(trace_filename);
+        if (err < 0)
+            av_log(NULL, AV_LOG_ERROR, "Error writing the trace to '%s': %s\n",
+                   trace_filename, av_err2str(err));
+        av_freep(&trace_filename);
+    }
+
     if (do_benchmark) {
         int64_t maxrss = getmaxrss() / 1024;
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%"PRId64"KiB\n", maxrss);
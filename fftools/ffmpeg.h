@@ -689,6 +689,7 @@ extern Decoder     **decoders;
 extern int        nb_decoders;
 
 extern char *vstats_filename;
+extern char *trace_filename;
 
 extern float dts_delta_threshold;
 extern float dts_error_threshold;
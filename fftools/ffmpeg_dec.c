@@ -30,6 +30,7 @@
 #include "libavutil/stereo3d.h"
 #include "libavutil/time.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/trace.h"
 
 #include "libavcodec/avcodec.h"
 #include "libavcodec/codec.h"
@@ -880,6 +881,7 @@ static void dec_thread_set_name(const DecoderPriv *dp)
         av_strlcatf(name, sizeof(name), ":%s", dp->dec_ctx->codec->name);
 
     ff_thread_setname(name);
+    av_trace_set_thread_name(name);
 }
 
 static void dec_thread_uninit(DecThreadContext *dt)
@@ -924,7 +926,9 @@ static int decoder_thread(void *arg)
     while (!input_status) {
         int flush_buffers, have_data;
 
+        av_trace_begin("dec", "receive", 0);
         input_status  = sch_dec_receive(dp->sch, dp->sch_idx, dt.pkt);
+        av_trace_end();
         have_data     = input_status >= 0 &&
             (dt.pkt->buf || dt.pkt->side_data_elems ||
              (intptr_t)dt.pkt->opaque == PKT_OPAQUE_SUB_HEARTBEAT ||
@@ -950,7 +954,9 @@ static int decoder_thread(void *arg)
                 goto finish;
         }
 
+        av_trace_begin("dec", "decode", have_data ? dt.pkt->pts : 0);
         ret = packet_decode(dp, have_data ? dt.pkt : NULL, dt.frame);
+        av_trace_end();
 
         av_packet_unref(dt.pkt);
         av_frame_unref(dt.frame);
@@ -34,6 +34,7 @@
 #include "libavutil/pixdesc.h"
 #include "libavutil/time.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/trace.h"
 
 #include "libavcodec/bsf.h"
 #include "libavcodec/packet.h"
@@ -654,6 +655,7 @@ static void thread_set_name(InputFile *f)
     char name[16];
     snprintf(name, sizeof(name), "dmx%d:%s", f->index, f->ctx->iformat->name);
     ff_thread_setname(name);
+    av_trace_set_thread_name(name);
 }
 
 static void demux_thread_uninit(DemuxThreadContext *dt)
@@ -703,7 +705,9 @@ static int input_thread(void *arg)
         DemuxStream *ds;
         unsigned send_flags = 0;
 
+        av_trace_begin("demux", "read", 0);
         ret = av_read_frame(f->ctx, dt.pkt_demux);
+        av_trace_end();
 
         if (ret == AVERROR(EAGAIN)) {
             av_usleep(10000);
@@ -772,7 +776,9 @@ static int input_thread(void *arg)
         if (d->readrate)
             readrate_sleep(d);
 
+        av_trace_begin("demux", "send", dt.pkt_demux->pts);
         ret = demux_send(d, &dt, ds, dt.pkt_demux, send_flags);
+        av_trace_end();
         if (ret < 0)
             break;
     }
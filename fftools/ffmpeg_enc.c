@@ -35,6 +35,7 @@
 #include "libavutil/rational.h"
 #include "libavutil/time.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/trace.h"
 
 #include "libavcodec/avcodec.h"
 
@@ -327,6 +328,10 @@ int enc_open(void *opaque, const AVFrame *frame)
 
     enc_ctx->flags |= AV_CODEC_FLAG_FRAME_DURATION;
 
+    // a thread budget only applies when no thread count was set by the user
+    if (sch_enc_thread_count(ep->sch, ep->sch_idx))
+        enc_ctx->thread_count = sch_enc_thread_count(ep->sch, ep->sch_idx);
+
     ret = hw_device_setup_for_encode(e, enc_ctx, frame ? frame->hw_frames_ctx : NULL);
     if (ret < 0) {
         av_log(e, AV_LOG_ERROR,
@@ -818,6 +823,7 @@ static void enc_thread_set_name(const OutputStream *ost)
     snprintf(name, sizeof(name), "enc%d:%d:%s", ost->file->index, ost->index,
              ost->enc->enc_ctx->codec->name);
     ff_thread_setname(name);
+    av_trace_set_thread_name(name);
 }
 
 static void enc_thread_uninit(EncoderThread *et)
@@ -874,7 +880,9 @@ int encoder_thread(void *arg)
     }
 
     while (!input_status) {
+        av_trace_begin("enc", "receive", 0);
         input_status = sch_enc_receive(ep->sch, ep->sch_idx, et.frame);
+        av_trace_end();
         if (input_status < 0) {
             if (input_status == AVERROR_EOF) {
                 av_log(e, AV_LOG_VERBOSE, "Encoder thread received EOF\n");
@@ -896,7 +904,9 @@ int encoder_thread(void *arg)
             name_set = 1;
         }
 
+        av_trace_begin("enc", "encode", et.frame->pts);
         ret = frame_encode(ost, et.frame, et.pkt);
+        av_trace_end();
 
         av_packet_unref(et.pkt);
         av_frame_unref(et.frame);
@@ -913,7 +923,9 @@ int encoder_thread(void *arg)
 
     // flush the encoder
     if (ret == 0 || ret == AVERROR_EOF) {
+        av_trace_begin("enc", "flush", 0);
         ret = frame_encode(ost, NULL, et.pkt);
+        av_trace_end();
         if (ret < 0 && ret != AVERROR_EOF)
             av_log(e, AV_LOG_ERROR, "Error flushing encoder: %s\n",
                    av_err2str(ret));
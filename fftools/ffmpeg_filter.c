@@ -37,6 +37,7 @@
 #include "libavutil/samplefmt.h"
 #include "libavutil/time.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/trace.h"
 
 // FIXME private header, used for mid_pred()
 #include "libavcodec/mathops.h"
@@ -1178,6 +1179,17 @@ int fg_create(FilterGraph **pfg, char *graph_desc, Scheduler *sch)
         goto fail;
     fgp->sch_idx = ret;
 
+    // complex filtergraph without an explicit thread count; as for simple
+    // filtergraphs, only video filters are threaded
+    if (!pfg && !filter_complex_nbthreads) {
+        for (int i = 0; i < fg->nb_outputs; i++) {
+            if (fg->outputs[i]->type == AVMEDIA_TYPE_VIDEO) {
+                sch_filter_use_thread_budget(sch, fgp->sch_idx);
+                break;
+            }
+        }
+    }
+
 fail:
     avfilter_inout_free(&inputs);
     avfilter_inout_free(&outputs);
@@ -1242,6 +1254,10 @@ int fg_create_simple(FilterGraph **pfg,
             return AVERROR(ENOMEM);
     }
 
+    // audio filters are not threaded
+    if (type == AVMEDIA_TYPE_VIDEO && !filter_nbthreads && !fgp->nb_threads)
+        sch_filter_use_thread_budget(sch, fgp->sch_idx);
+
     return 0;
 }
 
@@ -1915,7 +1931,8 @@ static int configure_filtergraph(FilterGraph *fg, FilterGraphThread *fgt)
             ret = av_opt_set(fgt->graph, "threads", fgp->nb_threads, 0);
             if (ret < 0)
                 return ret;
-        }
+        } else
+            fgt->graph->nb_threads = sch_filter_thread_count(fgp->sch, fgp->sch_idx);
 
         if (av_dict_count(ofp->sws_opts)) {
             ret = av_dict_get_string(ofp->sws_opts,
@@ -1934,7 +1951,8 @@ static int configure_filtergraph(FilterGraph *fg, FilterGraphThread *fgt)
             av_free(args);
         }
     } else {
-        fgt->graph->nb_threads = filter_complex_nbthreads;
+        fgt->graph->nb_threads = filter_complex_nbthreads ? filter_complex_nbthreads :
+                                 sch_filter_thread_count(fgp->sch, fgp->sch_idx);
     }
 
     hw_device = hw_device_for_filter();
@@ -2918,6 +2936,7 @@ static void fg_thread_set_name(const FilterGraph *fg)
     }
 
     ff_thread_setname(name);
+    av_trace_set_thread_name(name);
 }
 
 static void fg_thread_uninit(FilterGraphThread *fgt)
@@ -2995,8 +3014,10 @@ static int filter_thread(void *arg)
         enum FrameOpaque o;
         unsigned input_idx = fgt.next_in;
 
+        av_trace_begin("filter", "receive", 0);
         input_status = sch_filter_receive(fgp->sch, fgp->sch_idx,
                                           &input_idx, fgt.frame);
+        av_trace_end();
         if (input_status == AVERROR_EOF) {
             av_log(fg, AV_LOG_VERBOSE, "Filtering thread received EOF\n");
             break;
@@ -3028,6 +3049,7 @@ static int filter_thread(void *arg)
         ifilter   = fg->inputs[input_idx];
         ifp       = ifp_from_ifilter(ifilter);
 
+        av_trace_begin("filter", "input", fgt.frame->pts);
         if (ifp->type_src == AVMEDIA_TYPE_SUBTITLE) {
             int hb_frame = input_status >= 0 && o == FRAME_OPAQUE_SUB_HEARTBEAT;
             ret = sub2video_frame(ifilter, (fgt.frame->buf[0] || hb_frame) ? fgt.frame : NULL,
@@ -3038,6 +3060,7 @@ static int filter_thread(void *arg)
             av_assert1(o == FRAME_OPAQUE_EOF);
             ret = send_eof(&fgt, ifilter, fgt.frame->pts, fgt.frame->time_base);
         }
+        av_trace_end();
         av_frame_unref(fgt.frame);
         if (ret == AVERROR_EOF) {
             av_log(fg, AV_LOG_VERBOSE, "Input %u no longer accepts new data\n",
@@ -3050,7 +3073,9 @@ static int filter_thread(void *arg)
 
 read_frames:
         // retrieve all newly avalable frames
+        av_trace_begin("filter", "output", 0);
         ret = read_frames(fg, &fgt, fgt.frame);
+        av_trace_end();
         if (ret == AVERROR_EOF) {
             av_log(fg, AV_LOG_VERBOSE, "All consumers returned EOF\n");
             break;
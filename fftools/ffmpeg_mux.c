@@ -32,6 +32,7 @@
 #include "libavutil/mem.h"
 #include "libavutil/time.h"
 #include "libavutil/timestamp.h"
+#include "libavutil/trace.h"
 
 #include "libavcodec/packet.h"
 
@@ -375,6 +376,7 @@ static void thread_set_name(Muxer *mux)
     snprintf(name, sizeof(name), "mux%d:%s",
              mux->of.index, mux->fc->oformat->name);
     ff_thread_setname(name);
+    av_trace_set_thread_name(name);
 }
 
 static void mux_thread_uninit(MuxThreadContext *mt)
@@ -423,7 +425,9 @@ int muxer_thread(void *arg)
         OutputStream *ost;
         int stream_idx, stream_eof = 0;
 
+        av_trace_begin("mux", "receive", 0);
         ret = sch_mux_receive(mux->sch, of->index, mt.pkt);
+        av_trace_end();
         stream_idx = mt.pkt->stream_index;
         if (stream_idx < 0) {
             av_log(mux, AV_LOG_VERBOSE, "All streams finished\n");
@@ -435,7 +439,9 @@ int muxer_thread(void *arg)
         mt.pkt->stream_index = ost->index;
         mt.pkt->flags       &= ~AV_PKT_FLAG_TRUSTED;
 
+        av_trace_begin("mux", "write", mt.pkt->dts);
         ret = mux_packet_filter(mux, &mt, ost, ret < 0 ? NULL : mt.pkt, &stream_eof);
+        av_trace_end();
         av_packet_unref(mt.pkt);
         if (ret == AVERROR_EOF) {
             if (stream_eof) {
@@ -1422,9 +1422,13 @@ static int ost_add(Muxer *mux, const OptionsContext *o, enum AVMediaType type,
         if (ret < 0)
             goto fail;
 
-        // default to automatic thread count
-        if (!threads_manual)
+        // default to automatic thread count, or a share of the thread
+        // budget for video
+        if (!threads_manual) {
             ost->enc->enc_ctx->thread_count = 0;
+            if (type == AVMEDIA_TYPE_VIDEO)
+                sch_enc_use_thread_budget(mux->sch, ms->sch_idx_enc);
+        }
     } else {
         ret = filter_codec_opts(o->g->codec_opts, AV_CODEC_ID_NONE, oc, st,
                                 NULL, &encoder_opts,
@@ -47,10 +47,12 @@
 #include "libavutil/opt.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/stereo3d.h"
+#include "libavutil/trace.h"
 
 HWDevice *filter_hw_device;
 
 char *vstats_filename;
+char *trace_filename;
 
 float audio_drift_threshold = 0.1;
 float dts_delta_threshold   = 10;
@@ -624,6 +626,37 @@ static int opt_sdp_file(void *optctx, const char *opt, const char *arg)
     return sch_sdp_filename(go->sch, arg);
 }
 
+static int opt_thread_budget(void *optctx, const char *opt, const char *arg)
+{
+    GlobalOptionsContext *go = optctx;
+    double nb_threads;
+    int ret;
+
+    ret = parse_number(opt, arg, OPT_TYPE_INT, -1, INT_MAX, &nb_threads);
+    if (ret < 0)
+        return ret;
+
+    sch_set_thread_budget(go->sch, nb_threads);
+    return 0;
+}
+
+static int opt_thread_affinity(void *optctx, const char *opt, const char *arg)
+{
+    GlobalOptionsContext *go = optctx;
+    enum SchThreadAffinity affinity;
+
+    if (!strcmp(arg, "none"))
+        affinity = SCH_AFFINITY_NONE;
+    else if (!strcmp(arg, "numa"))
+        affinity = SCH_AFFINITY_NUMA;
+    else {
+        av_log(NULL, AV_LOG_FATAL, "Invalid thread affinity policy: %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+
+    return sch_set_thread_affinity(go->sch, affinity);
+}
+
 #if CONFIG_VAAPI
 static int opt_vaapi_device(void *optctx, const char *opt, const char *arg)
 {
@@ -956,6 +989,24 @@ static int opt_vstats_file(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_trace(void *optctx, const char *opt, const char *arg)
+{
+    int ret;
+
+    av_freep(&trace_filename);
+    trace_filename = av_strdup(arg);
+    if (!trace_filename)
+        return AVERROR(ENOMEM);
+
+    ret = av_trace_start(0);
+    if (ret < 0 && ret != AVERROR(EBUSY)) {
+        av_log(NULL, AV_LOG_FATAL, "Error starting the trace: %s\n",
+               av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
 static int opt_vstats(void *optctx, const char *opt, const char *arg)
 {
     char filename[40];
@@ -1616,6 +1667,9 @@ const OptionDef options[] = {
     { "benchmark_all",          OPT_TYPE_BOOL, OPT_EXPERT,
         { &do_benchmark_all },
       "add timings for each task" },
+    { "trace",                  OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
+        { .func_arg = opt_trace },
+        "record the activity of all threads to a file in the Chrome trace format", "filename" },
     { "progress",               OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
         { .func_arg = opt_progress },
       "write program-readable progress information", "url" },
@@ -1723,6 +1777,12 @@ const OptionDef options[] = {
     { "filter_complex_threads", OPT_TYPE_INT, OPT_EXPERT,
         { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
+    { "thread_budget",          OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
+        { .func_arg = opt_thread_budget },
+        "share this many threads between video encoders and filtergraphs", "number" },
+    { "thread_affinity",        OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
+        { .func_arg = opt_thread_affinity },
+        "pin scheduler threads to CPUs according to a policy", "none|numa" },
     { "lavfi",               OPT_TYPE_FUNC, OPT_FUNC_ARG | OPT_EXPERT,
         { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
@@ -19,9 +19,21 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "config.h"
+
+#if HAVE_SCHED_GETAFFINITY
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include <errno.h>
 #include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "cmdutils.h"
 #include "ffmpeg_sched.h"
@@ -32,6 +44,7 @@
 #include "libavcodec/packet.h"
 
 #include "libavutil/avassert.h"
+#include "libavutil/cpu.h"
 #include "libavutil/error.h"
 #include "libavutil/fifo.h"
 #include "libavutil/frame.h"
@@ -69,6 +82,13 @@ typedef struct SchTask {
 
     pthread_t           thread;
     int                 thread_running;
+
+    // index into Scheduler.cpu_nodes the thread is pinned to, or -1
+    int                 cpu_node;
+    // whether the internal threads of this node count against the thread
+    // budget, and the resulting number of threads
+    int                 use_thread_budget;
+    int                 nb_threads;
 } SchTask;
 
 typedef struct SchDecOutput {
@@ -88,6 +108,9 @@ typedef struct SchDec {
     SchTask             task;
     // Queue for receiving input packets, one stream.
     ThreadQueue        *queue;
+    // Set when a muxer sends subtitle heartbeat packets to this decoder,
+    // so that its queue has more than one producer thread.
+    int                 sub_heartbeat;
 
     // Queue for sending post-flush end timestamps back to the source
     AVThreadMessageQueue *queue_end_ts;
@@ -266,6 +289,25 @@ typedef struct SchFilterGraph {
     int                 task_exited;
 } SchFilterGraph;
 
+#if HAVE_SCHED_GETAFFINITY && defined(CPU_SET)
+#define HAVE_CPU_PINNING 1
+#else
+#define HAVE_CPU_PINNING 0
+#endif
+
+// a set of CPUs sharing a NUMA node
+typedef struct SchCPUNode {
+#if HAVE_CPU_PINNING
+    cpu_set_t           cpus;
+#endif
+    int                 nb_cpus;
+
+    // number of threads assigned by the thread budget
+    int                 nb_threads;
+    // number of tasks using the thread budget pinned to this node
+    unsigned            nb_tasks;
+} SchCPUNode;
+
 enum SchedulerState {
     SCH_STATE_UNINIT,
     SCH_STATE_STARTED,
@@ -304,6 +346,12 @@ struct Scheduler {
     char               *sdp_filename;
     int                 sdp_auto;
 
+    int                 thread_budget;
+    enum SchThreadAffinity thread_affinity;
+
+    SchCPUNode         *cpu_nodes;
+    unsigned         nb_cpu_nodes;
+
     enum SchedulerState state;
     atomic_int          terminate;
     atomic_int          task_failed;
@@ -372,7 +420,7 @@ static void waiter_uninit(SchWaiter *w)
 }
 
 static int queue_alloc(ThreadQueue **ptq, unsigned nb_streams, unsigned queue_size,
-                       enum QueueType type)
+                       enum QueueType type, int flags)
 {
     ThreadQueue *tq;
     ObjPool *op;
@@ -398,7 +446,7 @@ static int queue_alloc(ThreadQueue **ptq, unsigned nb_streams, unsigned queue_si
     if (!op)
         return AVERROR(ENOMEM);
 
-    tq = tq_alloc(nb_streams, queue_size, op,
+    tq = tq_alloc(nb_streams, queue_size, flags, op,
                   (type == QUEUE_PACKETS) ? pkt_move : frame_move);
     if (!tq) {
         objpool_free(&op);
@@ -440,6 +488,8 @@ static void task_init(Scheduler *sch, SchTask *task, enum SchedulerNodeType type
 
     task->func      = func;
     task->func_arg  = func_arg;
+
+    task->cpu_node  = -1;
 }
 
 static int64_t trailing_dts(const Scheduler *sch, int count_finished)
@@ -567,6 +617,8 @@ void sch_free(Scheduler **psch)
 
     av_freep(&sch->sdp_filename);
 
+    av_freep(&sch->cpu_nodes);
+
     pthread_mutex_destroy(&sch->schedule_lock);
 
     pthread_mutex_destroy(&sch->mux_ready_lock);
@@ -623,6 +675,46 @@ int sch_sdp_filename(Scheduler *sch, const char *sdp_filename)
     return sch->sdp_filename ? 0 : AVERROR(ENOMEM);
 }
 
+void sch_set_thread_budget(Scheduler *sch, int thread_budget)
+{
+    sch->thread_budget = thread_budget;
+}
+
+int sch_set_thread_affinity(Scheduler *sch, enum SchThreadAffinity affinity)
+{
+    if (affinity != SCH_AFFINITY_NONE && !HAVE_CPU_PINNING) {
+        av_log(sch, AV_LOG_ERROR, "Thread pinning is not supported on this platform\n");
+        return AVERROR(ENOSYS);
+    }
+
+    sch->thread_affinity = affinity;
+    return 0;
+}
+
+void sch_enc_use_thread_budget(Scheduler *sch, unsigned enc_idx)
+{
+    av_assert0(enc_idx < sch->nb_enc);
+    sch->enc[enc_idx].task.use_thread_budget = 1;
+}
+
+void sch_filter_use_thread_budget(Scheduler *sch, unsigned fg_idx)
+{
+    av_assert0(fg_idx < sch->nb_filters);
+    sch->filters[fg_idx].task.use_thread_budget = 1;
+}
+
+int sch_enc_thread_count(const Scheduler *sch, unsigned enc_idx)
+{
+    av_assert0(enc_idx < sch->nb_enc);
+    return sch->enc[enc_idx].task.nb_threads;
+}
+
+int sch_filter_thread_count(const Scheduler *sch, unsigned fg_idx)
+{
+    av_assert0(fg_idx < sch->nb_filters);
+    return sch->filters[fg_idx].task.nb_threads;
+}
+
 static const AVClass sch_mux_class = {
     .class_name                = "SchMux",
     .version                   = LIBAVUTIL_VERSION_INT,
@@ -769,10 +861,6 @@ int sch_add_dec(Scheduler *sch, SchThreadFunc func, void *ctx, int send_end_ts)
     if (ret < 0)
         return ret;
 
-    ret = queue_alloc(&dec->queue, 1, 0, QUEUE_PACKETS);
-    if (ret < 0)
-        return ret;
-
     if (send_end_ts) {
         ret = av_thread_message_queue_alloc(&dec->queue_end_ts, 1, sizeof(Timestamp));
         if (ret < 0)
@@ -813,10 +901,6 @@ int sch_add_enc(Scheduler *sch, SchThreadFunc func, void *ctx,
     if (!enc->send_pkt)
         return AVERROR(ENOMEM);
 
-    ret = queue_alloc(&enc->queue, 1, 0, QUEUE_FRAMES);
-    if (ret < 0)
-        return ret;
-
     return idx;
 }
 
@@ -861,7 +945,7 @@ int sch_add_filtergraph(Scheduler *sch, unsigned nb_inputs, unsigned nb_outputs,
     if (ret < 0)
         return ret;
 
-    ret = queue_alloc(&fg->queue, fg->nb_inputs + 1, 0, QUEUE_FRAMES);
+    ret = queue_alloc(&fg->queue, fg->nb_inputs + 1, 0, QUEUE_FRAMES, 0);
     if (ret < 0)
         return ret;
 
@@ -1262,6 +1346,7 @@ int sch_mux_sub_heartbeat_add(Scheduler *sch, unsigned mux_idx, unsigned stream_
 
     av_assert0(dec_idx < sch->nb_dec);
     ms->sub_heartbeat_dst[ms->nb_sub_heartbeat_dst - 1] = dec_idx;
+    sch->dec[dec_idx].sub_heartbeat = 1;
 
     if (!mux->sub_heartbeat_pkt) {
         mux->sub_heartbeat_pkt = av_packet_alloc();
@@ -1451,6 +1536,255 @@ fail:
     return ret;
 }
 
+#if HAVE_CPU_PINNING
+// parse a list of ranges in the sysfs "cpulist" format, e.g. "0-3,8-11"
+static int read_cpulist(const char *path, cpu_set_t *set)
+{
+    char buf[4096], *p = buf;
+    FILE *f;
+
+    CPU_ZERO(set);
+
+    f = fopen(path, "r");
+    if (!f)
+        return AVERROR(errno);
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (!p)
+        return AVERROR(EIO);
+
+    while (*p && *p != '\n') {
+        unsigned long first, last;
+        char *end;
+
+        first = last = strtoul(p, &end, 10);
+        if (end == p)
+            return AVERROR_INVALIDDATA;
+        p = end;
+
+        if (*p == '-') {
+            last = strtoul(p + 1, &end, 10);
+            if (end == p + 1)
+                return AVERROR_INVALIDDATA;
+            p = end;
+        }
+        for (unsigned long i = first; i <= last && i < CPU_SETSIZE; i++)
+            CPU_SET(i, set);
+
+        if (*p == ',')
+            p++;
+    }
+
+    return 0;
+}
+#endif
+
+/* Read the CPUs this process may run on, split by NUMA node. Falls back to a
+ * single node when the topology is unknown or pinning is not requested. */
+static int cpu_topology_init(Scheduler *sch)
+{
+    SchCPUNode *node;
+    int ret;
+
+#if HAVE_CPU_PINNING
+    if (sch->thread_affinity == SCH_AFFINITY_NUMA) {
+        cpu_set_t allowed, nodes;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+            ret = AVERROR(errno);
+            av_log(sch, AV_LOG_ERROR, "Could not get the CPU affinity: %s\n",
+                   av_err2str(ret));
+            return ret;
+        }
+
+        // node IDs use the same list format as CPUs
+        if (read_cpulist("/sys/devices/system/node/online", &nodes) < 0) {
+            CPU_ZERO(&nodes);
+            CPU_SET(0, &nodes);
+        }
+
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            char path[64];
+            cpu_set_t cpus;
+
+            if (!CPU_ISSET(i, &nodes))
+                continue;
+
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/node/node%d/cpulist", i);
+            if (read_cpulist(path, &cpus) < 0) {
+                // no NUMA information, use all allowed CPUs
+                if (i)
+                    continue;
+                cpus = allowed;
+            }
+
+            CPU_AND(&cpus, &cpus, &allowed);
+            if (!CPU_COUNT(&cpus))
+                continue;
+
+            ret = GROW_ARRAY(sch->cpu_nodes, sch->nb_cpu_nodes);
+            if (ret < 0)
+                return ret;
+
+            node          = &sch->cpu_nodes[sch->nb_cpu_nodes - 1];
+            node->cpus    = cpus;
+            node->nb_cpus = CPU_COUNT(&cpus);
+
+            av_log(sch, AV_LOG_VERBOSE, "NUMA node %d: %d CPUs\n",
+                   i, node->nb_cpus);
+        }
+
+        if (sch->nb_cpu_nodes)
+            return 0;
+    }
+#endif
+
+    ret = GROW_ARRAY(sch->cpu_nodes, sch->nb_cpu_nodes);
+    if (ret < 0)
+        return ret;
+
+    node          = &sch->cpu_nodes[0];
+    node->nb_cpus = av_cpu_count();
+#if HAVE_CPU_PINNING
+    if (sched_getaffinity(0, sizeof(node->cpus), &node->cpus) < 0)
+        CPU_ZERO(&node->cpus);
+#endif
+
+    return 0;
+}
+
+static SchTask *task_for_node(Scheduler *sch, SchedulerNode n)
+{
+    switch (n.type) {
+    case SCH_NODE_TYPE_DEMUX:       return &sch->demux[n.idx].task;
+    case SCH_NODE_TYPE_MUX:         return &sch->mux[n.idx].task;
+    case SCH_NODE_TYPE_DEC:         return &sch->dec[n.idx].task;
+    case SCH_NODE_TYPE_ENC:         return &sch->enc[n.idx].task;
+    case SCH_NODE_TYPE_FILTER_IN:
+    case SCH_NODE_TYPE_FILTER_OUT:  return &sch->filters[n.idx].task;
+    default: av_assert0(0);
+    }
+    return NULL;
+}
+
+// pick the node with the fewest budgeted tasks per CPU
+static int cpu_node_least_loaded(const Scheduler *sch)
+{
+    int best = 0;
+
+    for (unsigned i = 1; i < sch->nb_cpu_nodes; i++) {
+        const SchCPUNode *n = &sch->cpu_nodes[i];
+        const SchCPUNode *b = &sch->cpu_nodes[best];
+
+        if ((uint64_t)n->nb_tasks * b->nb_cpus < (uint64_t)b->nb_tasks * n->nb_cpus)
+            best = i;
+    }
+
+    return best;
+}
+
+static void task_assign_node(Scheduler *sch, SchTask *task, int cpu_node)
+{
+    task->cpu_node = cpu_node;
+    if (task->use_thread_budget)
+        sch->cpu_nodes[cpu_node].nb_tasks++;
+}
+
+/* Distribute the CPUs among the graph nodes. Encoders and filtergraphs using
+ * the thread budget are spread evenly over the NUMA nodes; every other node
+ * follows the node it exchanges most data with, so that frames do not
+ * cross sockets. */
+static int thread_policy_init(Scheduler *sch)
+{
+    int total_cpus = 0, budget;
+    int ret;
+
+    if (!sch->thread_budget && sch->thread_affinity == SCH_AFFINITY_NONE)
+        return 0;
+
+    ret = cpu_topology_init(sch);
+    if (ret < 0)
+        return ret;
+
+    for (unsigned i = 0; i < sch->nb_enc; i++) {
+        SchTask *task = &sch->enc[i].task;
+        if (task->use_thread_budget)
+            task_assign_node(sch, task, cpu_node_least_loaded(sch));
+    }
+
+    for (unsigned i = 0; i < sch->nb_filters; i++) {
+        SchFilterGraph *fg = &sch->filters[i];
+        int cpu_node = -1;
+
+        // follow the first encoder we feed
+        for (unsigned j = 0; j < fg->nb_outputs && cpu_node < 0; j++)
+            if (fg->outputs[j].dst.type == SCH_NODE_TYPE_ENC)
+                cpu_node = sch->enc[fg->outputs[j].dst.idx].task.cpu_node;
+
+        if (cpu_node < 0 && fg->task.use_thread_budget)
+            cpu_node = cpu_node_least_loaded(sch);
+        if (cpu_node >= 0)
+            task_assign_node(sch, &fg->task, cpu_node);
+    }
+
+    for (unsigned i = 0; i < sch->nb_enc; i++) {
+        SchEnc *enc = &sch->enc[i];
+        if (enc->task.cpu_node < 0)
+            enc->task.cpu_node = task_for_node(sch, enc->src)->cpu_node;
+    }
+
+    for (unsigned i = 0; i < sch->nb_dec; i++) {
+        SchDec *dec = &sch->dec[i];
+        if (dec->nb_outputs && dec->outputs[0].nb_dst)
+            dec->task.cpu_node = task_for_node(sch, dec->outputs[0].dst[0])->cpu_node;
+    }
+
+    for (unsigned i = 0; i < sch->nb_mux; i++) {
+        SchMux *mux = &sch->mux[i];
+        if (mux->nb_streams)
+            mux->task.cpu_node = task_for_node(sch, mux->streams[0].src)->cpu_node;
+    }
+
+    for (unsigned i = 0; i < sch->nb_demux; i++) {
+        SchDemux *d = &sch->demux[i];
+        if (d->nb_streams && d->streams[0].nb_dst)
+            d->task.cpu_node = task_for_node(sch, d->streams[0].dst[0])->cpu_node;
+    }
+
+    if (!sch->thread_budget)
+        return 0;
+
+    // split the budget between the NUMA nodes proportionally to their CPUs,
+    // then evenly between the tasks on each node
+    for (unsigned i = 0; i < sch->nb_cpu_nodes; i++)
+        total_cpus += sch->cpu_nodes[i].nb_cpus;
+    budget = sch->thread_budget > 0 ? sch->thread_budget : total_cpus;
+
+    for (unsigned i = 0; i < sch->nb_cpu_nodes; i++) {
+        SchCPUNode *n = &sch->cpu_nodes[i];
+
+        n->nb_threads = (int64_t)budget * n->nb_cpus / FFMAX(total_cpus, 1);
+        if (n->nb_tasks)
+            av_log(sch, AV_LOG_VERBOSE, "CPU node %u: %u tasks sharing %d threads\n",
+                   i, n->nb_tasks, n->nb_threads);
+    }
+
+    for (unsigned i = 0; i < sch->nb_enc + sch->nb_filters; i++) {
+        SchTask *task = i < sch->nb_enc ? &sch->enc[i].task :
+                                          &sch->filters[i - sch->nb_enc].task;
+        const SchCPUNode *n;
+
+        if (!task->use_thread_budget)
+            continue;
+
+        n = &sch->cpu_nodes[task->cpu_node];
+        task->nb_threads = FFMAX(n->nb_threads / n->nb_tasks, 1);
+    }
+
+    return 0;
+}
+
 static int start_prepare(Scheduler *sch)
 {
     int ret;
@@ -1495,6 +1829,13 @@ static int start_prepare(Scheduler *sch)
             if (!o->dst_finished)
                 return AVERROR(ENOMEM);
         }
+
+        // packets come from the demuxer or the encoder we are connected to,
+        // plus the muxer thread when it sends subtitle heartbeats
+        ret = queue_alloc(&dec->queue, 1, 0, QUEUE_PACKETS,
+                          dec->sub_heartbeat ? 0 : TQ_SINGLE_PRODUCER);
+        if (ret < 0)
+            return ret;
     }
 
     for (unsigned i = 0; i < sch->nb_enc; i++) {
@@ -1514,6 +1855,13 @@ static int start_prepare(Scheduler *sch)
         enc->dst_finished = av_calloc(enc->nb_dst, sizeof(*enc->dst_finished));
         if (!enc->dst_finished)
             return AVERROR(ENOMEM);
+
+        // frames come from a single decoder or filtergraph output; encoders
+        // fed through a sync queue may be sent to by several threads, but
+        // only while holding the sync queue lock
+        ret = queue_alloc(&enc->queue, 1, 0, QUEUE_FRAMES, TQ_SINGLE_PRODUCER);
+        if (ret < 0)
+            return ret;
     }
 
     for (unsigned i = 0; i < sch->nb_mux; i++) {
@@ -1545,7 +1893,7 @@ static int start_prepare(Scheduler *sch)
         }
 
         ret = queue_alloc(&mux->queue, mux->nb_streams, mux->queue_size,
-                          QUEUE_PACKETS);
+                          QUEUE_PACKETS, 0);
         if (ret < 0)
             return ret;
     }
@@ -1593,6 +1941,10 @@ static int start_prepare(Scheduler *sch)
     if (ret < 0)
         return ret;
 
+    ret = thread_policy_init(sch);
+    if (ret < 0)
+        return ret;
+
     return 0;
 }
 
@@ -2541,6 +2893,21 @@ static void *task_wrapper(void *arg)
     int ret;
     int err = 0;
 
+#if HAVE_CPU_PINNING
+    // threads created by the task, e.g. codec or filter thread pools,
+    // inherit the affinity
+    if (sch->thread_affinity != SCH_AFFINITY_NONE && task->cpu_node >= 0) {
+        const SchCPUNode *n = &sch->cpu_nodes[task->cpu_node];
+
+        if (sched_setaffinity(0, sizeof(n->cpus), &n->cpus) < 0)
+            av_log(task->func_arg, AV_LOG_WARNING,
+                   "Could not set the CPU affinity: %s\n", av_err2str(AVERROR(errno)));
+        else
+            av_log(task->func_arg, AV_LOG_VERBOSE, "Pinned to CPU node %d\n",
+                   task->cpu_node);
+    }
+#endif
+
     ret = task->func(task->func_arg);
     if (ret < 0)
         av_log(task->func_arg, AV_LOG_ERROR,
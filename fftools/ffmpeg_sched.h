@@ -298,6 +298,37 @@ int sch_mux_stream_ready(Scheduler *sch, unsigned mux_idx, unsigned stream_idx);
  */
 int sch_sdp_filename(Scheduler *sch, const char *sdp_filename);
 
+enum SchThreadAffinity {
+    SCH_AFFINITY_NONE = 0,
+    /**
+     * Pin the thread of every node in the transcoding graph to the CPUs of
+     * one NUMA node, spreading the nodes using the thread budget evenly and
+     * keeping the remaining ones close to the nodes they exchange data with.
+     * Threads created by a node, e.g. codec or filter thread pools, inherit
+     * its affinity.
+     */
+    SCH_AFFINITY_NUMA,
+};
+
+/**
+ * Set the total number of threads encoders and filtergraphs registered with
+ * sch_enc_use_thread_budget() / sch_filter_use_thread_budget() should use for
+ * their internal threading. The budget is split evenly between them.
+ *
+ * @param thread_budget number of threads, 0 disables the budget (the
+ *                      default), a negative value uses the number of CPUs
+ *                      available to the process
+ */
+void sch_set_thread_budget(Scheduler *sch, int thread_budget);
+
+/**
+ * Set the CPU affinity policy for the threads of the transcoding graph.
+ *
+ * @return 0 on success, AVERROR(ENOSYS) if pinning threads is not supported
+ *         on this platform
+ */
+int sch_set_thread_affinity(Scheduler *sch, enum SchThreadAffinity affinity);
+
 /**
  * Add an encoder to the scheduler.
  *
@@ -315,6 +346,30 @@ int sch_sdp_filename(Scheduler *sch, const char *sdp_filename);
 int sch_add_enc(Scheduler *sch, SchThreadFunc func, void *ctx,
                 int (*open_cb)(void *func_arg, const struct AVFrame *frame));
 
+/**
+ * Make the internal threads of the given encoder count against the thread
+ * budget. Must be called before sch_start().
+ */
+void sch_enc_use_thread_budget(Scheduler *sch, unsigned enc_idx);
+/**
+ * Make the internal threads of the given filtergraph count against the thread
+ * budget. Must be called before sch_start().
+ */
+void sch_filter_use_thread_budget(Scheduler *sch, unsigned fg_idx);
+
+/**
+ * @return the number of internal threads assigned to the given encoder by the
+ *         thread budget, or 0 if the encoder is not subject to a budget;
+ *         only valid after sch_start()
+ */
+int sch_enc_thread_count(const Scheduler *sch, unsigned enc_idx);
+/**
+ * @return the number of internal threads assigned to the given filtergraph by
+ *         the thread budget, or 0 if the filtergraph is not subject to a
+ *         budget; only valid after sch_start()
+ */
+int sch_filter_thread_count(const Scheduler *sch, unsigned fg_idx);
+
 /**
  * Add an pre-encoding sync queue to the scheduler.
  *
@@ -16,6 +16,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -24,6 +25,7 @@
 #include "libavutil/fifo.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mem.h"
+#include "libavutil/mem_internal.h"
 #include "libavutil/thread.h"
 
 #include "objpool.h"
@@ -40,7 +42,7 @@ typedef struct FifoElem {
 } FifoElem;
 
 struct ThreadQueue {
-    int              *finished;
+    atomic_int       *finished;
     unsigned int    nb_streams;
 
     AVFifo  *fifo;
@@ -50,6 +52,25 @@ struct ThreadQueue {
 
     pthread_mutex_t lock;
     pthread_cond_t  cond;
+
+    /**
+     * Ring used instead of the FIFO with TQ_SINGLE_PRODUCER. Every slot owns
+     * an object for the whole lifetime of the queue, items are moved in and
+     * out of it, so neither side touches the lock or the object pool on the
+     * fast path. The mutex/condition pair above is only used for parking a
+     * thread while the ring is full (producer) or empty (consumer).
+     */
+    void          **ring;
+    unsigned int   *ring_stream_idx;
+    size_t          ring_size;
+
+    // nonzero when a thread is blocked on cond, wakers skip the lock if zero
+    atomic_int      nb_waiters;
+
+    // free-running counters, head is only written by the producer and
+    // tail only by the consumer; kept on separate cache lines
+    DECLARE_ALIGNED(64, atomic_size_t, head);
+    DECLARE_ALIGNED(64, atomic_size_t, tail);
 };
 
 void tq_free(ThreadQueue **ptq)
@@ -66,6 +87,13 @@ void tq_free(ThreadQueue **ptq)
     }
     av_fifo_freep2(&tq->fifo);
 
+    if (tq->ring) {
+        for (size_t i = 0; i < tq->ring_size; i++)
+            objpool_release(tq->obj_pool, &tq->ring[i]);
+    }
+    av_freep(&tq->ring);
+    av_freep(&tq->ring_stream_idx);
+
     objpool_free(&tq->obj_pool);
 
     av_freep(&tq->finished);
@@ -76,7 +104,7 @@ void tq_free(ThreadQueue **ptq)
     av_freep(ptq);
 }
 
-ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
+ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size, int flags,
                       ObjPool *obj_pool, void (*obj_move)(void *dst, void *src))
 {
     ThreadQueue *tq;
@@ -102,11 +130,35 @@ ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
     tq->finished = av_calloc(nb_streams, sizeof(*tq->finished));
     if (!tq->finished)
         goto fail;
+    for (unsigned int i = 0; i < nb_streams; i++)
+        atomic_init(&tq->finished[i], 0);
     tq->nb_streams = nb_streams;
 
-    tq->fifo = av_fifo_alloc2(queue_size, sizeof(FifoElem), 0);
-    if (!tq->fifo)
-        goto fail;
+    atomic_init(&tq->nb_waiters, 0);
+    atomic_init(&tq->head, 0);
+    atomic_init(&tq->tail, 0);
+
+    if (flags & TQ_SINGLE_PRODUCER) {
+        tq->ring            = av_calloc(queue_size, sizeof(*tq->ring));
+        tq->ring_stream_idx = av_calloc(queue_size, sizeof(*tq->ring_stream_idx));
+        if (!tq->ring || !tq->ring_stream_idx)
+            goto fail;
+        tq->ring_size = queue_size;
+
+        for (size_t i = 0; i < queue_size; i++) {
+            ret = objpool_get(obj_pool, &tq->ring[i]);
+            if (ret < 0) {
+                // the pool is still owned by the caller on failure
+                for (size_t j = 0; j < i; j++)
+                    objpool_release(obj_pool, &tq->ring[j]);
+                goto fail;
+            }
+        }
+    } else {
+        tq->fifo = av_fifo_alloc2(queue_size, sizeof(FifoElem), 0);
+        if (!tq->fifo)
+            goto fail;
+    }
 
     tq->obj_pool = obj_pool;
     tq->obj_move = obj_move;
@@ -117,27 +169,83 @@ fail:
     return NULL;
 }
 
-int tq_send(ThreadQueue *tq, unsigned int stream_idx, void *data)
+/* Wake up any thread parked on the queue. The caller must have published its
+ * state change with a sequentially consistent store or read-modify-write, so
+ * that either it sees the waiter here or the waiter sees the change when it
+ * checks its condition under the lock after registering. Waiters register
+ * again each time they go back to sleep, so once they have been woken up,
+ * further state changes do not need to take the lock until then. */
+static void ring_wake(ThreadQueue *tq)
 {
-    int *finished;
-    int ret;
+    if (atomic_load(&tq->nb_waiters)) {
+        pthread_mutex_lock(&tq->lock);
+        atomic_store(&tq->nb_waiters, 0);
+        pthread_cond_broadcast(&tq->cond);
+        pthread_mutex_unlock(&tq->lock);
+    }
+}
 
-    av_assert0(stream_idx < tq->nb_streams);
-    finished = &tq->finished[stream_idx];
+// fill level below which a producer blocked on a full ring is resumed
+#define RING_SEND_RESUME(tq) (((tq)->ring_size + 1) / 2)
+
+static int ring_can_send(ThreadQueue *tq, size_t head, atomic_int *finished,
+                         size_t max_fill)
+{
+    return head - atomic_load(&tq->tail) < max_fill ||
+           (atomic_load(finished) & FINISHED_RECV);
+}
+
+static int send_ring(ThreadQueue *tq, unsigned int stream_idx, void *data)
+{
+    atomic_int *finished = &tq->finished[stream_idx];
+    size_t head = atomic_load_explicit(&tq->head, memory_order_relaxed);
+    size_t pos  = head % tq->ring_size;
+
+    if (atomic_load(finished) & FINISHED_SEND)
+        return AVERROR(EINVAL);
+
+    /* Once the ring is full, wait until the consumer has drained half of it,
+     * instead of being woken up and going back to sleep for every item. */
+    if (!ring_can_send(tq, head, finished, tq->ring_size)) {
+        pthread_mutex_lock(&tq->lock);
+        while (atomic_fetch_add(&tq->nb_waiters, 1),
+               !ring_can_send(tq, head, finished, RING_SEND_RESUME(tq)))
+            pthread_cond_wait(&tq->cond, &tq->lock);
+        pthread_mutex_unlock(&tq->lock);
+    }
+
+    if (atomic_load(finished) & FINISHED_RECV) {
+        atomic_fetch_or(finished, FINISHED_SEND);
+        return AVERROR_EOF;
+    }
+
+    tq->ring_stream_idx[pos] = stream_idx;
+    tq->obj_move(tq->ring[pos], data);
+
+    atomic_store(&tq->head, head + 1);
+    ring_wake(tq);
+
+    return 0;
+}
+
+static int send_locked(ThreadQueue *tq, unsigned int stream_idx, void *data)
+{
+    atomic_int *finished = &tq->finished[stream_idx];
+    int ret;
 
     pthread_mutex_lock(&tq->lock);
 
-    if (*finished & FINISHED_SEND) {
+    if (atomic_load(finished) & FINISHED_SEND) {
         ret = AVERROR(EINVAL);
         goto finish;
     }
 
-    while (!(*finished & FINISHED_RECV) && !av_fifo_can_write(tq->fifo))
+    while (!(atomic_load(finished) & FINISHED_RECV) && !av_fifo_can_write(tq->fifo))
         pthread_cond_wait(&tq->cond, &tq->lock);
 
-    if (*finished & FINISHED_RECV) {
+    if (atomic_load(finished) & FINISHED_RECV) {
         ret = AVERROR_EOF;
-        *finished |= FINISHED_SEND;
+        atomic_fetch_or(finished, FINISHED_SEND);
     } else {
         FifoElem elem = { .stream_idx = stream_idx };
 
@@ -158,31 +266,28 @@ finish:
     return ret;
 }
 
-static int receive_locked(ThreadQueue *tq, int *stream_idx,
-                          void *data)
+int tq_send(ThreadQueue *tq, unsigned int stream_idx, void *data)
 {
-    FifoElem elem;
-    unsigned int nb_finished = 0;
+    av_assert0(stream_idx < tq->nb_streams);
 
-    while (av_fifo_read(tq->fifo, &elem, 1) >= 0) {
-        if (tq->finished[elem.stream_idx] & FINISHED_RECV) {
-            objpool_release(tq->obj_pool, &elem.obj);
-            continue;
-        }
+    return tq->ring ? send_ring  (tq, stream_idx, data) :
+                      send_locked(tq, stream_idx, data);
+}
 
-        tq->obj_move(data, elem.obj);
-        objpool_release(tq->obj_pool, &elem.obj);
-        *stream_idx = elem.stream_idx;
-        return 0;
-    }
+/* report stream EOFs once the data is drained, same as receive_locked() */
+static int receive_eof(ThreadQueue *tq, int *stream_idx)
+{
+    unsigned int nb_finished = 0;
 
     for (unsigned int i = 0; i < tq->nb_streams; i++) {
-        if (!tq->finished[i])
+        int finished = atomic_load(&tq->finished[i]);
+
+        if (!finished)
             continue;
 
         /* return EOF to the consumer at most once for each stream */
-        if (!(tq->finished[i] & FINISHED_RECV)) {
-            tq->finished[i] |= FINISHED_RECV;
+        if (!(finished & FINISHED_RECV)) {
+            atomic_fetch_or(&tq->finished[i], FINISHED_RECV);
             *stream_idx   = i;
             return AVERROR_EOF;
         }
@@ -193,12 +298,104 @@ static int receive_locked(ThreadQueue *tq, int *stream_idx,
     return nb_finished == tq->nb_streams ? AVERROR_EOF : AVERROR(EAGAIN);
 }
 
+/* whether the consumer has anything to do: either an item is available or
+ * some stream changed its finished state */
+static int ring_can_receive(ThreadQueue *tq, size_t tail)
+{
+    unsigned int nb_finished = 0;
+
+    if (atomic_load(&tq->head) != tail)
+        return 1;
+
+    for (unsigned int i = 0; i < tq->nb_streams; i++) {
+        int finished = atomic_load(&tq->finished[i]);
+
+        if (finished && !(finished & FINISHED_RECV))
+            return 1;
+        nb_finished += !!(finished & FINISHED_RECV);
+    }
+
+    return nb_finished == tq->nb_streams;
+}
+
+static int receive_ring(ThreadQueue *tq, int *stream_idx, void *data)
+{
+    while (1) {
+        size_t tail = atomic_load_explicit(&tq->tail, memory_order_relaxed);
+        int ret;
+
+        if (atomic_load(&tq->head) != tail) {
+            size_t        pos = tail % tq->ring_size;
+            unsigned int  idx = tq->ring_stream_idx[pos];
+
+            if (atomic_load(&tq->finished[idx]) & FINISHED_RECV) {
+                // drop the item; the pool resets the object on release and
+                // hands the same one back, so this cannot fail
+                objpool_release(tq->obj_pool, &tq->ring[pos]);
+                ret = objpool_get(tq->obj_pool, &tq->ring[pos]);
+                av_assert0(ret >= 0);
+            } else {
+                tq->obj_move(data, tq->ring[pos]);
+                *stream_idx = idx;
+            }
+
+            atomic_store(&tq->tail, tail + 1);
+            if (atomic_load(&tq->head) - (tail + 1) < RING_SEND_RESUME(tq))
+                ring_wake(tq);
+
+            if (*stream_idx >= 0)
+                return 0;
+            continue;
+        }
+
+        /* The producer sets FINISHED_SEND after publishing its last item, so
+         * once a finished flag is seen the ring has to be checked again. */
+        if (!ring_can_receive(tq, tail)) {
+            pthread_mutex_lock(&tq->lock);
+            while (atomic_fetch_add(&tq->nb_waiters, 1),
+                   !ring_can_receive(tq, tail))
+                pthread_cond_wait(&tq->cond, &tq->lock);
+            pthread_mutex_unlock(&tq->lock);
+            continue;
+        }
+        if (atomic_load(&tq->head) != tail)
+            continue;
+
+        ret = receive_eof(tq, stream_idx);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+    }
+}
+
+static int receive_locked(ThreadQueue *tq, int *stream_idx,
+                          void *data)
+{
+    FifoElem elem;
+
+    while (av_fifo_read(tq->fifo, &elem, 1) >= 0) {
+        if (atomic_load(&tq->finished[elem.stream_idx]) & FINISHED_RECV) {
+            objpool_release(tq->obj_pool, &elem.obj);
+            continue;
+        }
+
+        tq->obj_move(data, elem.obj);
+        objpool_release(tq->obj_pool, &elem.obj);
+        *stream_idx = elem.stream_idx;
+        return 0;
+    }
+
+    return receive_eof(tq, stream_idx);
+}
+
 int tq_receive(ThreadQueue *tq, int *stream_idx, void *data)
 {
     int ret;
 
     *stream_idx = -1;
 
+    if (tq->ring)
+        return receive_ring(tq, stream_idx, data);
+
     pthread_mutex_lock(&tq->lock);
 
     while (1) {
@@ -227,12 +424,18 @@ void tq_send_finish(ThreadQueue *tq, unsigned int stream_idx)
 {
     av_assert0(stream_idx < tq->nb_streams);
 
-    pthread_mutex_lock(&tq->lock);
-
     /* mark the stream as send-finished;
      * next time the consumer thread tries to read this stream it will get
      * an EOF and recv-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_SEND;
+    if (tq->ring) {
+        atomic_fetch_or(&tq->finished[stream_idx], FINISHED_SEND);
+        ring_wake(tq);
+        return;
+    }
+
+    pthread_mutex_lock(&tq->lock);
+
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_SEND);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
@@ -242,12 +445,18 @@ void tq_receive_finish(ThreadQueue *tq, unsigned int stream_idx)
 {
     av_assert0(stream_idx < tq->nb_streams);
 
-    pthread_mutex_lock(&tq->lock);
-
     /* mark the stream as recv-finished;
      * next time the producer thread tries to send for this stream, it will
      * get an EOF and send-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_RECV;
+    if (tq->ring) {
+        atomic_fetch_or(&tq->finished[stream_idx], FINISHED_RECV);
+        ring_wake(tq);
+        return;
+    }
+
+    pthread_mutex_lock(&tq->lock);
+
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_RECV);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
@@ -25,6 +25,19 @@
 
 typedef struct ThreadQueue ThreadQueue;
 
+enum ThreadQueueFlags {
+    /**
+     * tq_send() is never called concurrently from more than one thread.
+     * Calls from different threads are allowed as long as they are
+     * serialized externally, e.g. by a mutex. The queue then uses a lock-free
+     * ring and only blocks while it is full or empty.
+     *
+     * tq_send_finish() and tq_receive_finish() may still be called from any
+     * thread.
+     */
+    TQ_SINGLE_PRODUCER = (1 << 0),
+};
+
 /**
  * Allocate a queue for sending data between threads.
  *
@@ -32,11 +45,12 @@ typedef struct ThreadQueue ThreadQueue;
  *                   maintained
  * @param queue_size number of items that can be stored in the queue without
  *                   blocking
+ * @param flags a combination of ThreadQueueFlags
  * @param obj_pool object pool that will be used to allocate items stored in the
  *                 queue; the pool becomes owned by the queue
  * @param callback that moves the contents between two data pointers
  */
-ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
+ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size, int flags,
                       ObjPool *obj_pool, void (*obj_move)(void *dst, void *src));
 void         tq_free(ThreadQueue **tq);
 
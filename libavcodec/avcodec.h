@@ -2086,6 +2086,22 @@ typedef struct AVCodecContext {
      */
     AVFrameSideData  **decoded_side_data;
     int             nb_decoded_side_data;
+
+    /**
+     * A reference to an AVThreadPool (see libavutil/threadpool.h) to run
+     * slice threading on, instead of threads private to this context. The
+     * reference is set by the caller and afterwards owned (and freed) by
+     * libavcodec.
+     *
+     * thread_count still limits the number of threads working on this
+     * context at once; if it is 0 it defaults to the number of threads of
+     * the pool plus one. Frame threading is not affected and always uses
+     * private threads.
+     *
+     * - encoding: May be set by the caller before avcodec_open2().
+     * - decoding: May be set by the caller before avcodec_open2().
+     */
+    AVBufferRef *thread_pool;
 } AVCodecContext;
 
 /**
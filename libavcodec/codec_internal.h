@@ -88,6 +88,12 @@
  * encoders do.
  */
 #define FF_CODEC_CAP_EOF_FLUSH              (1 << 10)
+/**
+ * The slice threading jobs of the codec wait on each other, so they must all
+ * run at the same time. Such codecs always get private slice threads, even
+ * when AVCodecContext.thread_pool is set.
+ */
+#define FF_CODEC_CAP_SLICE_THREAD_SYNC      (1 << 11)
 
 /**
  * FFCodec.codec_tags termination value
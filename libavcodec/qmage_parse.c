@@ -0,0 +1,176 @@
+/*
+ * Quram Qmage header parser
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/log.h"
+
+#include "bytestream.h"
+#include "get_bits.h"
+#include "qmage_parse.h"
+
+int ff_qmage_parse_header(FFQmageHeader *h, const uint8_t *buf, int size, void *logctx)
+{
+    GetByteContext gb;
+    int header_end;
+
+    if (size < 12)
+        return 0;
+
+    bytestream2_init(&gb, buf, size);
+    if (bytestream2_get_be16u(&gb) != QMAGE_MAGIC) {
+        av_log(logctx, AV_LOG_ERROR, "bad magic number\n");
+        return AVERROR_INVALIDDATA;
+    }
+
+    h->qversion = bytestream2_get_byteu(&gb);
+    if (h->qversion < QVERSION_1_43_LESS) {
+        avpriv_request_sample(logctx, "qversion=0x%x", h->qversion);
+        return AVERROR_PATCHWELCOME;
+    }
+
+    h->raw_type = bytestream2_get_byteu(&gb);
+    switch (h->raw_type) {
+    case 0: //RGB565
+        h->transparency = 0;
+        break;
+    case 3: //RGBA5658
+    case 6: //RGBA
+        h->transparency = 1;
+        break;
+    default:
+        avpriv_request_sample(logctx, "raw_type=%d", h->raw_type);
+        return AVERROR_PATCHWELCOME;
+    }
+
+    h->flags4 = bytestream2_get_byteu(&gb);
+    h->mode   = !!(h->flags4 & 0x80);
+    if (h->mode)
+        h->header_size = 24;
+    else
+        h->header_size = h->transparency ? 16 : 12;
+
+    /* stills of newer versions always carry the alpha position */
+    header_end = h->mode ? 24 : h->qversion > QVERSION_1_43_LESS ? 16 : h->header_size;
+    if (size < header_end)
+        return 0;
+
+    h->flags5  = bytestream2_get_byteu(&gb);
+    h->width   = bytestream2_get_le16u(&gb);
+    h->height  = bytestream2_get_le16u(&gb);
+    h->flags10 = bytestream2_get_byteu(&gb);
+    h->flags11 = bytestream2_get_byteu(&gb);
+
+    h->flags14 = 0;
+    h->alpha_position = 0;
+    if (h->qversion == QVERSION_1_43_LESS) {
+        if (h->transparency || h->mode)
+            h->alpha_position = bytestream2_get_le32u(&gb);
+    } else {
+        h->alpha_position = bytestream2_get_le16u(&gb);
+        h->flags14 = bytestream2_get_byteu(&gb);
+        bytestream2_skipu(&gb, 1);
+    }
+
+    if (h->mode) {
+        h->total_frame_number   = bytestream2_get_le16u(&gb);
+        h->current_frame_number = bytestream2_get_le16u(&gb);
+        h->animation_delay_time = bytestream2_get_le16u(&gb);
+        h->animation_no_repeat  = bytestream2_get_byteu(&gb);
+        bytestream2_skipu(&gb, 1);
+    } else {
+        h->total_frame_number = h->current_frame_number = 1;
+    }
+
+    if (h->qversion > QVERSION_1_43_LESS) {
+        if (!h->mode || h->current_frame_number <= 1)
+            h->alpha_position *= 4;
+    }
+
+    if (h->mode && h->alpha_position <= h->header_size) {
+        av_log(logctx, AV_LOG_ERROR, "invalid alpha position %d\n", h->alpha_position);
+        return AVERROR_INVALIDDATA;
+    }
+
+    return bytestream2_tell(&gb);
+}
+
+int ff_qmage_a9ll_alpha_size(const uint8_t *buf, int size, int width, int height,
+                             void *logctx)
+{
+    GetBitContext gb1, gb2;
+    const uint8_t *p, *end = buf + size;
+    int len1, len2, ret;
+
+    /* the plane is coded in 4x4 blocks of pixel pairs, like the color plane */
+    if (width & 1) {
+        avpriv_request_sample(logctx, "alpha with odd width");
+        return AVERROR_PATCHWELCOME;
+    }
+    width >>= 1;
+
+    if (size < 8)
+        return 0;
+
+    len1 = AV_RL32(buf);
+    len2 = AV_RL32(buf + 4);
+    if (len1 < 8 || len2 < 8 || len1 > len2)
+        return AVERROR_INVALIDDATA;
+    if (size < len2)
+        return 0;
+
+    if ((ret = init_get_bits8(&gb1, buf + 8, len1 - 8)) < 0)
+        return ret;
+    if ((ret = init_get_bits8(&gb2, buf + len1, len2 - len1)) < 0)
+        return ret;
+    p = buf + len2;
+
+    for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
+            int cbp, nb_pixels;
+            if (get_bits(&gb1, 2) == 3)
+                continue;
+            if (end - p < 2)
+                return 0;
+            cbp = AV_RL16(p);
+            p  += 2;
+            /* edge blocks only code the pixels inside the picture */
+            nb_pixels = FFMIN(width - x, 4) * FFMIN(height - y, 4);
+            for (int k = 0; k < nb_pixels; k++) {
+                if (!(cbp & (1 << k))) {
+                    int nb_bits = get_bits(&gb2, 3);
+                    if (nb_bits == 7) {
+                        if (end - p < 2)
+                            return 0;
+                        p += 2;
+                    } else {
+                        skip_bits(&gb1, nb_bits + 1);
+                    }
+                }
+            }
+        }
+    }
+
+    return FFALIGN(p - buf, 4);
+}
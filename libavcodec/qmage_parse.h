@@ -0,0 +1,64 @@
+/*
+ * Quram Qmage header parser
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVCODEC_QMAGE_PARSE_H
+#define AVCODEC_QMAGE_PARSE_H
+
+#include <stdint.h>
+
+#define QMAGE_MAGIC           0x514d
+#define QVERSION_1_43_LESS    0xb
+#define QMAGE_HEADER_SIZE_MAX 24
+
+typedef struct FFQmageHeader {
+    int qversion;
+    int raw_type;
+    int transparency;
+    int mode;
+    int width;
+    int height;
+    int alpha_position;
+    int total_frame_number;
+    int current_frame_number;
+    int animation_delay_time;
+    int animation_no_repeat;
+    int header_size;
+
+    /* flag bytes only interpreted by the decoder */
+    uint8_t flags4, flags5, flags10, flags11, flags14;
+} FFQmageHeader;
+
+/*
+ * Parse the frame header at buf.
+ * Returns the number of bytes read, 0 if more data is needed,
+ * or a negative error code.
+ */
+int ff_qmage_parse_header(FFQmageHeader *h, const uint8_t *buf, int size, void *logctx);
+
+/*
+ * Walk the A9LL coded alpha plane of an animation keyframe, which does not
+ * store its size. buf points at the start of the alpha data.
+ * Returns the size of the alpha data, 0 if more data is needed,
+ * or a negative error code.
+ */
+int ff_qmage_a9ll_alpha_size(const uint8_t *buf, int size, int width, int height,
+                             void *logctx);
+
+#endif /* AVCODEC_QMAGE_PARSE_H */
@@ -0,0 +1,163 @@
+/*
+ * Quram Qmage parser
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Qmage parser
+ *
+ * Qmage frames do not carry their size. It is derived from the frame
+ * header, and for animation keyframes with alpha from a walk over the
+ * A9LL alpha bitstream, both of which need the start of the frame in
+ * one piece: until the size is known, it is computed from the data
+ * buffered in the ParseContext. Stills run to the end of the input.
+ */
+
+#include "libavutil/intreadwrite.h"
+
+#include "parser.h"
+#include "qmage_parse.h"
+
+typedef struct QmageParseContext {
+    ParseContext pc;
+    int next_try;           ///< buffered size at which to retry the size computation
+    int frame_size;         ///< 0 if not known yet
+    int frame_pos;          ///< bytes of the current frame seen so far
+    int key_frame;
+    int delay;
+} QmageParseContext;
+
+/* returns the size of the frame at buf, or 0 if it is not known yet */
+static int qmage_frame_size(QmageParseContext *q, const uint8_t *buf, int size,
+                            void *logctx)
+{
+    FFQmageHeader h;
+    int alpha_size, ret;
+
+    ret = ff_qmage_parse_header(&h, buf, size, logctx);
+    if (ret <= 0)
+        return ret;
+
+    q->key_frame = h.current_frame_number <= 1;
+    q->delay     = h.mode ? h.animation_delay_time : 0;
+    if (!h.mode)
+        return 0;
+    if (!h.transparency)
+        return h.alpha_position;
+
+    if (size < h.alpha_position + 4)
+        return 0;
+    if (h.current_frame_number == 1) {
+        alpha_size = ff_qmage_a9ll_alpha_size(buf + h.alpha_position, size - h.alpha_position,
+                                              h.width, h.height, logctx);
+        if (alpha_size <= 0)
+            return alpha_size;
+    } else {
+        alpha_size = AV_RL32(buf + h.alpha_position);
+        if (alpha_size < 4)
+            return AVERROR_INVALIDDATA;
+    }
+    if (alpha_size > INT_MAX - h.alpha_position)
+        return AVERROR_INVALIDDATA;
+
+    return h.alpha_position + alpha_size;
+}
+
+/* next may be negative if the frame ended in already buffered data */
+static int qmage_find_frame_end(QmageParseContext *q, const uint8_t *buf,
+                                int buf_size, void *logctx)
+{
+    ParseContext *pc = &q->pc;
+    int next;
+
+    if (!q->frame_size) {
+        /* the start of the frame is either left over from the previous
+         * frame, or buffered from previous calls, or at buf */
+        const uint8_t *data = pc->overread ? pc->buffer + pc->overread_index : pc->buffer;
+        int size = pc->overread ? pc->overread : pc->index;
+
+        q->frame_pos = size;
+        if (!size) {
+            data = buf;
+            size = buf_size;
+        }
+
+        /* the alpha walk restarts from the beginning, so only retry it
+         * once the buffered data has grown substantially */
+        if (size && size >= q->next_try) {
+            int ret = qmage_frame_size(q, data, size, logctx);
+            if (ret < 0) {
+                av_log(logctx, AV_LOG_ERROR, "invalid frame header\n");
+                q->next_try = INT_MAX;
+            } else {
+                q->frame_size = ret;
+                q->next_try   = size + FFMAX(size / 2, 1);
+            }
+        }
+    }
+
+    if (q->frame_size && q->frame_size - q->frame_pos <= buf_size) {
+        next = q->frame_size - q->frame_pos;
+        q->frame_size = q->next_try = 0;
+        return next;
+    }
+
+    q->frame_pos += buf_size;
+    /* at the end of the input, whatever is buffered makes up the frame */
+    if (!buf_size)
+        q->frame_size = q->next_try = 0;
+    return END_NOT_FOUND;
+}
+
+static int qmage_parse(AVCodecParserContext *s, AVCodecContext *avctx,
+                       const uint8_t **poutbuf, int *poutbuf_size,
+                       const uint8_t *buf, int buf_size)
+{
+    QmageParseContext *q = s->priv_data;
+    int next;
+
+    *poutbuf_size = 0;
+    *poutbuf = NULL;
+
+    if (s->flags & PARSER_FLAG_COMPLETE_FRAMES) {
+        next = buf_size;
+        qmage_frame_size(q, buf, buf_size, avctx);
+    } else {
+        next = qmage_find_frame_end(q, buf, buf_size, avctx);
+        if (ff_combine_frame(&q->pc, next, &buf, &buf_size) < 0)
+            return buf_size;
+        if (!buf_size)
+            return 0;
+    }
+
+    s->duration  = q->delay > 0 ? q->delay : 1;
+    s->key_frame = q->key_frame;
+    s->pict_type = q->key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_P;
+
+    *poutbuf      = buf;
+    *poutbuf_size = buf_size;
+    return next;
+}
+
+const AVCodecParser ff_qmage_parser = {
+    .codec_ids      = { AV_CODEC_ID_QMAGE },
+    .priv_data_size = sizeof(QmageParseContext),
+    .parser_parse   = qmage_parse,
+    .parser_close   = ff_parse_close,
+};
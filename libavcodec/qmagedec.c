@@ -27,16 +27,38 @@
 #include "copy_block.h"
 #include "decode.h"
 #include "get_bits.h"
+#include "libavutil/buffer.h"
+#include "libavutil/imgutils.h"
 #include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "progressframe.h"
+#include "qmage_parse.h"
 #include "qmagedata.h"
+#include "thread.h"
 
-#define QMAGE_MAGIC 0x514d
-#define QVERSION_1_43_LESS 0xb
 #define QCODEC_V16_SHORT_INDEX  0
 #define QCODEC_W2_PASS 1
 
+#define W2_BAND_MIN_HEIGHT 16
+
 typedef struct {
-    AVFrame * last_frame;
+    const AVClass * class;
+    int inplace;
+    int alpha;
+
+    ProgressFrame last_frame;
+    ProgressFrame frame;
+
+    uint8_t * shadow;
+    unsigned int shadow_size;
+    uint8_t * dirty;
+    unsigned int dirty_size;
+    int mb_width;
+
+    int alpha_out;
+    AVBufferPool * pool;
+    int pool_size;
+    uint32_t unpremultiply[256];
 
     int qversion;
 
@@ -78,6 +100,14 @@ typedef struct {
     int header_size;
 
     int color_count;
+
+    struct W2Band * w2_bands;
+    unsigned int w2_bands_size;
+    int * w2_rets;
+    unsigned int w2_rets_size;
+
+    uint8_t * w2_buf;           ///< depth 2 intermediate, reused across frames
+    unsigned int w2_buf_size;
 } Context;
 
 static void dump(AVCodecContext *avctx)
@@ -117,104 +147,60 @@ static void dump(AVCodecContext *avctx)
 static int decode_header(AVCodecContext *avctx, AVPacket *avpkt)
 {
     Context * ctx = avctx->priv_data;
+    FFQmageHeader h;
     GetByteContext gb;
-    int flags4, flags5, flags10, flags11;
+    int ret;
 
-    if (avpkt->size < 12)
+    ret = ff_qmage_parse_header(&h, avpkt->data, avpkt->size, avctx);
+    if (!ret)
         return AVERROR_INVALIDDATA;
+    if (ret < 0)
+        return ret;
 
-    bytestream2_init(&gb, avpkt->data, avpkt->size);
+    ctx->qversion = h.qversion;
+    ctx->raw_type = h.raw_type;
+    ctx->transparency = h.transparency;
 
-    if (bytestream2_get_be16(&gb) != QMAGE_MAGIC) {
-        av_log(avctx, AV_LOG_ERROR, "bad magic number\n");
-        return AVERROR_INVALIDDATA;
-    }
+    ctx->qp = h.flags4 & 0x1f;
+    ctx->not_comp = !!(h.flags4 & 0x20);
+    ctx->use_chroma_key = !!(h.flags4 & 0x40);
+    ctx->mode = h.mode;
 
-    ctx->qversion = bytestream2_get_byte(&gb);
-
-    ctx->raw_type = bytestream2_get_byte(&gb);
-    switch (ctx->raw_type) {
-    case 0: //RGB565
-        ctx->transparency = 0;
-        break;
-    case 3: //RGBA5658
-    case 6: //RGBA
-        ctx->transparency = 1;
-        break;
-    default:
-        avpriv_request_sample(avctx, "raw_type=%d", ctx->raw_type);
-        return AVERROR_PATCHWELCOME;
-    }
-
-    flags4 = bytestream2_get_byte(&gb);
-    ctx->qp = flags4 & 0x1f;
-    ctx->not_comp = !!(flags4 & 0x20);
-    ctx->use_chroma_key = !!(flags4 & 0x40);
-    ctx->mode = !!(flags4 & 0x80);
-
-    flags5 = bytestream2_get_byte(&gb);
     if (ctx->qversion == QVERSION_1_43_LESS)
-        ctx->encoder_mode = flags5 & 0x7;
-    else if (ctx->qversion > QVERSION_1_43_LESS)
-        ctx->encoder_mode = flags5 & 0xf;
+        ctx->encoder_mode = h.flags5 & 0x7;
     else
-        ctx->encoder_mode = 0;
-    if (ctx->qversion > QVERSION_1_43_LESS)
-        ctx->is_dynamic_table = !!(flags5 & 0x10);
-    else
-        ctx->is_dynamic_table = 0;
-    ctx->alpha_depth = (flags5 & 0x20) ? 2 : 1;
-    ctx->depth = (flags5 & 0x40) ? 2 : 1;
-    ctx->use_extra_exception = !!(flags5 & 0x80);
-
-    ctx->width = bytestream2_get_le16(&gb);
-    ctx->height = bytestream2_get_le16(&gb);
-
-    flags10 = bytestream2_get_byte(&gb);
-    ctx->near_lossless = !!(flags10 & 0x40);
-
-    flags11 = bytestream2_get_byte(&gb);
-    ctx->android_support = !!(flags11 & 0x4);
-    ctx->is_gray_type = !!(flags11 & 0x4);
-    ctx->use_index_color = !!(flags11 & 0x8);
-    ctx->pre_multiplied = !!(flags11 & 0x10);
-    ctx->not_alpha_comp  = !!(flags11 & 0x40);
-    ctx->is_opaque = !!(flags11 & 0x20);
-    ctx->nine_patched = !!(flags11 & 0x80);
-
-    if (ctx->qversion == QVERSION_1_43_LESS) {
-        if (ctx->transparency || ctx->mode)
-            ctx->alpha_position = bytestream2_get_le32(&gb);
+        ctx->encoder_mode = h.flags5 & 0xf;
+    ctx->is_dynamic_table = ctx->qversion > QVERSION_1_43_LESS && (h.flags5 & 0x10);
+    ctx->alpha_depth = (h.flags5 & 0x20) ? 2 : 1;
+    ctx->depth = (h.flags5 & 0x40) ? 2 : 1;
+    ctx->use_extra_exception = !!(h.flags5 & 0x80);
+
+    ctx->width = h.width;
+    ctx->height = h.height;
+
+    ctx->near_lossless = !!(h.flags10 & 0x40);
+
+    ctx->android_support = !!(h.flags11 & 0x4);
+    ctx->is_gray_type = !!(h.flags11 & 0x4);
+    ctx->use_index_color = !!(h.flags11 & 0x8);
+    ctx->pre_multiplied = !!(h.flags11 & 0x10);
+    ctx->not_alpha_comp  = !!(h.flags11 & 0x40);
+    ctx->is_opaque = !!(h.flags11 & 0x20);
+    ctx->nine_patched = !!(h.flags11 & 0x80);
+
+    ctx->alpha_position = h.alpha_position;
+    if (ctx->qversion == QVERSION_1_43_LESS)
         ctx->alpha_encoder_mode = ctx->encoder_mode;
-    } else if (ctx->qversion > QVERSION_1_43_LESS) {
-        int flags14;
-        ctx->alpha_position = bytestream2_get_le16(&gb);
-        flags14 = bytestream2_get_byte(&gb);
-        ctx->alpha_encoder_mode = flags14 & 0xf;
-        bytestream2_skip(&gb, 1);
-    }
-
-    if (ctx->mode) {
-        ctx->total_frame_number = bytestream2_get_le16(&gb);
-        ctx->current_frame_number = bytestream2_get_le16(&gb);
-        ctx->animation_delay_time = bytestream2_get_le16(&gb);
-        ctx->animation_no_repeat = bytestream2_get_byte(&gb);
-        bytestream2_skip(&gb, 1);
-    } else {
-        ctx->total_frame_number = ctx->current_frame_number = 1;
-    }
-
-    if (ctx->qversion > QVERSION_1_43_LESS) {
-        if (!ctx->mode || ctx->current_frame_number <= 1)
-            ctx->alpha_position *= 4;
-    }
+    else
+        ctx->alpha_encoder_mode = h.flags14 & 0xf;
 
-    if (ctx->mode) {
-        ctx->header_size = 24;
-    } else {
-        ctx->header_size = ctx->transparency ? 16 : 12;
-    }
+    ctx->total_frame_number = h.total_frame_number;
+    ctx->current_frame_number = h.current_frame_number;
+    ctx->animation_delay_time = h.animation_delay_time;
+    ctx->animation_no_repeat = h.animation_no_repeat;
+    ctx->header_size = h.header_size;
 
+    bytestream2_init(&gb, avpkt->data + ret, avpkt->size - ret);
     if (ctx->use_index_color) {
         if (ctx->nine_patched)
             bytestream2_skip(&gb, 4);
@@ -226,17 +212,17 @@ static int decode_header(AVCodecContext *avctx, AVPacket *avpkt)
     return 0;
 }
 
-static uint16_t get_pixel(AVCodecContext * avctx, const uint8_t * src, int linesize, int x, int y)
+static uint16_t get_pixel(const uint8_t * src, int linesize, int x, int y, int width, int height)
 {
-    if (x >= 0 && x < avctx->width && y >= 0 && y < avctx->height)
+    if (x >= 0 && x < width && y >= 0 && y < height)
         return AV_RN16A(src + y*linesize + x*2);
     return 0;
 }
 
-static void decode_pixel_inter(AVCodecContext * avctx, int copy, const uint16_t * ori_delta, GetBitContext * gb1, GetBitContext *gb2, GetByteContext * gb3, uint8_t * dst, const uint8_t * ref, int ref_linesize, int ref_x, int ref_y)
+static void decode_pixel_inter(int width, int height, int copy, const uint16_t * ori_delta, GetBitContext * gb1, GetBitContext *gb2, GetByteContext * gb3, uint8_t * dst, const uint8_t * ref, int ref_linesize, int ref_x, int ref_y)
 {
     if (copy) {
-        AV_WN16A(dst, get_pixel(avctx, ref, ref_linesize, ref_x, ref_y));
+        AV_WN16A(dst, get_pixel(ref, ref_linesize, ref_x, ref_y, width, height));
     } else {
         int nb_bits = get_bits(gb2, 3);
         if (nb_bits == 7) {
@@ -244,7 +230,7 @@ static void decode_pixel_inter(AVCodecContext * avctx, int copy, const uint16_t
         } else {
             int idx = get_bits(gb1, nb_bits + 1);
             uint16_t delta = ori_delta[idx + (2 << nb_bits) - 2];
-            AV_WN16A(dst, get_pixel(avctx, ref, ref_linesize, ref_x, ref_y) + delta);
+            AV_WN16A(dst, get_pixel(ref, ref_linesize, ref_x, ref_y, width, height) + delta);
         }
     }
 }
@@ -256,7 +242,97 @@ static void copy_edge(uint8_t * dst, int linesize, int width, int height)
             AV_WN16A(dst + j*linesize + i*2, AV_RN16A(dst + j*linesize - 2));
 }
 
-static int decode_a9ll(AVCodecContext *avctx, uint8_t * data, int size, uint8_t * dst, int dst_linesize)
+/* Pixel codes of a 4x4 block are parsed into (mask, delta) pairs, so that the
+ * pixel is reconstructed as (pred & mask) + delta. Copied pixels have a zero
+ * delta and escaped pixels a zero mask. */
+static void parse_block_cbp(GetBitContext * gb1, GetBitContext * gb2, GetByteContext * gb3, int cbp, const uint16_t * ori_delta, uint16_t * mask, uint16_t * delta)
+{
+    for (int k = 0; k < 16; k++) {
+        if (cbp & (1 << k)) {
+            mask[k]  = 0xffff;
+            delta[k] = 0;
+        } else {
+            int nb_bits = get_bits(gb2, 3);
+            if (nb_bits == 7) {
+                mask[k]  = 0;
+                delta[k] = bytestream2_get_le16(gb3);
+            } else {
+                int idx = get_bits(gb1, nb_bits + 1);
+                mask[k]  = 0xffff;
+                delta[k] = ori_delta[idx + (2 << nb_bits) - 2];
+            }
+        }
+    }
+}
+
+static void parse_block(GetBitContext * gb1, GetByteContext * gb2, const uint16_t * ori_delta, uint16_t * mask, uint16_t * delta)
+{
+    for (int k = 0; k < 16; k++) {
+        if (get_bits1(gb1)) {
+            mask[k]  = 0xffff;
+            delta[k] = 0;
+        } else {
+            int nb_bits = get_bits(gb1, 3);
+            if (nb_bits == 7) {
+                mask[k]  = 0;
+                delta[k] = bytestream2_get_le16(gb2);
+            } else {
+                int idx = get_bits(gb1, nb_bits + 1);
+                mask[k]  = 0xffff;
+                delta[k] = ori_delta[idx + (2 << nb_bits) - 2];
+            }
+        }
+    }
+}
+
+/* Rows are processed top to bottom, so pred may point into dst one row
+ * above the block. */
+static av_always_inline void add_pred4x4(uint8_t * dst, ptrdiff_t dst_linesize,
+                                         const uint8_t * pred, ptrdiff_t pred_linesize,
+                                         const uint16_t * mask, const uint16_t * delta)
+{
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 4; i++)
+            AV_WN16A(dst + i*2, (AV_RN16A(pred + i*2) & mask[i]) + delta[i]);
+        dst   += dst_linesize;
+        pred  += pred_linesize;
+        mask  += 4;
+        delta += 4;
+    }
+}
+
+/* Reconstructs the 4x4 block at dst, predicted from (ref_x, ref_y) in ref.
+ * Prediction from the left neighbour depends on the pixels being written and
+ * takes the serial path, as do blocks predicted from outside the picture. */
+static void reconstruct_block(AVCodecContext * avctx, int width, int height, uint8_t * dst, int linesize,
+                              const uint8_t * ref, int ref_linesize, int ref_x, int ref_y,
+                              int serial, const uint16_t * mask, const uint16_t * delta)
+{
+    if (!serial && ref_x >= 0 && ref_x + 4 <= width &&
+                   ref_y >= 0 && ref_y + 4 <= height) {
+        add_pred4x4(dst, linesize, ref + ref_y*ref_linesize + ref_x*2, ref_linesize, mask, delta);
+        return;
+    }
+
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            AV_WN16A(dst + j*linesize + i*2,
+                     (get_pixel(ref, ref_linesize, ref_x + i, ref_y + j, width, height) & mask[j*4 + i]) + delta[j*4 + i]);
+}
+
+static void decode_intra_block(AVCodecContext * avctx, GetBitContext * gb1, GetByteContext * gb2, const uint16_t * ori_delta, int mode, int x, int y, uint8_t * dst, int linesize)
+{
+    uint16_t mask[16], delta[16];
+
+    parse_block(gb1, gb2, ori_delta, mask, delta);
+    reconstruct_block(avctx, avctx->width, avctx->height, dst + y*linesize + x*2, linesize, dst, linesize,
+                      x + qmage_dir[mode].x, y + qmage_dir[mode].y, mode == 0, mask, delta);
+}
+
+/* hdr is the offset of the stream offsets within data; the alpha plane is
+ * coded like the color plane, as pairs of 8-bit values */
+static int decode_a9ll(AVCodecContext *avctx, const uint8_t * data, int size, int hdr, int dynamic_table,
+                       int width, int height, uint8_t * dst, int dst_linesize, ProgressFrame * progress)
 {
     Context * s = avctx->priv_data;
     GetBitContext gb1, gb2;
@@ -265,19 +341,19 @@ static int decode_a9ll(AVCodecContext *avctx, uint8_t * data, int size, uint8_t
     const uint16_t * ori_delta;
     uint16_t ori_delta_local[512];
 
-    if (size < s->header_size + 8)
+    if (size < hdr + 8)
         return AVERROR_INVALIDDATA;
-    gb1_start = AV_RL32(data + s->header_size);
-    gb3_start = AV_RL32(data + s->header_size + 4);
-    if (gb1_start < s->header_size + 8 || gb1_start > size || gb3_start < s->header_size + 8 || gb3_start > size)
+    gb1_start = AV_RL32(data + hdr);
+    gb3_start = AV_RL32(data + hdr + 4);
+    if (gb1_start < hdr + 8 || gb1_start > size || gb3_start < hdr + 8 || gb3_start > size)
         return AVERROR_INVALIDDATA;
-    if ((ret = init_get_bits8(&gb1, data + s->header_size + 8, size - s->header_size - 8)) < 0)
+    if ((ret = init_get_bits8(&gb1, data + hdr + 8, size - hdr - 8)) < 0)
         return ret;
     if ((ret = init_get_bits8(&gb2, data + gb1_start, size - gb1_start)) < 0)
         return ret;
     bytestream2_init(&gb3, data + gb3_start, size - gb3_start);
 
-    if (s->is_dynamic_table) {
+    if (dynamic_table) {
         uint8_t sign[512];
         for (int i = 0; i < 512; i++)
             sign[i] = bytestream2_get_byte(&gb3);
@@ -294,16 +370,22 @@ static int decode_a9ll(AVCodecContext *avctx, uint8_t * data, int size, uint8_t
         return AVERROR_INVALIDDATA;
     }
 
-    for (int y = 0; y < avctx->height; y += 4) {
-        for (int x = 0; x < avctx->width; x += 4) {
+    for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
             int mode = get_bits(&gb1, 2);
-            if (mode < 3) {
+            if (mode < 3 && x + 4 <= width && y + 4 <= height) {
+                uint16_t mask[16], delta[16];
+                int cbp = bytestream2_get_le16(&gb3);
+                parse_block_cbp(&gb1, &gb2, &gb3, cbp, ori_delta, mask, delta);
+                reconstruct_block(avctx, width, height, dst + y*dst_linesize + x*2, dst_linesize, dst, dst_linesize,
+                                  x + qmage_dir[mode].x, y + qmage_dir[mode].y, mode == 0, mask, delta);
+            } else if (mode < 3) {
                 int cbp = bytestream2_get_le16(&gb3);
                 int k = 0;
                 for (int j = 0; j < 4; j++) {
                     for (int i = 0; i < 4; i++) {
-                        if (x + i < avctx->width && y + j < avctx->height) {
-                            decode_pixel_inter(avctx, cbp & (1 << k), ori_delta, &gb1, &gb2, &gb3,
+                        if (x + i < width && y + j < height) {
+                            decode_pixel_inter(width, height, cbp & (1 << k), ori_delta, &gb1, &gb2, &gb3,
                                                dst + (y+j)*dst_linesize + (x+i)*2,
                                                dst, dst_linesize,
                                                x+i+qmage_dir[mode].x, y+j+qmage_dir[mode].y);
@@ -314,9 +396,11 @@ static int decode_a9ll(AVCodecContext *avctx, uint8_t * data, int size, uint8_t
             } else {
                 if (x > 0)
                     copy_edge(dst + y*dst_linesize + x*2, dst_linesize,
-                              FFMIN(avctx->width - x, 4), FFMIN(avctx->height - y, 4));
+                              FFMIN(width - x, 4), FFMIN(height - y, 4));
             }
         }
+        if (progress && !((y + 4) & 15))
+            ff_progress_frame_report(progress, y + 4);
     }
 
     return 0;
@@ -333,19 +417,46 @@ static void copy_block16x16(uint8_t * dst, int dst_linesize, const uint8_t * ref
     copy_block16(dst + 16, ref + 16, dst_linesize, ref_linesize, 16);
 }
 
-static void decode_pixel(AVCodecContext * avctx, GetBitContext * gb1, GetByteContext * gb2, const uint16_t * ori_delta, uint8_t * dst, const uint8_t * ref, int ref_linesize, int ref_x, int ref_y)
+/* In-place decoding overwrites the reference picture. Each macroblock is saved
+ * to the shadow buffer before it is first written, and motion compensated reads
+ * take the saved pixels for such macroblocks. */
+static void mark_dirty(AVCodecContext *avctx, const uint8_t * dst, int linesize, int x, int y)
 {
-    int skip = get_bits1(gb1);
-    if (skip) {
-        AV_WN16A(dst, get_pixel(avctx, ref, ref_linesize, ref_x, ref_y));
-    } else {
-        int nb_bits = get_bits(gb1, 3);
-        if (nb_bits == 7) {
-            AV_WN16A(dst, bytestream2_get_le16(gb2));
-        } else {
-            int idx = get_bits(gb1, nb_bits + 1);
-            uint16_t delta = ori_delta[idx + (2 << nb_bits) - 2];
-            AV_WN16A(dst, get_pixel(avctx, ref, ref_linesize, ref_x, ref_y) + delta);
+    Context * s = avctx->priv_data;
+    int w = FFMIN(avctx->width - x, 16);
+    int h = FFMIN(avctx->height - y, 16);
+
+    s->dirty[(y >> 4) * s->mb_width + (x >> 4)] = 1;
+    for (int j = 0; j < h; j++)
+        memcpy(s->shadow + (y+j)*linesize + x*2, dst + (y+j)*linesize + x*2, w*2);
+}
+
+static int is_dirty(AVCodecContext *avctx, int x, int y, int w, int h)
+{
+    Context * s = avctx->priv_data;
+    int x0 = FFMAX(x, 0), x1 = FFMIN(x + w, avctx->width) - 1;
+    int y0 = FFMAX(y, 0), y1 = FFMIN(y + h, avctx->height) - 1;
+
+    for (int mby = y0 >> 4; mby <= y1 >> 4; mby++)
+        for (int mbx = x0 >> 4; mbx <= x1 >> 4; mbx++)
+            if (s->dirty[mby * s->mb_width + mbx])
+                return 1;
+    return 0;
+}
+
+/* gathers the reference block at (x,y); pixels outside the picture read as zero */
+static void gather_ref_block(AVCodecContext *avctx, const uint8_t * ref, int ref_linesize, int x, int y, int w, int h, uint16_t * tmp)
+{
+    Context * s = avctx->priv_data;
+
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++) {
+            int rx = x + i, ry = y + j;
+            const uint8_t * src = ref;
+            if (rx >= 0 && rx < avctx->width && ry >= 0 && ry < avctx->height &&
+                s->dirty[(ry >> 4) * s->mb_width + (rx >> 4)])
+                src = s->shadow;
+            tmp[j*w + i] = get_pixel(src, ref_linesize, rx, ry, avctx->width, avctx->height);
         }
     }
 }
@@ -356,37 +467,45 @@ static void decode_block3_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByt
     int mode = get_bits(gb1, 3);
     if (s->qp == 0 || get_bits1(gb1)) {
         if (mode < 3) {
-            for (int j = 0; j < 4; j++)
-                for (int i = 0; i < 4; i++)
-                    decode_pixel(avctx, gb1, gb2, ori_delta,
-                                 dst + (y+j)*linesize + (x+i)*2,
-                                 dst, linesize, x+i+qmage_dir[mode].x, y+j+qmage_dir[mode].y);
+            decode_intra_block(avctx, gb1, gb2, ori_delta, mode, x, y, dst, linesize);
         } else if (mode == 3) {
             if (x > 0)
                 copy_edge(dst + y*linesize + x*2, linesize, 4, 4);
         } else if (mode == 4) {
-            for (int j = 0; j < 4; j++)
-                for (int i = 0; i < 4; i++)
-                    decode_pixel(avctx, gb1, gb2, ori_delta,
-                                 dst + (y+j)*linesize + (x+i)*2,
-                                 ref, ref_linesize, x+i, y+j);
+            uint16_t mask[16], delta[16];
+            parse_block(gb1, gb2, ori_delta, mask, delta);
+            reconstruct_block(avctx, avctx->width, avctx->height, dst + y*linesize + x*2, linesize, ref, ref_linesize, x, y, 0, mask, delta);
         } else if (mode == 5) {
-            copy_block4x4(dst + y*linesize + x*2, linesize,
-                          ref + y*ref_linesize + x*2, ref_linesize);
+            if (dst != ref)
+                copy_block4x4(dst + y*linesize + x*2, linesize,
+                              ref + y*ref_linesize + x*2, ref_linesize);
         } else if (mode == 6) {
-            for (int j = 0; j < 4; j++)
-                for (int i = 0; i < 4; i++)
-                    decode_pixel(avctx, gb1, gb2, ori_delta,
-                                 dst + (y+j)*linesize + (x+i)*2,
-                                 ref, ref_linesize, x+i+mv_x, y+j+mv_y);
+            uint16_t tmp[16], mask[16], delta[16];
+            const uint8_t * src = ref;
+            int ref_x = x + mv_x, ref_y = y + mv_y;
+            if (dst == ref && is_dirty(avctx, ref_x, ref_y, 4, 4)) {
+                gather_ref_block(avctx, ref, ref_linesize, ref_x, ref_y, 4, 4, tmp);
+                src = (const uint8_t *)tmp;
+                ref_linesize = 8;
+                ref_x = ref_y = 0;
+            }
+            parse_block(gb1, gb2, ori_delta, mask, delta);
+            reconstruct_block(avctx, avctx->width, avctx->height, dst + y*linesize + x*2, linesize, src, ref_linesize, ref_x, ref_y, 0, mask, delta);
         } else {
+            uint16_t tmp[16];
+            const uint8_t * src;
             if (x+mv_x < 0 || x+mv_x+4 > avctx->width ||
                 y+mv_y < 0 || y+mv_y+4 > avctx->height) {
                 av_log(avctx, AV_LOG_WARNING, "offscreen mv");
                 return;
             }
-            copy_block4x4(dst + y*linesize + x*2, linesize,
-                          ref + (y+mv_y)*ref_linesize + (x+mv_x)*2, ref_linesize);
+            src = ref + (y+mv_y)*ref_linesize + (x+mv_x)*2;
+            if (dst == ref && is_dirty(avctx, x+mv_x, y+mv_y, 4, 4)) {
+                gather_ref_block(avctx, ref, ref_linesize, x+mv_x, y+mv_y, 4, 4, tmp);
+                src = (const uint8_t *)tmp;
+                ref_linesize = 8;
+            }
+            copy_block4x4(dst + y*linesize + x*2, linesize, src, ref_linesize);
         }
     } else {
         avpriv_request_sample(avctx, "qp");
@@ -399,11 +518,7 @@ static void decode_block2_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByt
     int mode = get_bits(gb1, 2);
     if (s->qp == 0 || get_bits1(gb1)) {
         if (mode < 3) {
-            for (int j = 0; j < 4; j++)
-                for (int i = 0; i < 4; i++)
-                    decode_pixel(avctx, gb1, gb2, ori_delta,
-                                 dst + (y+j)*linesize + (x+i)*2,
-                                 dst, linesize, x+i+qmage_dir[mode].x, y+j+qmage_dir[mode].y);
+            decode_intra_block(avctx, gb1, gb2, ori_delta, mode, x, y, dst, linesize);
         } else {
             if (x > 0)
                 copy_edge(dst + y*linesize + x*2, linesize, 4, 4);
@@ -417,7 +532,8 @@ static int decode_mb_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByteCont
 {
    if (get_bits1(gb1)) {
        if (get_bits1(gb1)) {
-           copy_block16x16(dst + y*linesize + x*2, linesize, ref + y*ref_linesize + x*2, ref_linesize);
+           if (dst != ref)
+               copy_block16x16(dst + y*linesize + x*2, linesize, ref + y*ref_linesize + x*2, ref_linesize);
        } else {
            int mv_x, mv_y;
            if (!get_bits1(gb1)) {
@@ -429,19 +545,32 @@ static int decode_mb_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByteCont
                    return AVERROR_INVALIDDATA;
                }
 
+               if (dst == ref)
+                   mark_dirty(avctx, dst, linesize, x, y);
+
                if (get_bits1(gb1)) {
-                   copy_block16x16(dst + y*linesize + x*2, linesize,
-                                   ref + (y+mv_y)*ref_linesize + (x+mv_x)*2, ref_linesize);
+                   uint16_t tmp[16 * 16];
+                   const uint8_t * src = ref + (y+mv_y)*ref_linesize + (x+mv_x)*2;
+                   if (dst == ref && is_dirty(avctx, x+mv_x, y+mv_y, 16, 16)) {
+                       gather_ref_block(avctx, ref, ref_linesize, x+mv_x, y+mv_y, 16, 16, tmp);
+                       src = (const uint8_t *)tmp;
+                       ref_linesize = 32;
+                   }
+                   copy_block16x16(dst + y*linesize + x*2, linesize, src, ref_linesize);
                    return 0;
                }
            } else {
                mv_x = mv_y = 0;
+               if (dst == ref)
+                   mark_dirty(avctx, dst, linesize, x, y);
            }
            for (int j = 0; j < 16; j += 4)
                for (int i = 0; i < 16; i += 4)
                    decode_block3_ani(avctx, gb1, gb2, x+i, y+j, dst, linesize, ref, ref_linesize, mv_x, mv_y, ori_delta);
        }
    } else {
+       if (dst == ref)
+           mark_dirty(avctx, dst, linesize, x, y);
        for (int j = 0; j < 16; j += 4)
            for (int i = 0; i < 16; i += 4)
                decode_block2_ani(avctx, gb1, gb2, x+i, y+j, dst, linesize, ori_delta);
@@ -457,18 +586,15 @@ static int decode_mbedge_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByte
         return AVERROR_INVALIDDATA;
     }
 
+    if (dst == ref)
+        mark_dirty(avctx, dst, linesize, xpos, ypos);
+
     for (int y = ypos; y < FFMIN(ypos + 16, avctx->height); y += 4) {
         for (int x = xpos; x < FFMIN(xpos + 16, avctx->width); x += 4) {
             if (x + 4 <= avctx->width && y + 4 <= avctx->height) {
                 int mode = get_bits(gb1, 2);
                 if (mode < 3) {
-                    for (int j = 0; j < 4; j++)
-                        for (int i = 0; i < 4; i++)
-                            if (x + i < avctx->width && y + j < avctx->height) {
-                                decode_pixel(avctx, gb1, gb2, ori_delta,
-                                             dst + (y+j)*linesize + (x+i)*2,
-                                             dst, linesize, x+i+qmage_dir[mode].x, y+j+qmage_dir[mode].y);
-                            }
+                    decode_intra_block(avctx, gb1, gb2, ori_delta, mode, x, y, dst, linesize);
                 } else {
                    if (x > 0)
                        copy_edge(dst + y*linesize + x*2, linesize, FFMIN(avctx->width - x, 4), FFMIN(avctx->height - y, 4));
@@ -484,6 +610,9 @@ static int decode_mbedge_ani(AVCodecContext *avctx, GetBitContext * gb1, GetByte
     return 0;
 }
 
+/* motion vectors and mode 6 pixels reach at most this many rows below the macroblock */
+#define MV_MAX_Y 64
+
 static int decode_a9ll_ani(AVCodecContext *avctx, const uint8_t * data, int size, uint8_t * dst, int dst_linesize, const uint8_t * ref, int ref_linesize)
 {
     Context * s = avctx->priv_data;
@@ -506,6 +635,7 @@ static int decode_a9ll_ani(AVCodecContext *avctx, const uint8_t * data, int size
     ori_delta = qmage_ori_delta[s->qversion != QVERSION_1_43_LESS];
 
     for (int y = 0; y < avctx->height; y += 16) {
+        ff_progress_frame_await(&s->last_frame, FFMIN(y + 16 + MV_MAX_Y, avctx->height));
         for (int x = 0; x < avctx->width; x += 16) {
             if (avctx->width - x >= 16 && avctx->height - y >= 16) {
                 if (decode_mb_ani(avctx, &gb1, &gb2, x, y, dst, dst_linesize, ref, ref_linesize, ori_delta) < 0)
@@ -515,16 +645,11 @@ static int decode_a9ll_ani(AVCodecContext *avctx, const uint8_t * data, int size
                     return AVERROR_INVALIDDATA;
             }
         }
+        ff_progress_frame_report(&s->frame, y + 16);
     }
     return 0;
 }
 
-static void memset32(uint8_t * dst, uint32_t v, int count)
-{
-    for (int i = 0; i < count; i++)
-        AV_WN32A(dst + i * 4, v);
-}
-
 static int read_value(GetByteContext * gb)
 {
     int v = 0;
@@ -535,74 +660,133 @@ static int read_value(GetByteContext * gb)
     return v + bytestream2_get_byte(gb);
 }
 
-static int decode_w2_aligned(AVCodecContext * avctx, GetByteContext * gb1, GetByteContext * gb2, GetByteContext * gb3, const uint8_t * data, int size, uint8_t * dst)
+/* W2-pass streams code pixel pairs as tokens: a literal pair, or a run of
+ * a color table pair. The pre-scan records the stream state at the start
+ * of every band, so that the bands can be filled concurrently. */
+typedef struct W2Band {
+    int start, end;         ///< pixel index range of the band
+    int pos1, pos2, pos3;   ///< stream offsets after the pending token
+    int pending;            ///< pixel pairs left in the pending token
+    uint16_t v1, v2;        ///< pixel pair of the pending token
+    int valid;
+} W2Band;
+
+typedef struct W2ThreadData {
+    const uint8_t * data;
+    int size;
+    int start1, start2, start3;
+    uint8_t * dst;
+    int dst_linesize;
+    int width;
+} W2ThreadData;
+
+static int w2_read_token(GetByteContext * gb1, GetByteContext * gb2, GetByteContext * gb3, const uint8_t * data, int size, W2Band * b)
 {
-    int counter = 0, idx, run;
-    uint32_t val;
-    int dim = avctx->width * avctx->height * 2;
-    do {
-        idx = read_value(gb1);
-        if (!idx) {
-            val = bytestream2_get_le32(gb3);
-            AV_WN32A(dst + counter, val);
-            counter += 4;
-        } else {
-            idx--;
-            if (idx * 4 + 4 > size - 16)
-                return AVERROR_INVALIDDATA;
-            val = AV_RL32(data + 16 + idx * 4);
-            run = read_value(gb2) + 1;
+    int idx = read_value(gb1);
+    if (!idx) {
+        b->v1 = bytestream2_get_le16(gb3);
+        b->v2 = bytestream2_get_le16(gb3);
+        b->pending = 1;
+    } else {
+        idx--;
+        if (idx * 4 + 4 > size - 16)
+            return AVERROR_INVALIDDATA;
+        b->v1 = AV_RL16(data + 16 + idx * 4);
+        b->v2 = AV_RL16(data + 16 + idx * 4 + 2);
+        b->pending = read_value(gb2) + 1;
+    }
+    return 0;
+}
 
-            memset32(dst + counter, val, FFMIN(run, (dim - counter) / 4));
-            counter += 4 * run;
+static int w2_prescan(const W2ThreadData * td, W2Band * bands, int nb_bands, int nb_pixels)
+{
+    GetByteContext gb1, gb2, gb3;
+    W2Band tok = { 0 };
+    int b = 1, pair = 0, ret;
+
+    bands[0].pos1 = bands[0].pos2 = bands[0].pos3 = 0;
+    bands[0].pending = 0;
+    bands[0].valid = 1;
+    for (int i = 1; i < nb_bands; i++)
+        bands[i].valid = 0;
+    if (nb_bands == 1)
+        return 0;
+
+    bytestream2_init(&gb1, td->data + td->start1, td->size - td->start1);
+    bytestream2_init(&gb2, td->data + td->start2, td->size - td->start2);
+    bytestream2_init(&gb3, td->data + td->start3, td->size - td->start3);
+
+    while (b < nb_bands && pair * 2 < nb_pixels) {
+        if ((ret = w2_read_token(&gb1, &gb2, &gb3, td->data, td->size, &tok)) < 0)
+            return ret;
+        while (b < nb_bands && bands[b].start / 2 < pair + tok.pending) {
+            W2Band * band = &bands[b++];
+            band->pos1    = bytestream2_tell(&gb1);
+            band->pos2    = bytestream2_tell(&gb2);
+            band->pos3    = bytestream2_tell(&gb3);
+            band->pending = pair + tok.pending - band->start / 2;
+            band->v1      = tok.v1;
+            band->v2      = tok.v2;
+            band->valid   = 1;
         }
-    } while (counter < dim);
+        pair += tok.pending;
+    }
     return 0;
 }
 
-static int decode_w2_unaligned(AVCodecContext * avctx, GetByteContext * gb1, GetByteContext * gb2, GetByteContext * gb3, const uint8_t * data, int size, uint8_t * dst, int dst_linesize)
+static int decode_w2_band(AVCodecContext * avctx, void * arg, int jobnr, int threadnr)
 {
-    int x = 0, y = 0, idx, run;
-    uint16_t v1, v2;
+    Context * s = avctx->priv_data;
+    const W2ThreadData * td = arg;
+    W2Band b = s->w2_bands[jobnr];
+    GetByteContext gb1, gb2, gb3;
+    int width = td->width;
+    int p = b.start, x = b.start % width;
+    uint8_t * row = td->dst + (b.start / width) * td->dst_linesize;
+    int skip = b.start & 1, ret;
+
+    if (!b.valid)
+        return AVERROR_INVALIDDATA;
+
+    bytestream2_init(&gb1, td->data + td->start1 + b.pos1, td->size - td->start1 - b.pos1);
+    bytestream2_init(&gb2, td->data + td->start2 + b.pos2, td->size - td->start2 - b.pos2);
+    bytestream2_init(&gb3, td->data + td->start3 + b.pos3, td->size - td->start3 - b.pos3);
 
-    while (1) {
-        idx = read_value(gb1);
-        if (!idx) {
 #define WRITE_PIXEL(v) \
-            AV_WN16A(dst + y*dst_linesize + x*2, v); \
-            x++; \
-            if (x >= avctx->width) { \
-                x = 0; \
-                y++; \
-                if (y >= avctx->height) \
-                    return 0; \
-            }
-            v1 = bytestream2_get_le16(gb3);
-            v2 = bytestream2_get_le16(gb3);
-            WRITE_PIXEL(v1)
-            WRITE_PIXEL(v2)
-        } else {
-            idx--;
-            if (idx * 4 + 4 > size - 16)
-                return AVERROR_INVALIDDATA;
-            v1 = AV_RL16(data + 16 + idx * 4);
-            v2 = AV_RL16(data + 16 + idx * 4 + 2);
-            run = read_value(gb2) + 1;
-            for (int i = 0; i < run; i++) {
-                WRITE_PIXEL(v1)
-                WRITE_PIXEL(v2)
-            }
+    do { \
+        AV_WN16A(row + x*2, v); \
+        if (++x >= width) { \
+            x = 0; \
+            row += td->dst_linesize; \
+        } \
+        if (++p >= b.end) \
+            return 0; \
+    } while (0)
+
+    while (1) {
+        if (skip && b.pending) {
+            WRITE_PIXEL(b.v2);
+            b.pending--;
+            skip = 0;
         }
+        for (; b.pending > 0; b.pending--) {
+            WRITE_PIXEL(b.v1);
+            WRITE_PIXEL(b.v2);
+        }
+        if ((ret = w2_read_token(&gb1, &gb2, &gb3, td->data, td->size, &b)) < 0)
+            return ret;
     }
 #undef WRITE_PIXEL
-    return 0;
 }
 
-static int decode_w2_pass_depth1(AVCodecContext *avctx, const uint8_t * data, int size, uint8_t * dst, int dst_linesize)
+static int decode_w2_pass_depth1(AVCodecContext *avctx, const uint8_t * data, int size,
+                                 int width, int height, uint8_t * dst, int dst_linesize)
 {
+    Context * s = avctx->priv_data;
     int cnt_table, size_idx, size_run;
-    int start1, start2, start3;
-    GetByteContext gb1, gb2, gb3;
+    int nb_bands, nb_pixels = width * height;
+    W2ThreadData td;
+    int ret;
 
     if (size < 16)
         return AVERROR_INVALIDDATA;
@@ -611,21 +795,41 @@ static int decode_w2_pass_depth1(AVCodecContext *avctx, const uint8_t * data, in
     size_idx = AV_RL32(data + 4);
     size_run = AV_RL32(data + 8);
 
-    start1 = 16 + cnt_table*4;
-    start2 = start1 + size_idx;
-    start3 = start2 + size_run;
+    td.start1 = 16 + cnt_table*4;
+    td.start2 = td.start1 + size_idx;
+    td.start3 = td.start2 + size_run;
 
-    if (start1 >= size || start2 >= size || start3 > size)
+    if (td.start1 >= size || td.start2 >= size || td.start3 > size)
         return AVERROR_INVALIDDATA;
 
-    bytestream2_init(&gb1, data + start1, size - start1);
-    bytestream2_init(&gb2, data + start2, size - start2);
-    bytestream2_init(&gb3, data + start3, size - start3);
+    td.data = data;
+    td.size = size;
+    td.dst = dst;
+    td.dst_linesize = dst_linesize;
+    td.width = width;
+
+    nb_bands = 1;
+    if (avctx->active_thread_type & FF_THREAD_SLICE)
+        nb_bands = av_clip(height / W2_BAND_MIN_HEIGHT, 1, avctx->thread_count);
+
+    av_fast_malloc(&s->w2_bands, &s->w2_bands_size, nb_bands * sizeof(*s->w2_bands));
+    av_fast_malloc(&s->w2_rets, &s->w2_rets_size, nb_bands * sizeof(*s->w2_rets));
+    if (!s->w2_bands || !s->w2_rets)
+        return AVERROR(ENOMEM);
+
+    for (int i = 0; i < nb_bands; i++) {
+        s->w2_bands[i].start = height *  i      / nb_bands * width;
+        s->w2_bands[i].end   = height * (i + 1) / nb_bands * width;
+    }
+
+    ret = w2_prescan(&td, s->w2_bands, nb_bands, nb_pixels);
 
-    if (dst_linesize == avctx->width * 2)
-        return decode_w2_aligned(avctx, &gb1, &gb2, &gb3, data, size, dst);
+    avctx->execute2(avctx, decode_w2_band, &td, s->w2_rets, nb_bands);
 
-    return decode_w2_unaligned(avctx, &gb1, &gb2, &gb3, data, size, dst, dst_linesize);
+    for (int i = 0; i < nb_bands; i++)
+        if (s->w2_rets[i] < 0)
+            return s->w2_rets[i];
+    return ret;
 }
 
 static int strip1(GetBitContext * gb1, GetByteContext * gb2, GetByteContext * gb3, int * rel, uint8_t * dst, int d_pos)
@@ -692,8 +896,10 @@ static int strip2(GetBitContext * gb1, GetByteContext * gb2, GetByteContext * gb
     return 0;
 }
 
-static int decode_w2_pass_depth2(AVCodecContext *avctx, const uint8_t * data, int size, uint8_t * dst, int dst_linesize)
+static int decode_w2_pass_depth2(AVCodecContext *avctx, const uint8_t * data, int size,
+                                 int width, int height, uint8_t * dst, int dst_linesize)
 {
+    Context * s = avctx->priv_data;
     int bsize, ret;
     uint8_t * bdata;
     int len1, len2, rel = 1, d_pos;
@@ -707,61 +913,51 @@ static int decode_w2_pass_depth2(AVCodecContext *avctx, const uint8_t * data, in
     if (bsize < 16)
         return AVERROR_INVALIDDATA;
 
-    bdata = av_malloc(bsize);
-    if (!bdata)
+    av_fast_padded_malloc(&s->w2_buf, &s->w2_buf_size, bsize);
+    if (!s->w2_buf)
         return AVERROR(ENOMEM);
+    bdata = s->w2_buf;
 
     len1 = AV_RL32(data + 4);
     len2 = AV_RL32(data + 8);
-    if ((ret = init_get_bits8(&gb1, data + 12, size - 12)) < 0) {
-        free(bdata);
+    if ((ret = init_get_bits8(&gb1, data + 12, size - 12)) < 0)
         return ret;
-    }
     bytestream2_init(&gb2, data + 12 + len1, size - 12 - len1);
     bytestream2_init(&gb3, data + 12 + len1 + len2, size - 12 - len1 - len2);
 
-    if (strip1(&gb1, &gb2, &gb3, &rel, bdata, 0) < 0) {
-        free(bdata);
+    if (strip1(&gb1, &gb2, &gb3, &rel, bdata, 0) < 0)
         return AVERROR_INVALIDDATA;
-    }
 
     for (d_pos = 16; d_pos < (bsize & ~15); d_pos += 16) {
         if (!get_bits1(&gb1)) {
             if (!get_bits1(&gb1)) {
                 bytestream2_get_buffer(&gb3, bdata + d_pos, 16);
             } else {
-                if (d_pos - rel*2 < 0) {
-                    free(bdata);
+                if (d_pos - rel*2 < 0)
                     return AVERROR_INVALIDDATA;
-                }
                 for (int j = 0; j < 8; j++)
                     AV_WN16A(bdata + d_pos + j*2, AV_RN16A(bdata + d_pos - rel*2 + j*2));
             }
         } else {
-            if (strip2(&gb1, &gb2, &gb3, &rel, bdata, d_pos) < 0) {
-                free(bdata);
+            if (strip2(&gb1, &gb2, &gb3, &rel, bdata, d_pos) < 0)
                 return AVERROR_INVALIDDATA;
-            }
         }
     }
 
     if (bsize & 15)
         bytestream2_get_buffer(&gb2, bdata + d_pos, bsize & 15);
 
-    ret = decode_w2_pass_depth1(avctx, bdata, bsize, dst, dst_linesize);
-    av_free(bdata);
-    return ret;
+    return decode_w2_pass_depth1(avctx, bdata, bsize, width, height, dst, dst_linesize);
 }
 
 static av_cold int qmage_decode_init(AVCodecContext *avctx)
 {
     Context * s = avctx->priv_data;
 
-    avctx->pix_fmt = AV_PIX_FMT_RGB565;
+    for (int a = 1; a < 256; a++)
+        s->unpremultiply[a] = (255 * 65536 + a / 2) / a;
 
-    s->last_frame = av_frame_alloc();
-    if (!s->last_frame)
-        return AVERROR(ENOMEM);
+    avctx->pix_fmt = AV_PIX_FMT_RGB565;
 
     return 0;
 }
@@ -769,53 +965,270 @@ static av_cold int qmage_decode_init(AVCodecContext *avctx)
 static av_cold int qmage_decode_close(AVCodecContext *avctx)
 {
     Context *s = avctx->priv_data;
-    av_frame_free(&s->last_frame);
+    ff_progress_frame_unref(&s->last_frame);
+    ff_progress_frame_unref(&s->frame);
+    av_buffer_pool_uninit(&s->pool);
+    av_freep(&s->shadow);
+    s->shadow_size = 0;
+    av_freep(&s->dirty);
+    s->dirty_size = 0;
+    av_freep(&s->w2_bands);
+    s->w2_bands_size = 0;
+    av_freep(&s->w2_rets);
+    s->w2_rets_size = 0;
+    av_freep(&s->w2_buf);
+    s->w2_buf_size = 0;
+    return 0;
+}
+
+/**
+ * Allocate the reference frame. With alpha output, reference frames are
+ * private: an RGB565 color plane in data[0] followed by an 8-bit alpha
+ * plane in data[1], which is coded as a half-width plane of 16-bit values.
+ */
+static int get_ref_buffer(AVCodecContext *avctx, ProgressFrame *pf)
+{
+    Context * s = avctx->priv_data;
+    int linesize, alpha_linesize, size, ret;
+    AVFrame * f;
+
+    if (!s->alpha_out)
+        return ff_progress_frame_get_buffer(avctx, pf, AV_GET_BUFFER_FLAG_REF);
+
+    linesize       = FFALIGN(avctx->width * 2, 32);
+    alpha_linesize = FFALIGN(avctx->width, 32);
+    size = (linesize + alpha_linesize) * avctx->height;
+    if (!s->pool || s->pool_size != size) {
+        av_buffer_pool_uninit(&s->pool);
+        s->pool = av_buffer_pool_init(size, NULL);
+        if (!s->pool)
+            return AVERROR(ENOMEM);
+        s->pool_size = size;
+    }
+
+    if ((ret = ff_progress_frame_alloc(avctx, pf)) < 0)
+        return ret;
+    f = pf->f;
+    f->buf[0] = av_buffer_pool_get(s->pool);
+    if (!f->buf[0]) {
+        ff_progress_frame_unref(pf);
+        return AVERROR(ENOMEM);
+    }
+    f->format      = AV_PIX_FMT_RGB565;
+    f->width       = avctx->width;
+    f->height      = avctx->height;
+    f->data[0]     = f->buf[0]->data;
+    f->linesize[0] = linesize;
+    f->data[1]     = f->data[0] + linesize * avctx->height;
+    f->linesize[1] = alpha_linesize;
+    return 0;
+}
+
+static int decode_alpha(AVCodecContext *avctx, const AVPacket *avpkt, int key, AVFrame *f)
+{
+    Context * s = avctx->priv_data;
+    const uint8_t * data = avpkt->data + s->alpha_position;
+    int size = avpkt->size - s->alpha_position;
+    int width = avctx->width >> 1;
+
+    if (s->not_alpha_comp || s->alpha_position < s->header_size || size < 4) {
+        if (s->not_alpha_comp)
+            avpriv_request_sample(avctx, "not_alpha_comp");
+        goto opaque;
+    }
+
+    if (!key) {
+        const AVFrame * ref = s->last_frame.f;
+        if (f == ref)
+            return 0;
+        ff_progress_frame_await(&s->last_frame, INT_MAX);
+        if (!ref->data[1])
+            goto opaque;
+        av_image_copy_plane(f->data[1], f->linesize[1], ref->data[1], ref->linesize[1],
+                            avctx->width, avctx->height);
+        return 0;
+    }
+
+    if (s->mode) {
+        if (avctx->width & 1) {
+            avpriv_request_sample(avctx, "alpha with odd width");
+            goto opaque;
+        }
+        return decode_a9ll(avctx, data, size, 0, 0, width, avctx->height, f->data[1], f->linesize[1], NULL);
+    }
+
+    if (s->alpha_encoder_mode != QCODEC_W2_PASS || (avctx->width & 1)) {
+        avpriv_request_sample(avctx, "alpha_encoder_mode=%d", s->alpha_encoder_mode);
+        goto opaque;
+    }
+    if (s->alpha_depth == 1)
+        return decode_w2_pass_depth1(avctx, data, size, width, avctx->height, f->data[1], f->linesize[1]);
+    else
+        return decode_w2_pass_depth2(avctx, data, size, width, avctx->height, f->data[1], f->linesize[1]);
+
+opaque:
+    for (int y = 0; y < avctx->height; y++)
+        memset(f->data[1] + y * f->linesize[1], 0xff, avctx->width);
     return 0;
 }
 
+static void convert_rgba(AVCodecContext *avctx, AVFrame *frame, const AVFrame *f)
+{
+    Context * s = avctx->priv_data;
+
+    for (int y = 0; y < avctx->height; y++) {
+        const uint8_t * src = f->data[0] + y * f->linesize[0];
+        const uint8_t * alpha = f->data[1] + y * f->linesize[1];
+        uint8_t * dst = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < avctx->width; x++) {
+            unsigned v = AV_RN16A(src + x*2);
+            unsigned a = AV_RN16A(alpha + (x & ~1)) >> (x & 1) * 8 & 0xff;
+            unsigned r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+            r = (r << 3) | (r >> 2);
+            g = (g << 2) | (g >> 4);
+            b = (b << 3) | (b >> 2);
+            if (s->pre_multiplied && a < 255) {
+                unsigned k = s->unpremultiply[a];
+                r = FFMIN((r * k + 32768) >> 16, 255);
+                g = FFMIN((g * k + 32768) >> 16, 255);
+                b = FFMIN((b * k + 32768) >> 16, 255);
+            }
+            dst[4*x + 0] = r;
+            dst[4*x + 1] = g;
+            dst[4*x + 2] = b;
+            dst[4*x + 3] = a;
+        }
+    }
+}
+
 static int qmage_decode_frame(AVCodecContext *avctx, AVFrame *frame,
                             int *got_frame, AVPacket *avpkt)
 {
     Context * s = avctx->priv_data;
-    int ret;
+    AVFrame * f, * out;
+    int key, ret;
+
+    ff_progress_frame_unref(&s->frame);
 
     ret = decode_header(avctx, avpkt);
     if (ret < 0)
         return ret;
 
-    ret = ff_get_buffer(avctx, frame, 0);
-    if (ret < 0)
-        return ret;
+    key = !s->mode || s->current_frame_number == 1;
+    if (!key && !s->last_frame.f) {
+        av_log(avctx, AV_LOG_ERROR, "decoding must start with keyframe\n");
+        return AVERROR_INVALIDDATA;
+    }
 
-    if (s->mode) {
-        if (s->current_frame_number == 1) {
-            frame->flags |= AV_FRAME_FLAG_KEY;
-            decode_a9ll(avctx, avpkt->data, avpkt->size, frame->data[0], frame->linesize[0]);
-        } else {
-            decode_a9ll_ani(avctx, avpkt->data, avpkt->size, frame->data[0], frame->linesize[0],
-                            s->last_frame->data[0], s->last_frame->linesize[0]);
-        }
-    } else {
-        frame->flags |= AV_FRAME_FLAG_KEY;
+    if (!s->mode) {
         switch(s->encoder_mode) {
         case QCODEC_W2_PASS: break;
         default:
             avpriv_request_sample(avctx, "encoder_mode=%d", s->encoder_mode);
             return AVERROR_INVALIDDATA;
         }
-        switch (s->depth) {
-        case 1:
-            decode_w2_pass_depth1(avctx, avpkt->data + s->header_size, avpkt->size - s->header_size, frame->data[0], frame->linesize[0]);
-            break;
-        case 2:
-            decode_w2_pass_depth2(avctx, avpkt->data + s->header_size, avpkt->size - s->header_size, frame->data[0], frame->linesize[0]);
-            break;
-        default:
+        if (s->depth != 1 && s->depth != 2)
             return AVERROR_INVALIDDATA;
+    }
+
+    s->alpha_out = s->alpha && s->transparency;
+    avctx->pix_fmt = s->alpha_out ? AV_PIX_FMT_RGBA : AV_PIX_FMT_RGB565;
+
+    /* inter frames are only known to reuse the alpha of the reference */
+    if (s->alpha_out && !key && !s->not_alpha_comp && s->alpha_position >= s->header_size &&
+        avpkt->size - s->alpha_position >= 4 && AV_RL32(avpkt->data + s->alpha_position) > 4) {
+        avpriv_request_sample(avctx, "alpha in inter frames");
+        return AVERROR_PATCHWELCOME;
+    }
+
+    if (!key && s->inplace && !(avctx->active_thread_type & FF_THREAD_FRAME) &&
+        av_frame_is_writable(s->last_frame.f) && !!s->last_frame.f->data[1] == s->alpha_out) {
+        int mb_count;
+
+        /* nobody else holds the reference: decode on top of it */
+        ff_progress_frame_ref(&s->frame, &s->last_frame);
+        f = s->frame.f;
+        if (s->alpha_out) {
+            if ((ret = ff_get_buffer(avctx, frame, 0)) < 0)
+                return ret;
+            frame->pict_type = AV_PICTURE_TYPE_P;
+        } else {
+            av_frame_side_data_free(&f->side_data, &f->nb_side_data);
+            f->flags    &= ~AV_FRAME_FLAG_KEY;
+            f->pict_type = AV_PICTURE_TYPE_P;
+            if ((ret = ff_decode_frame_props(avctx, f)) < 0)
+                return ret;
+        }
+
+        s->mb_width = (avctx->width + 15) >> 4;
+        mb_count = s->mb_width * ((avctx->height + 15) >> 4);
+        av_fast_malloc(&s->dirty, &s->dirty_size, mb_count);
+        av_fast_malloc(&s->shadow, &s->shadow_size, f->linesize[0] * avctx->height);
+        if (!s->dirty || !s->shadow)
+            return AVERROR(ENOMEM);
+        memset(s->dirty, 0, mb_count);
+
+        ret = decode_a9ll_ani(avctx, avpkt->data, avpkt->size, f->data[0], f->linesize[0],
+                              f->data[0], f->linesize[0]);
+        if (ret < 0)
+            return ret;
+
+        if (s->alpha_out) {
+            if ((ret = decode_alpha(avctx, avpkt, key, f)) < 0)
+                return ret;
+            convert_rgba(avctx, frame, f);
+        } else if ((ret = av_frame_ref(frame, f)) < 0)
+            return ret;
+        *got_frame = 1;
+        return avpkt->size;
+    }
+
+    ret = get_ref_buffer(avctx, &s->frame);
+    if (ret < 0)
+        return ret;
+    f = s->frame.f;
+    out = f;
+    if (s->alpha_out) {
+        ret = ff_thread_get_buffer(avctx, frame, 0);
+        if (ret < 0)
+            return ret;
+        out = frame;
+    }
+    if (key) {
+        out->flags    |= AV_FRAME_FLAG_KEY;
+        out->pict_type = AV_PICTURE_TYPE_I;
+    } else {
+        out->pict_type = AV_PICTURE_TYPE_P;
+    }
+
+    ff_thread_finish_setup(avctx);
+
+    if (s->mode) {
+        if (key) {
+            ret = decode_a9ll(avctx, avpkt->data, avpkt->size, s->header_size, s->is_dynamic_table,
+                              avctx->width, avctx->height, f->data[0], f->linesize[0], &s->frame);
+        } else {
+            ret = decode_a9ll_ani(avctx, avpkt->data, avpkt->size, f->data[0], f->linesize[0],
+                                  s->last_frame.f->data[0], s->last_frame.f->linesize[0]);
         }
+    } else if (s->depth == 1) {
+        ret = decode_w2_pass_depth1(avctx, avpkt->data + s->header_size, avpkt->size - s->header_size,
+                                    avctx->width, avctx->height, f->data[0], f->linesize[0]);
+    } else {
+        ret = decode_w2_pass_depth2(avctx, avpkt->data + s->header_size, avpkt->size - s->header_size,
+                                    avctx->width, avctx->height, f->data[0], f->linesize[0]);
     }
+    if (ret >= 0 && s->alpha_out)
+        ret = decode_alpha(avctx, avpkt, key, f);
+    /* the following frames may already be waiting on this one, even if it failed */
+    ff_progress_frame_report(&s->frame, INT_MAX);
+    ff_progress_frame_replace(&s->last_frame, &s->frame);
+    if (ret < 0)
+        return ret;
 
-    if ((ret = av_frame_replace(s->last_frame, frame)) < 0)
+    if (s->alpha_out)
+        convert_rgba(avctx, frame, f);
+    else if ((ret = av_frame_ref(frame, f)) < 0)
         return ret;
 
     *got_frame = 1;
@@ -823,14 +1236,49 @@ static int qmage_decode_frame(AVCodecContext *avctx, AVFrame *frame,
     return avpkt->size;
 }
 
+#if HAVE_THREADS
+static int qmage_decode_update_thread_context(AVCodecContext *dst, const AVCodecContext *src)
+{
+    Context * d = dst->priv_data;
+    const Context * s = src->priv_data;
+
+    if (dst == src)
+        return 0;
+
+    ff_progress_frame_replace(&d->last_frame, &s->frame);
+    return 0;
+}
+#endif
+
+#define OFFSET(x) offsetof(Context, x)
+#define VD AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_DECODING_PARAM
+static const AVOption options[] = {
+    { "inplace", "Decode animation frames on top of an unreferenced previous frame", OFFSET(inplace),
+        AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, VD },
+    { "alpha", "Output RGBA with the decoded alpha plane for transparent images", OFFSET(alpha),
+        AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, VD },
+    { NULL },
+};
+
+static const AVClass qmage_class = {
+    .class_name = "Qmage",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 const FFCodec ff_qmage_decoder = {
     .p.name         = "qmage",
     CODEC_LONG_NAME("Quram Qmage"),
     .p.type         = AVMEDIA_TYPE_VIDEO,
     .p.id           = AV_CODEC_ID_QMAGE,
-    .p.capabilities = AV_CODEC_CAP_DR1,
+    .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_SLICE_THREADS |
+                      AV_CODEC_CAP_FRAME_THREADS,
     .priv_data_size = sizeof(Context),
     .init           = qmage_decode_init,
     .close          = qmage_decode_close,
     FF_CODEC_DECODE_CB(qmage_decode_frame),
+    UPDATE_THREAD_CONTEXT(qmage_decode_update_thread_context),
+    .caps_internal  = FF_CODEC_CAP_USES_PROGRESSFRAMES,
+    .p.priv_class   = &qmage_class,
 };
@@ -0,0 +1,947 @@
+/*
+ * Quram Qmage image format encoder
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Qmage encoder
+ *
+ * Stills are coded with W2-pass (depth 1), animations with A9LL: an intra
+ * keyframe followed by inter frames. Both are lossless RGB565.
+ *
+ * Every macroblock row is analysed and coded into its own set of streams
+ * by a slice thread; the streams are then concatenated into the packet.
+ */
+
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/qsort.h"
+
+#include "avcodec.h"
+#include "bytestream.h"
+#include "codec_internal.h"
+#include "encode.h"
+#include "put_bits.h"
+#include "qmagedata.h"
+
+#define QMAGE_MAGIC 0x514d
+#define QVERSION_1_43_LESS 0xb
+#define QCODEC_W2_PASS 1
+
+#define HEADER_SIZE_STILL 12
+#define HEADER_SIZE_ANI   24
+
+/* keeps color table indices within 5 bytes */
+#define W2_MAX_TABLE (4 * 255)
+
+#define MV_MIN_X -127
+#define MV_MAX_X  128
+#define MV_MIN_Y  -63
+#define MV_MAX_Y   64
+
+enum {
+    ME_FAST,
+    ME_FULL,
+};
+
+typedef struct W2Run {
+    uint32_t pair;
+    int len;
+} W2Run;
+
+typedef struct W2Entry {
+    uint32_t pair;
+    int count;              ///< number of runs, 0 if the entry is empty
+    int weight;             ///< bytes saved over literals, ignoring the table
+    int idx;                ///< token value, 0 if coded as literals
+} W2Entry;
+
+typedef struct SliceContext {
+    uint8_t *buf1, *buf2, *buf3;
+    PutBitContext pb;       ///< mode and delta bits
+    PutBitContext pb_nb;    ///< delta sizes (keyframes only)
+    PutByteContext pbyte;   ///< cbp, escapes, raw pixels; W2 idx stream
+    PutByteContext pbyte2;  ///< W2 run stream
+    PutByteContext pbyte3;  ///< W2 literal stream
+    int bits, bits_nb;      ///< bits written to pb and pb_nb
+    W2Run *runs;
+    int nb_runs;
+} SliceContext;
+
+typedef struct QmageEncContext {
+    const AVClass *class;
+    int animation;
+    int motion_est;
+    int me_range;
+
+    SliceContext *slices;
+    int nb_slices;
+    int mb_width;
+    int buf1_size, buf2_size, buf3_size;
+
+    uint8_t inv_delta[65536];   ///< code of each A9LL delta, 0xff if none
+    uint8_t code_nb[256];
+    uint8_t code_idx[256];
+
+    const AVFrame *cur;
+    AVFrame *last;
+    int16_t (*mvs)[2];
+    int16_t (*last_mvs)[2];
+    int frame_number;
+
+    W2Entry *hash;
+    unsigned int hash_size;
+    int hash_mask;
+    W2Entry **table;
+    unsigned int table_size;
+    int nb_table;
+} QmageEncContext;
+
+static inline int get_pixel(const uint8_t *src, ptrdiff_t linesize, int x, int y, int width, int height)
+{
+    if (x >= 0 && x < width && y >= 0 && y < height)
+        return AV_RN16(src + y*linesize + x*2);
+    return 0;
+}
+
+static int write_value(PutByteContext *pb, int v)
+{
+    for (; v >= 0xff; v -= 0xff)
+        bytestream2_put_byte(pb, 0xff);
+    bytestream2_put_byte(pb, v);
+    return 0;
+}
+
+/* W2-pass */
+
+static inline uint32_t w2_hash(const QmageEncContext *s, uint32_t pair)
+{
+    return (pair * 0x9E3779B1U >> 7) & s->hash_mask;
+}
+
+static W2Entry *w2_find(const QmageEncContext *s, uint32_t pair)
+{
+    W2Entry *e = &s->hash[w2_hash(s, pair)];
+    while (e->count && e->pair != pair)
+        e = &s->hash[(e - s->hash + 1) & s->hash_mask];
+    return e;
+}
+
+static void w2_band_pairs(const AVCodecContext *avctx, const QmageEncContext *s, int jobnr, int *start, int *end)
+{
+    int nb_pairs = (avctx->width * avctx->height + 1) >> 1;
+    *start = (int64_t)nb_pairs *  jobnr      / s->nb_slices;
+    *end   = (int64_t)nb_pairs * (jobnr + 1) / s->nb_slices;
+}
+
+static int w2_runs_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    QmageEncContext *s = avctx->priv_data;
+    SliceContext *sl = &s->slices[jobnr];
+    const AVFrame *f = s->cur;
+    int width = avctx->width, nb_pixels = width * avctx->height;
+    int start, end, x, y;
+    const uint8_t *row;
+
+    w2_band_pairs(avctx, s, jobnr, &start, &end);
+    x   = start * 2 % width;
+    y   = start * 2 / width;
+    row = f->data[0] + y * f->linesize[0];
+
+    sl->nb_runs = 0;
+    for (int p = start; p < end; p++) {
+        uint32_t pair = AV_RN16(row + x*2);
+        if (++x >= width) {
+            x = 0;
+            row += f->linesize[0];
+        }
+        if (p * 2 + 1 < nb_pixels) {
+            pair |= AV_RN16(row + x*2) << 16;
+            if (++x >= width) {
+                x = 0;
+                row += f->linesize[0];
+            }
+        }
+        if (sl->nb_runs && sl->runs[sl->nb_runs - 1].pair == pair) {
+            sl->runs[sl->nb_runs - 1].len++;
+        } else {
+            sl->runs[sl->nb_runs].pair = pair;
+            sl->runs[sl->nb_runs].len  = 1;
+            sl->nb_runs++;
+        }
+    }
+    return 0;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    const W2Entry *ea = *(const W2Entry * const *)a;
+    const W2Entry *eb = *(const W2Entry * const *)b;
+    if (ea->count != eb->count)
+        return eb->count - ea->count;
+    return eb->weight - ea->weight;
+}
+
+/* pairs that occur in long or repeated runs go into the color table, most
+ * frequent first so that their indices take a single byte */
+static int w2_build_table(AVCodecContext *avctx)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int nb_runs = 0, nb_entries = 0, hash_len = 2;
+
+    for (int i = 0; i < s->nb_slices; i++)
+        nb_runs += s->slices[i].nb_runs;
+    while (hash_len < 2 * nb_runs)
+        hash_len <<= 1;
+
+    av_fast_malloc(&s->hash, &s->hash_size, hash_len * sizeof(*s->hash));
+    if (!s->hash)
+        return AVERROR(ENOMEM);
+    memset(s->hash, 0, hash_len * sizeof(*s->hash));
+    s->hash_mask = hash_len - 1;
+
+    for (int i = 0; i < s->nb_slices; i++) {
+        const SliceContext *sl = &s->slices[i];
+        for (int j = 0; j < sl->nb_runs; j++) {
+            W2Entry *e = w2_find(s, sl->runs[j].pair);
+            if (!e->count) {
+                e->pair = sl->runs[j].pair;
+                nb_entries++;
+            }
+            e->count++;
+            e->weight = FFMIN(e->weight + 5LL * sl->runs[j].len - 2, INT_MAX);
+        }
+    }
+
+    av_fast_malloc(&s->table, &s->table_size, nb_entries * sizeof(*s->table));
+    if (!s->table && nb_entries)
+        return AVERROR(ENOMEM);
+    s->nb_table = 0;
+    for (int i = 0; i < hash_len; i++)
+        if (s->hash[i].count && s->hash[i].weight > 4)
+            s->table[s->nb_table++] = &s->hash[i];
+
+    AV_QSORT(s->table, s->nb_table, W2Entry *, cmp_entry);
+    s->nb_table = FFMIN(s->nb_table, W2_MAX_TABLE);
+    for (int i = 0; i < s->nb_table; i++)
+        s->table[i]->idx = i + 1;
+    return 0;
+}
+
+static int w2_emit_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    QmageEncContext *s = avctx->priv_data;
+    SliceContext *sl = &s->slices[jobnr];
+
+    bytestream2_init_writer(&sl->pbyte,  sl->buf1, s->buf1_size);
+    bytestream2_init_writer(&sl->pbyte2, sl->buf2, s->buf2_size);
+    bytestream2_init_writer(&sl->pbyte3, sl->buf3, s->buf3_size);
+
+    for (int i = 0; i < sl->nb_runs; i++) {
+        const W2Run *r = &sl->runs[i];
+        const W2Entry *e = w2_find(s, r->pair);
+        if (e->idx) {
+            write_value(&sl->pbyte,  e->idx);
+            write_value(&sl->pbyte2, r->len - 1);
+        } else {
+            for (int j = 0; j < r->len; j++) {
+                bytestream2_put_byte(&sl->pbyte, 0);
+                bytestream2_put_le16(&sl->pbyte3, r->pair);
+                bytestream2_put_le16(&sl->pbyte3, r->pair >> 16);
+            }
+        }
+    }
+    return 0;
+}
+
+static int encode_w2_pass(AVCodecContext *avctx, AVPacket *pkt)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int64_t size_idx = 0, size_run = 0, size_lit = 0, size;
+    uint8_t *buf;
+    int ret;
+
+    avctx->execute2(avctx, w2_runs_slice, NULL, NULL, s->nb_slices);
+    if ((ret = w2_build_table(avctx)) < 0)
+        return ret;
+    avctx->execute2(avctx, w2_emit_slice, NULL, NULL, s->nb_slices);
+
+    for (int i = 0; i < s->nb_slices; i++) {
+        size_idx += bytestream2_tell_p(&s->slices[i].pbyte);
+        size_run += bytestream2_tell_p(&s->slices[i].pbyte2);
+        size_lit += bytestream2_tell_p(&s->slices[i].pbyte3);
+    }
+    size = HEADER_SIZE_STILL + 16 + s->nb_table * 4 + size_idx + size_run + size_lit;
+    if (size > INT_MAX)
+        return AVERROR(ERANGE);
+
+    if ((ret = ff_get_encode_buffer(avctx, pkt, size, 0)) < 0)
+        return ret;
+    buf = pkt->data;
+
+    bytestream_put_be16(&buf, QMAGE_MAGIC);
+    bytestream_put_byte(&buf, QVERSION_1_43_LESS);
+    bytestream_put_byte(&buf, 0);               // raw_type: RGB565
+    bytestream_put_byte(&buf, 0);
+    bytestream_put_byte(&buf, QCODEC_W2_PASS);  // encoder_mode, depth 1
+    bytestream_put_le16(&buf, avctx->width);
+    bytestream_put_le16(&buf, avctx->height);
+    bytestream_put_le16(&buf, 0);
+
+    bytestream_put_le32(&buf, s->nb_table);
+    bytestream_put_le32(&buf, size_idx);
+    bytestream_put_le32(&buf, size_run);
+    bytestream_put_le32(&buf, 0);
+    for (int i = 0; i < s->nb_table; i++)
+        bytestream_put_le32(&buf, s->table[i]->pair);
+
+    for (int i = 0; i < s->nb_slices; i++)
+        bytestream_put_buffer(&buf, s->slices[i].buf1, bytestream2_tell_p(&s->slices[i].pbyte));
+    for (int i = 0; i < s->nb_slices; i++)
+        bytestream_put_buffer(&buf, s->slices[i].buf2, bytestream2_tell_p(&s->slices[i].pbyte2));
+    for (int i = 0; i < s->nb_slices; i++)
+        bytestream_put_buffer(&buf, s->slices[i].buf3, bytestream2_tell_p(&s->slices[i].pbyte3));
+
+    return 0;
+}
+
+/* A9LL */
+
+static int delta_bits(const QmageEncContext *s, uint16_t d)
+{
+    int c = s->inv_delta[d];
+    return c == 0xff ? 19 : 4 + s->code_nb[c];
+}
+
+/* cost of a block coded with parse_block(): one bit per pixel, plus the delta */
+static int block_cost(const QmageEncContext *s, const uint16_t *cur, const uint16_t *pred)
+{
+    int bits = 0;
+    for (int k = 0; k < 16; k++) {
+        uint16_t d = cur[k] - pred[k];
+        bits += d ? 1 + delta_bits(s, d) : 1;
+    }
+    return bits;
+}
+
+/* cost of n pixels coded with a cbp, as in keyframes */
+static int block_cost_cbp(const QmageEncContext *s, const uint16_t *cur, const uint16_t *pred, int n)
+{
+    int bits = 16;
+    for (int k = 0; k < n; k++) {
+        uint16_t d = cur[k] - pred[k];
+        if (d)
+            bits += delta_bits(s, d);
+    }
+    return bits;
+}
+
+static void put_delta(const QmageEncContext *s, PutBitContext *pb_nb, PutBitContext *pb, PutByteContext *pbyte,
+                      uint16_t d, uint16_t v)
+{
+    int c = s->inv_delta[d];
+    if (c == 0xff) {
+        put_bits(pb_nb, 3, 7);
+        bytestream2_put_le16(pbyte, v);
+    } else {
+        put_bits(pb_nb, 3, s->code_nb[c]);
+        put_bits(pb, s->code_nb[c] + 1, s->code_idx[c]);
+    }
+}
+
+static void put_block(const QmageEncContext *s, SliceContext *sl, const uint16_t *cur, const uint16_t *pred)
+{
+    for (int k = 0; k < 16; k++) {
+        uint16_t d = cur[k] - pred[k];
+        put_bits(&sl->pb, 1, !d);
+        if (d)
+            put_delta(s, &sl->pb, &sl->pb, &sl->pbyte, d, cur[k]);
+    }
+}
+
+static void put_block_cbp(const QmageEncContext *s, SliceContext *sl, const uint16_t *cur, const uint16_t *pred, int n)
+{
+    int cbp = 0;
+    for (int k = 0; k < n; k++)
+        if (cur[k] == pred[k])
+            cbp |= 1 << k;
+    bytestream2_put_le16(&sl->pbyte, cbp);
+    for (int k = 0; k < n; k++)
+        if (cur[k] != pred[k])
+            put_delta(s, &sl->pb_nb, &sl->pb, &sl->pbyte, cur[k] - pred[k], cur[k]);
+}
+
+/* gathers the in-picture pixels of the 4x4 block at (x,y) of src, and the
+ * corresponding pixels of ref displaced by (dx,dy); returns their number */
+static int gather_block(const AVCodecContext *avctx, const uint8_t *src, ptrdiff_t linesize,
+                        const uint8_t *ref, ptrdiff_t ref_linesize,
+                        int x, int y, int dx, int dy, uint16_t *cur, uint16_t *pred)
+{
+    int n = 0;
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 4; i++) {
+            if (x + i < avctx->width && y + j < avctx->height) {
+                if (cur)
+                    cur[n] = get_pixel(src, linesize, x + i, y + j, avctx->width, avctx->height);
+                pred[n] = get_pixel(ref, ref_linesize, x + i + dx, y + j + dy, avctx->width, avctx->height);
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+/* mode 3 repeats the pixel left of each row of the block */
+static int is_edge_copy(const AVCodecContext *avctx, const uint8_t *src, ptrdiff_t linesize, int x, int y)
+{
+    if (!x)
+        return 0;
+    for (int j = y; j < FFMIN(y + 4, avctx->height); j++) {
+        const uint8_t *row = src + j * linesize;
+        for (int i = x; i < FFMIN(x + 4, avctx->width); i++)
+            if (AV_RN16(row + i*2) != AV_RN16(row + x*2 - 2))
+                return 0;
+    }
+    return 1;
+}
+
+static int best_intra_mode(const AVCodecContext *avctx, const QmageEncContext *s, const uint8_t *src, ptrdiff_t linesize,
+                           int x, int y, int cbp, uint16_t *cur, uint16_t *pred, int *cost)
+{
+    int best = 3, best_cost = INT_MAX;
+    int n = gather_block(avctx, src, linesize, src, linesize, x, y, 0, 0, cur, pred);
+
+    if (is_edge_copy(avctx, src, linesize, x, y)) {
+        *cost = 0;
+        return 3;
+    }
+    for (int mode = 0; mode < 3; mode++) {
+        uint16_t tmp[16];
+        int c;
+        gather_block(avctx, src, linesize, src, linesize, x, y,
+                     qmage_dir[mode].x, qmage_dir[mode].y, NULL, tmp);
+        c = cbp ? block_cost_cbp(s, cur, tmp, n) : block_cost(s, cur, tmp);
+        if (c < best_cost) {
+            best_cost = c;
+            best = mode;
+            memcpy(pred, tmp, sizeof(tmp));
+        }
+    }
+    *cost = best_cost;
+    return best;
+}
+
+static int key_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    QmageEncContext *s = avctx->priv_data;
+    SliceContext *sl = &s->slices[jobnr];
+    const uint8_t *src = s->cur->data[0];
+    ptrdiff_t linesize = s->cur->linesize[0];
+
+    init_put_bits(&sl->pb,    sl->buf1, s->buf1_size);
+    init_put_bits(&sl->pb_nb, sl->buf2, s->buf2_size);
+    bytestream2_init_writer(&sl->pbyte, sl->buf3, s->buf3_size);
+
+    for (int y = jobnr * 16; y < FFMIN(jobnr * 16 + 16, avctx->height); y += 4) {
+        for (int x = 0; x < avctx->width; x += 4) {
+            uint16_t cur[16], pred[16];
+            int cost, n = FFMIN(avctx->width - x, 4) * FFMIN(avctx->height - y, 4);
+            int mode = best_intra_mode(avctx, s, src, linesize, x, y, 1, cur, pred, &cost);
+
+            put_bits(&sl->pb, 2, mode);
+            if (mode < 3)
+                put_block_cbp(s, sl, cur, pred, n);
+        }
+    }
+    sl->bits    = put_bits_count(&sl->pb);
+    sl->bits_nb = put_bits_count(&sl->pb_nb);
+    flush_put_bits(&sl->pb);
+    flush_put_bits(&sl->pb_nb);
+    return 0;
+}
+
+static int mb_diff(const uint8_t *src, ptrdiff_t linesize, const uint8_t *ref, ptrdiff_t ref_linesize,
+                   int x, int y, int mv_x, int mv_y, int limit)
+{
+    int diff = 0;
+    src += y * linesize + x * 2;
+    ref += (y + mv_y) * ref_linesize + (x + mv_x) * 2;
+    for (int j = 0; j < 16; j++) {
+        for (int i = 0; i < 16; i++)
+            diff += AV_RN16(src + i*2) != AV_RN16(ref + i*2);
+        if (diff >= limit)
+            return diff;
+        src += linesize;
+        ref += ref_linesize;
+    }
+    return diff;
+}
+
+static int mv_valid(const AVCodecContext *avctx, const QmageEncContext *s, int x, int y, int mv_x, int mv_y)
+{
+    return mv_x >= FFMAX(MV_MIN_X, -s->me_range) && mv_x <= FFMIN(MV_MAX_X, s->me_range) &&
+           mv_y >= FFMAX(MV_MIN_Y, -s->me_range) && mv_y <= FFMIN(MV_MAX_Y, s->me_range) &&
+           x + mv_x >= 0 && x + mv_x + 16 <= avctx->width &&
+           y + mv_y >= 0 && y + mv_y + 16 <= avctx->height;
+}
+
+/* returns the number of differing pixels at the best motion vector */
+static int motion_search(AVCodecContext *avctx, const uint8_t *src, ptrdiff_t linesize,
+                         const uint8_t *ref, ptrdiff_t ref_linesize, int x, int y, int *mv)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int mb = (y >> 4) * s->mb_width + (x >> 4);
+    int best = mb_diff(src, linesize, ref, ref_linesize, x, y, 0, 0, INT_MAX);
+
+    mv[0] = mv[1] = 0;
+
+    if (s->motion_est == ME_FULL) {
+        for (int dy = -s->me_range; dy <= s->me_range && best; dy++) {
+            for (int dx = -s->me_range; dx <= s->me_range && best; dx++) {
+                int d;
+                if (!mv_valid(avctx, s, x, y, dx, dy))
+                    continue;
+                d = mb_diff(src, linesize, ref, ref_linesize, x, y, dx, dy, best);
+                if (d < best) {
+                    best  = d;
+                    mv[0] = dx;
+                    mv[1] = dy;
+                }
+            }
+        }
+    } else {
+        /* predictors from the left and co-located macroblocks, then a
+         * small diamond refinement */
+        const int16_t pred[3][2] = {
+            { (x >> 4) ? s->mvs[mb - 1][0] : 0, (x >> 4) ? s->mvs[mb - 1][1] : 0 },
+            { s->last_mvs[mb][0], s->last_mvs[mb][1] },
+            { (x >> 4) && (y >> 4) ? s->last_mvs[mb - s->mb_width - 1][0] : 0,
+              (x >> 4) && (y >> 4) ? s->last_mvs[mb - s->mb_width - 1][1] : 0 },
+        };
+        static const int8_t diamond[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+        for (int i = 0; i < FF_ARRAY_ELEMS(pred) && best; i++) {
+            int d;
+            if (!mv_valid(avctx, s, x, y, pred[i][0], pred[i][1]))
+                continue;
+            d = mb_diff(src, linesize, ref, ref_linesize, x, y, pred[i][0], pred[i][1], best);
+            if (d < best) {
+                best  = d;
+                mv[0] = pred[i][0];
+                mv[1] = pred[i][1];
+            }
+        }
+        for (int step = 4; step && best; step >>= 1) {
+            int moved = 1;
+            for (int iter = 0; moved && best && iter < 16; iter++) {
+                int cx = mv[0], cy = mv[1];
+                moved = 0;
+                for (int i = 0; i < 4; i++) {
+                    int dx = cx + diamond[i][0] * step, dy = cy + diamond[i][1] * step, d;
+                    if (!mv_valid(avctx, s, x, y, dx, dy))
+                        continue;
+                    d = mb_diff(src, linesize, ref, ref_linesize, x, y, dx, dy, best);
+                    if (d < best) {
+                        best  = d;
+                        mv[0] = dx;
+                        mv[1] = dy;
+                        moved = 1;
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/* chooses the decode_block3_ani() modes of a macroblock for motion vector mv */
+static int mb_inter_cost(AVCodecContext *avctx, const uint8_t *src, ptrdiff_t linesize,
+                         const uint8_t *ref, ptrdiff_t ref_linesize, int x, int y, const int *mv, uint8_t *modes)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int total = 0;
+
+    for (int j = 0; j < 16; j += 4) {
+        for (int i = 0; i < 16; i += 4) {
+            uint16_t cur[16], pred[16];
+            int cost, mode = best_intra_mode(avctx, s, src, linesize, x + i, y + j, 0, cur, pred, &cost);
+
+            gather_block(avctx, src, linesize, ref, ref_linesize, x + i, y + j, 0, 0, NULL, pred);
+            if (!memcmp(cur, pred, sizeof(cur))) {
+                mode = 5;
+                cost = 0;
+            } else {
+                int c = block_cost(s, cur, pred);
+                if (c < cost) {
+                    mode = 4;
+                    cost = c;
+                }
+            }
+            if (cost && (mv[0] || mv[1])) {
+                int c;
+                gather_block(avctx, src, linesize, ref, ref_linesize, x + i, y + j, mv[0], mv[1], NULL, pred);
+                c = memcmp(cur, pred, sizeof(cur)) ? block_cost(s, cur, pred) : 0;
+                if (c < cost) {
+                    mode = c ? 6 : 7;
+                    cost = c;
+                }
+            }
+            modes[(j >> 2) * 4 + (i >> 2)] = mode;
+            total += 3 + cost;
+        }
+    }
+    return total;
+}
+
+static int mb_intra_cost(AVCodecContext *avctx, const uint8_t *src, ptrdiff_t linesize, int x, int y, uint8_t *modes)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int total = 1;
+
+    for (int j = 0; j < 16; j += 4) {
+        for (int i = 0; i < 16; i += 4) {
+            uint16_t cur[16], pred[16];
+            int cost;
+            modes[(j >> 2) * 4 + (i >> 2)] = best_intra_mode(avctx, s, src, linesize, x + i, y + j, 0, cur, pred, &cost);
+            total += 2 + cost;
+        }
+    }
+    return total;
+}
+
+static void put_mb_blocks(AVCodecContext *avctx, SliceContext *sl, const uint8_t *src, ptrdiff_t linesize,
+                          const uint8_t *ref, ptrdiff_t ref_linesize, int x, int y, const int *mv,
+                          const uint8_t *modes, int inter)
+{
+    QmageEncContext *s = avctx->priv_data;
+
+    for (int j = 0; j < 16; j += 4) {
+        for (int i = 0; i < 16; i += 4) {
+            int mode = modes[(j >> 2) * 4 + (i >> 2)];
+            uint16_t cur[16], pred[16];
+
+            put_bits(&sl->pb, inter ? 3 : 2, mode);
+            if (mode < 3)
+                gather_block(avctx, src, linesize, src, linesize, x + i, y + j,
+                             qmage_dir[mode].x, qmage_dir[mode].y, cur, pred);
+            else if (mode == 4)
+                gather_block(avctx, src, linesize, ref, ref_linesize, x + i, y + j, 0, 0, cur, pred);
+            else if (mode == 6)
+                gather_block(avctx, src, linesize, ref, ref_linesize, x + i, y + j, mv[0], mv[1], cur, pred);
+            else
+                continue;
+            put_block(s, sl, cur, pred);
+        }
+    }
+}
+
+static void encode_mbedge(AVCodecContext *avctx, SliceContext *sl, const uint8_t *src, ptrdiff_t linesize, int xpos, int ypos)
+{
+    QmageEncContext *s = avctx->priv_data;
+
+    put_bits(&sl->pb, 1, 0);
+    for (int y = ypos; y < FFMIN(ypos + 16, avctx->height); y += 4) {
+        for (int x = xpos; x < FFMIN(xpos + 16, avctx->width); x += 4) {
+            if (x + 4 <= avctx->width && y + 4 <= avctx->height) {
+                uint16_t cur[16], pred[16];
+                int cost, mode = best_intra_mode(avctx, s, src, linesize, x, y, 0, cur, pred, &cost);
+                put_bits(&sl->pb, 2, mode);
+                if (mode < 3)
+                    put_block(s, sl, cur, pred);
+            } else {
+                for (int j = 0; j < 4; j++)
+                    for (int i = 0; i < 4; i++)
+                        if (x + i < avctx->width && y + j < avctx->height)
+                            bytestream2_put_le16(&sl->pbyte, AV_RN16(src + (y+j)*linesize + (x+i)*2));
+            }
+        }
+    }
+}
+
+static int inter_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    QmageEncContext *s = avctx->priv_data;
+    SliceContext *sl = &s->slices[jobnr];
+    const uint8_t *src = s->cur->data[0], *ref = s->last->data[0];
+    ptrdiff_t linesize = s->cur->linesize[0], ref_linesize = s->last->linesize[0];
+    int y = jobnr * 16;
+
+    init_put_bits(&sl->pb, sl->buf1, s->buf1_size);
+    bytestream2_init_writer(&sl->pbyte, sl->buf3, s->buf3_size);
+
+    for (int x = 0; x < avctx->width; x += 16) {
+        int mb = jobnr * s->mb_width + (x >> 4);
+        uint8_t modes[16], modes_mv[16], modes_intra[16];
+        int mv[2], zero[2] = { 0, 0 };
+        int cost, cost_mv = INT_MAX, cost_intra, diff;
+
+        s->mvs[mb][0] = s->mvs[mb][1] = 0;
+        if (avctx->width - x < 16 || avctx->height - y < 16) {
+            encode_mbedge(avctx, sl, src, linesize, x, y);
+            continue;
+        }
+
+        if (!mb_diff(src, linesize, ref, ref_linesize, x, y, 0, 0, 1)) {
+            put_bits(&sl->pb, 2, 3);
+            continue;
+        }
+
+        diff = motion_search(avctx, src, linesize, ref, ref_linesize, x, y, mv);
+        if (mv[0] || mv[1]) {
+            s->mvs[mb][0] = mv[0];
+            s->mvs[mb][1] = mv[1];
+            if (!diff) {
+                put_bits(&sl->pb, 3, 4);
+                put_bits(&sl->pb, 8, mv[0] + 0x7f);
+                put_bits(&sl->pb, 7, mv[1] + 0x3f);
+                put_bits(&sl->pb, 1, 1);
+                continue;
+            }
+            cost_mv = 19 + mb_inter_cost(avctx, src, linesize, ref, ref_linesize, x, y, mv, modes_mv);
+        }
+        cost       = 3 + mb_inter_cost(avctx, src, linesize, ref, ref_linesize, x, y, zero, modes);
+        cost_intra = mb_intra_cost(avctx, src, linesize, x, y, modes_intra);
+
+        if (cost_intra <= cost && cost_intra <= cost_mv) {
+            put_bits(&sl->pb, 1, 0);
+            put_mb_blocks(avctx, sl, src, linesize, ref, ref_linesize, x, y, zero, modes_intra, 0);
+        } else if (cost <= cost_mv) {
+            put_bits(&sl->pb, 3, 5);
+            put_mb_blocks(avctx, sl, src, linesize, ref, ref_linesize, x, y, zero, modes, 1);
+        } else {
+            put_bits(&sl->pb, 3, 4);
+            put_bits(&sl->pb, 8, mv[0] + 0x7f);
+            put_bits(&sl->pb, 7, mv[1] + 0x3f);
+            put_bits(&sl->pb, 1, 0);
+            put_mb_blocks(avctx, sl, src, linesize, ref, ref_linesize, x, y, mv, modes_mv, 1);
+        }
+    }
+    sl->bits    = put_bits_count(&sl->pb);
+    sl->bits_nb = 0;
+    flush_put_bits(&sl->pb);
+    return 0;
+}
+
+static int encode_a9ll(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *frame, int key)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int64_t bits1 = 0, bits2 = 0, size3 = 0, size;
+    int size1, size2, delay, ret;
+    PutBitContext pb;
+    uint8_t *buf;
+
+    avctx->execute2(avctx, key ? key_slice : inter_slice, NULL, NULL, s->nb_slices);
+
+    for (int i = 0; i < s->nb_slices; i++) {
+        bits1 += s->slices[i].bits;
+        bits2 += s->slices[i].bits_nb;
+        size3 += bytestream2_tell_p(&s->slices[i].pbyte);
+    }
+    size1 = (bits1 + 7) >> 3;
+    size2 = (bits2 + 7) >> 3;
+    size  = HEADER_SIZE_ANI + 8 + (int64_t)size1 + size2 + size3;
+    if (size > INT_MAX)
+        return AVERROR(ERANGE);
+
+    if ((ret = ff_get_encode_buffer(avctx, pkt, size, 0)) < 0)
+        return ret;
+    buf = pkt->data;
+
+    delay = av_rescale_q(frame->duration > 0 ? frame->duration : 1, avctx->time_base, (AVRational){ 1, 1000 });
+
+    bytestream_put_be16(&buf, QMAGE_MAGIC);
+    bytestream_put_byte(&buf, QVERSION_1_43_LESS);
+    bytestream_put_byte(&buf, 0);       // raw_type: RGB565
+    bytestream_put_byte(&buf, 0x80);    // mode: animation
+    bytestream_put_byte(&buf, 0);
+    bytestream_put_le16(&buf, avctx->width);
+    bytestream_put_le16(&buf, avctx->height);
+    bytestream_put_le16(&buf, 0);
+    bytestream_put_le32(&buf, size);    // alpha_position: no alpha follows
+    bytestream_put_le16(&buf, 0);       // total_frame_number, see the muxer
+    bytestream_put_le16(&buf, FFMIN(s->frame_number + 1, UINT16_MAX));
+    bytestream_put_le16(&buf, av_clip_uint16(delay));
+    bytestream_put_le16(&buf, 0);
+
+    bytestream_put_le32(&buf, HEADER_SIZE_ANI + 8 + size1);
+    bytestream_put_le32(&buf, HEADER_SIZE_ANI + 8 + size1 + size2);
+
+    init_put_bits(&pb, buf, size1);
+    for (int i = 0; i < s->nb_slices; i++)
+        ff_copy_bits(&pb, s->slices[i].buf1, s->slices[i].bits);
+    flush_put_bits(&pb);
+    buf += size1;
+
+    if (key) {
+        init_put_bits(&pb, buf, size2);
+        for (int i = 0; i < s->nb_slices; i++)
+            ff_copy_bits(&pb, s->slices[i].buf2, s->slices[i].bits_nb);
+        flush_put_bits(&pb);
+        buf += size2;
+    }
+
+    for (int i = 0; i < s->nb_slices; i++)
+        bytestream_put_buffer(&buf, s->slices[i].buf3, bytestream2_tell_p(&s->slices[i].pbyte));
+
+    return 0;
+}
+
+static int qmage_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
+                              const AVFrame *frame, int *got_packet)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int key = !s->animation || !s->frame_number;
+    int ret;
+
+    s->cur = frame;
+    if (!s->animation) {
+        ret = encode_w2_pass(avctx, pkt);
+    } else {
+        ret = encode_a9ll(avctx, pkt, frame, key);
+        if (ret >= 0) {
+            int16_t (*tmp)[2] = s->mvs;
+            s->mvs      = s->last_mvs;
+            s->last_mvs = tmp;
+            av_frame_unref(s->last);
+            ret = av_frame_ref(s->last, frame);
+        }
+    }
+    s->cur = NULL;
+    if (ret < 0)
+        return ret;
+
+    s->frame_number++;
+    if (key)
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    *got_packet = 1;
+    return 0;
+}
+
+static av_cold int qmage_encode_init(AVCodecContext *avctx)
+{
+    QmageEncContext *s = avctx->priv_data;
+    int mb_height;
+
+    if (avctx->width > UINT16_MAX || avctx->height > UINT16_MAX) {
+        av_log(avctx, AV_LOG_ERROR, "dimensions too large\n");
+        return AVERROR(EINVAL);
+    }
+
+    memset(s->inv_delta, 0xff, sizeof(s->inv_delta));
+    for (int c = 253; c >= 0; c--) {
+        int nb = av_log2(c + 2) - 1;
+        s->code_nb[c]  = nb;
+        s->code_idx[c] = c + 2 - (2 << nb);
+        s->inv_delta[qmage_ori_delta[0][c]] = c;
+    }
+    s->inv_delta[0] = 0xff;
+
+    s->me_range = avctx->me_range > 0 ? avctx->me_range : 16;
+    s->mb_width = (avctx->width + 15) >> 4;
+    mb_height   = (avctx->height + 15) >> 4;
+    s->nb_slices = mb_height;
+
+    /* per macroblock row: W2 needs up to 5 index, 2 run and 4 literal bytes
+     * per pixel pair, A9LL keyframes 7 + 3 delta bits and 2 + 2/16 bytes
+     * per pixel, inter frames less than 16 bits and 2 bytes per pixel */
+    s->buf1_size = 48 * avctx->width + 128;
+    s->buf2_size = 32 * avctx->width + 64;
+    s->buf3_size = 48 * avctx->width + 64;
+
+    s->slices = av_calloc(s->nb_slices, sizeof(*s->slices));
+    if (!s->slices)
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < s->nb_slices; i++) {
+        SliceContext *sl = &s->slices[i];
+        sl->buf1 = av_mallocz(s->buf1_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        sl->buf2 = av_mallocz(s->buf2_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        sl->buf3 = av_mallocz(s->buf3_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        sl->runs = av_malloc_array(8 * avctx->width + 1, sizeof(*sl->runs));
+        if (!sl->buf1 || !sl->buf2 || !sl->buf3 || !sl->runs)
+            return AVERROR(ENOMEM);
+    }
+
+    if (s->animation) {
+        s->last     = av_frame_alloc();
+        s->mvs      = av_calloc(s->mb_width * mb_height, sizeof(*s->mvs));
+        s->last_mvs = av_calloc(s->mb_width * mb_height, sizeof(*s->last_mvs));
+        if (!s->last || !s->mvs || !s->last_mvs)
+            return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+static av_cold int qmage_encode_close(AVCodecContext *avctx)
+{
+    QmageEncContext *s = avctx->priv_data;
+
+    for (int i = 0; i < s->nb_slices && s->slices; i++) {
+        av_freep(&s->slices[i].buf1);
+        av_freep(&s->slices[i].buf2);
+        av_freep(&s->slices[i].buf3);
+        av_freep(&s->slices[i].runs);
+    }
+    av_freep(&s->slices);
+    av_frame_free(&s->last);
+    av_freep(&s->mvs);
+    av_freep(&s->last_mvs);
+    av_freep(&s->hash);
+    s->hash_size = 0;
+    av_freep(&s->table);
+    s->table_size = 0;
+    return 0;
+}
+
+#define OFFSET(x) offsetof(QmageEncContext, x)
+#define VE AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption options[] = {
+    { "animation", "Code an A9LL animation instead of W2-pass stills", OFFSET(animation),
+        AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, VE },
+    { "motion_est", "Motion estimation algorithm", OFFSET(motion_est),
+        AV_OPT_TYPE_INT, { .i64 = ME_FAST }, ME_FAST, ME_FULL, VE, .unit = "motion_est" },
+        { "fast", "Predictors and diamond search", 0, AV_OPT_TYPE_CONST, { .i64 = ME_FAST }, 0, 0, VE, .unit = "motion_est" },
+        { "full", "Exhaustive search within me_range", 0, AV_OPT_TYPE_CONST, { .i64 = ME_FULL }, 0, 0, VE, .unit = "motion_est" },
+    { NULL },
+};
+
+static const AVClass qmage_class = {
+    .class_name = "Qmage encoder",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+const FFCodec ff_qmage_encoder = {
+    .p.name         = "qmage",
+    CODEC_LONG_NAME("Quram Qmage"),
+    .p.type         = AVMEDIA_TYPE_VIDEO,
+    .p.id           = AV_CODEC_ID_QMAGE,
+    .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_SLICE_THREADS |
+                      AV_CODEC_CAP_ENCODER_REORDERED_OPAQUE,
+    .priv_data_size = sizeof(QmageEncContext),
+    .init           = qmage_encode_init,
+    FF_CODEC_ENCODE_CB(qmage_encode_frame),
+    .close          = qmage_encode_close,
+    .p.pix_fmts     = (const enum AVPixelFormat[]){
+        AV_PIX_FMT_RGB565, AV_PIX_FMT_NONE
+    },
+    .p.priv_class   = &qmage_class,
+    .caps_internal  = FF_CODEC_CAP_INIT_CLEANUP,
+};
@@ -34,6 +34,8 @@
 #include "libavutil/pixdesc.h"
 #include "libavutil/rational.h"
 #include "libavutil/samplefmt.h"
+#include "libavutil/thread.h"
+#include "libavutil/trace.h"
 
 #include "audio.h"
 #include "avfilter.h"
@@ -1428,8 +1430,10 @@ int ff_filter_activate(AVFilterContext *filter)
     av_assert1(!(filter->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC &&
                  filter->filter->activate));
     ctxi->ready = 0;
+    av_trace_begin("filter", filter->name, 0);
     ret = filter->filter->activate ? filter->filter->activate(filter) :
           filter_activate_default(filter);
+    av_trace_end();
     if (ret == FFERROR_NOT_READY)
         ret = 0;
     return ret;
@@ -1669,3 +1673,104 @@ int ff_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
 {
     return fffilterctx(ctx)->execute(ctx, func, arg, ret, nb_jobs);
 }
+
+struct FFWavefront {
+    int *progress;
+    int nb_rows;
+    /* row i is protected by lock i % nb_jobs */
+    AVMutex *mutex;
+    AVCond *cond;
+    int nb_jobs;
+};
+
+int ff_wavefront_alloc(FFWavefront **pwf, int nb_rows, int nb_jobs)
+{
+    FFWavefront *wf;
+    int ret;
+
+    wf = av_mallocz(sizeof(*wf));
+    if (!wf)
+        return AVERROR(ENOMEM);
+    *pwf = wf;
+
+    wf->nb_rows  = nb_rows;
+    wf->progress = av_calloc(nb_rows, sizeof(*wf->progress));
+    wf->mutex    = av_calloc(nb_jobs, sizeof(*wf->mutex));
+    wf->cond     = av_calloc(nb_jobs, sizeof(*wf->cond));
+    if (!wf->progress || !wf->mutex || !wf->cond) {
+        ff_wavefront_free(pwf);
+        return AVERROR(ENOMEM);
+    }
+
+    for (; wf->nb_jobs < nb_jobs; wf->nb_jobs++) {
+        if ((ret = ff_mutex_init(&wf->mutex[wf->nb_jobs], NULL))) {
+            ff_wavefront_free(pwf);
+            return AVERROR(ret);
+        }
+        if ((ret = ff_cond_init(&wf->cond[wf->nb_jobs], NULL))) {
+            ff_mutex_destroy(&wf->mutex[wf->nb_jobs]);
+            ff_wavefront_free(pwf);
+            return AVERROR(ret);
+        }
+    }
+
+    return 0;
+}
+
+void ff_wavefront_free(FFWavefront **pwf)
+{
+    FFWavefront *wf = *pwf;
+
+    if (!wf)
+        return;
+
+    for (int i = 0; i < wf->nb_jobs; i++) {
+        ff_mutex_destroy(&wf->mutex[i]);
+        ff_cond_destroy(&wf->cond[i]);
+    }
+    av_freep(&wf->mutex);
+    av_freep(&wf->cond);
+    av_freep(&wf->progress);
+    av_freep(pwf);
+}
+
+void ff_wavefront_wait(FFWavefront *wf, int row, int pos)
+{
+    const int i = row % wf->nb_jobs;
+
+    ff_mutex_lock(&wf->mutex[i]);
+    while (wf->progress[row] < pos)
+        ff_cond_wait(&wf->cond[i], &wf->mutex[i]);
+    ff_mutex_unlock(&wf->mutex[i]);
+}
+
+void ff_wavefront_report(FFWavefront *wf, int row, int pos)
+{
+    const int i = row % wf->nb_jobs;
+
+    ff_mutex_lock(&wf->mutex[i]);
+    wf->progress[row] = pos;
+    ff_cond_broadcast(&wf->cond[i]);
+    ff_mutex_unlock(&wf->mutex[i]);
+}
+
+int ff_filter_execute_wavefront(AVFilterContext *ctx, avfilter_action_func *func,
+                                void *arg, FFWavefront *wf, int *ret, int nb_jobs)
+{
+    int r;
+
+    memset(wf->progress, 0, wf->nb_rows * sizeof(*wf->progress));
+
+    nb_jobs = FFMIN(nb_jobs, wf->nb_jobs);
+    if (nb_jobs > 1 && ctx->thread_type & AVFILTER_THREAD_SLICE) {
+        nb_jobs = ff_graph_thread_execute_concurrent(fffiltergraph(ctx->graph), ctx,
+                                                     func, arg, ret, nb_jobs);
+        if (nb_jobs > 1)
+            return nb_jobs;
+    }
+
+    r = func(ctx, arg, 0, 1);
+    if (ret)
+        ret[0] = r;
+    return 1;
+}
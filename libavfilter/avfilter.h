@@ -828,6 +828,19 @@ typedef struct AVFilterGraph {
     avfilter_execute_func *execute;
 
     char *aresample_swr_opts; ///< swr options to use for the auto-inserted aresample filters, Access ONLY through AVOptions
+
+    /**
+     * A reference to an AVThreadPool (see libavutil/threadpool.h) to run
+     * slice threaded filters on, instead of threads private to this graph.
+     * May be set by the caller before adding any filters to the filtergraph;
+     * afterwards owned (and freed) by libavfilter. The pool is also used by
+     * the scaling contexts of scale filters in this graph.
+     *
+     * nb_threads still limits the number of threads working on this graph
+     * at once; if it is 0 it defaults to the number of threads of the pool
+     * plus one.
+     */
+    AVBufferRef *thread_pool;
 } AVFilterGraph;
 
 /**
@@ -192,6 +192,17 @@ int ff_graph_thread_init(FFFilterGraph *graph);
 
 void ff_graph_thread_free(FFFilterGraph *graph);
 
+/**
+ * Run nb_jobs jobs of func on the slice threads of the graph, all at the same
+ * time.
+ *
+ * @return the number of jobs func was run with, or 0 if the graph cannot run
+ *         the jobs concurrently, in which case func was not run
+ */
+int ff_graph_thread_execute_concurrent(FFFilterGraph *graph, AVFilterContext *ctx,
+                                       avfilter_action_func *func, void *arg,
+                                       int *ret, int nb_jobs);
+
 /**
  * Negotiate the media format, dimensions, etc of all inputs to a filter.
  *
@@ -78,6 +78,13 @@ int ff_graph_thread_init(FFFilterGraph *graph)
     graph->p.nb_threads  = 1;
     return 0;
 }
+
+int ff_graph_thread_execute_concurrent(FFFilterGraph *graph, AVFilterContext *ctx,
+                                       avfilter_action_func *func, void *arg,
+                                       int *ret, int nb_jobs)
+{
+    return 0;
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -126,6 +133,7 @@ void avfilter_graph_free(AVFilterGraph **graphp)
         avfilter_free(graph->filters[0]);
 
     ff_graph_thread_free(graphi);
+    av_buffer_unref(&graph->thread_pool);
 
     av_freep(&graphi->sink_links);
 
@@ -28,16 +28,14 @@
 #include "libavutil/avstring.h"
 #include "libavutil/eval.h"
 #include "libavutil/fifo.h"
-#include "libavutil/imgutils.h"
 #include "libavutil/internal.h"
 #include "libavutil/opt.h"
-#include "libavutil/pixdesc.h"
 #include "avfilter.h"
 #include "audio.h"
 #include "filters.h"
 #include "formats.h"
 #include "video.h"
-#include "scene_sad.h"
+#include "scene_detect.h"
 
 static const char *const var_names[] = {
     "TB",                ///< timebase
@@ -162,14 +160,9 @@ typedef struct SelectContext {
     char *expr_str;
     AVExpr *expr;
     double var_values[VAR_VARS_NB];
-    int bitdepth;
-    int nb_planes;
-    ptrdiff_t width[4];
-    ptrdiff_t height[4];
     int do_scene_detect;            ///< 1 if the expression requires scene detection variables, 0 otherwise
-    ff_scene_sad_fn sad;            ///< Sum of the absolute difference function (scene detect only)
+    SceneDetectContext sd;          ///< frame difference measurement            (scene detect only)
     double prev_mafd;               ///< previous MAFD                           (scene detect only)
-    AVFrame *prev_picref;           ///< previous frame                          (scene detect only)
     double select;
     int select_out;                 ///< mark the selected output pad index
     int nb_outputs;
@@ -182,6 +175,7 @@ static const AVOption filt_name##_options[] = {                     \
     { "e",    "set an expression to use for selecting frames", OFFSET(expr_str), AV_OPT_TYPE_STRING, { .str = "1" }, .flags=FLAGS }, \
     { "outputs", "set the number of outputs", OFFSET(nb_outputs), AV_OPT_TYPE_INT, {.i64 = 1}, 1, INT_MAX, .flags=FLAGS }, \
     { "n",       "set the number of outputs", OFFSET(nb_outputs), AV_OPT_TYPE_INT, {.i64 = 1}, 1, INT_MAX, .flags=FLAGS }, \
+    { "scene_step", "set the pixel and row step of the scene detection", OFFSET(sd.step), AV_OPT_TYPE_INT, {.i64 = 1}, 1, 16, .flags=FLAGS }, \
     { NULL }                                                            \
 }
 
@@ -222,21 +216,6 @@ static av_cold int init(AVFilterContext *ctx)
 static int config_input(AVFilterLink *inlink)
 {
     SelectContext *select = inlink->dst->priv;
-    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
-    int is_yuv = !(desc->flags & AV_PIX_FMT_FLAG_RGB) &&
-                 (desc->flags & AV_PIX_FMT_FLAG_PLANAR) &&
-                 desc->nb_components >= 3;
-
-    select->bitdepth = desc->comp[0].depth;
-    select->nb_planes = is_yuv ? 1 : av_pix_fmt_count_planes(inlink->format);
-
-    for (int plane = 0; plane < select->nb_planes; plane++) {
-        ptrdiff_t line_size = av_image_get_linesize(inlink->format, inlink->w, plane);
-        int vsub = desc->log2_chroma_h;
-
-        select->width[plane] = line_size >> (select->bitdepth > 8);
-        select->height[plane] = plane == 1 || plane == 2 ?  AV_CEIL_RSHIFT(inlink->h, vsub) : inlink->h;
-    }
 
     select->var_values[VAR_N]          = 0.0;
     select->var_values[VAR_SELECTED_N] = 0.0;
@@ -280,11 +259,8 @@ static int config_input(AVFilterLink *inlink)
     select->var_values[VAR_SAMPLE_RATE] =
         inlink->type == AVMEDIA_TYPE_AUDIO ? inlink->sample_rate : NAN;
 
-    if (CONFIG_SELECT_FILTER && select->do_scene_detect) {
-        select->sad = ff_scene_sad_get_fn(select->bitdepth == 8 ? 8 : 16);
-        if (!select->sad)
-            return AVERROR(EINVAL);
-    }
+    if (CONFIG_SELECT_FILTER && select->do_scene_detect)
+        return ff_scene_detect_config(inlink->dst, &select->sd, inlink);
     return 0;
 }
 
@@ -292,31 +268,16 @@ static double get_scene_score(AVFilterContext *ctx, AVFrame *frame)
 {
     double ret = 0;
     SelectContext *select = ctx->priv;
-    AVFrame *prev_picref = select->prev_picref;
+    uint64_t sad, count;
 
-    if (prev_picref &&
-        frame->height == prev_picref->height &&
-        frame->width  == prev_picref->width) {
-        uint64_t sad = 0;
+    if (CONFIG_SELECT_FILTER && ff_scene_detect_sad(ctx, &select->sd, frame, &sad, &count)) {
         double mafd, diff;
-        uint64_t count = 0;
-
-        for (int plane = 0; plane < select->nb_planes; plane++) {
-            uint64_t plane_sad;
-            select->sad(prev_picref->data[plane], prev_picref->linesize[plane],
-                    frame->data[plane], frame->linesize[plane],
-                    select->width[plane], select->height[plane], &plane_sad);
-            sad += plane_sad;
-            count += select->width[plane] * select->height[plane];
-        }
 
-        mafd = (double)sad / count / (1ULL << (select->bitdepth - 8));
+        mafd = (double)sad / count / (1ULL << (select->sd.bitdepth - 8));
         diff = fabs(mafd - select->prev_mafd);
         ret  = av_clipf(FFMIN(mafd, diff) / 100., 0, 1);
         select->prev_mafd = mafd;
-        av_frame_free(&prev_picref);
     }
-    select->prev_picref = av_frame_clone(frame);
     return ret;
 }
 
@@ -466,9 +427,8 @@ static av_cold void uninit(AVFilterContext *ctx)
     av_expr_free(select->expr);
     select->expr = NULL;
 
-    if (select->do_scene_detect) {
-        av_frame_free(&select->prev_picref);
-    }
+    if (CONFIG_SELECT_FILTER && select->do_scene_detect)
+        ff_scene_detect_uninit(&select->sd);
 }
 
 #if CONFIG_ASELECT_FILTER
@@ -566,6 +526,7 @@ const AVFilter ff_vf_select = {
     .priv_class    = &select_class,
     FILTER_INPUTS(avfilter_vf_select_inputs),
     FILTER_QUERY_FUNC2(query_formats),
-    .flags         = AVFILTER_FLAG_DYNAMIC_OUTPUTS | AVFILTER_FLAG_METADATA_ONLY,
+    .flags         = AVFILTER_FLAG_DYNAMIC_OUTPUTS | AVFILTER_FLAG_METADATA_ONLY |
+                     AVFILTER_FLAG_SLICE_THREADS,
 };
 #endif /* CONFIG_SELECT_FILTER */
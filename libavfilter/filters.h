@@ -603,4 +603,45 @@ int ff_fmt_is_in(int fmt, const int *fmts);
 int ff_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
                       void *arg, int *ret, int nb_jobs);
 
+/**
+ * Progress of the rows processed by slice jobs that wait on each other,
+ * e.g. for a wavefront where a row can only be processed once the row above
+ * it is done up to some point.
+ */
+typedef struct FFWavefront FFWavefront;
+
+/**
+ * Allocate a wavefront.
+ *
+ * @param nb_rows number of rows
+ * @param nb_jobs maximum number of jobs the rows will be dealt to
+ */
+int ff_wavefront_alloc(FFWavefront **wf, int nb_rows, int nb_jobs);
+
+void ff_wavefront_free(FFWavefront **wf);
+
+/**
+ * Wait until row has been reported done up to pos.
+ */
+void ff_wavefront_wait(FFWavefront *wf, int row, int pos);
+
+/**
+ * Report that row is done up to pos, waking up the jobs waiting for it.
+ */
+void ff_wavefront_report(FFWavefront *wf, int row, int pos);
+
+/**
+ * Like ff_filter_execute(), for jobs that wait on each other through wf.
+ *
+ * Such jobs must all run at the same time, which only the slice threads
+ * owned by the filtergraph guarantee. Without them, e.g. with a user
+ * supplied AVFilterGraph.execute callback, func is run as a single job.
+ * The progress of all rows is reset before func is run.
+ *
+ * @param ret if not NULL, receives the return value of each job run
+ * @return the number of jobs func was run with
+ */
+int ff_filter_execute_wavefront(AVFilterContext *ctx, avfilter_action_func *func,
+                                void *arg, FFWavefront *wf, int *ret, int nb_jobs);
+
 #endif /* AVFILTER_FILTERS_H */
@@ -23,6 +23,7 @@
 
 #include <stddef.h>
 
+#include "libavutil/buffer.h"
 #include "libavutil/error.h"
 #include "libavutil/macros.h"
 #include "libavutil/mem.h"
@@ -34,6 +35,8 @@
 typedef struct ThreadContext {
     AVFilterGraph *graph;
     AVSliceThread *thread;
+    /* for jobs that wait on each other, when thread runs on a shared pool */
+    AVSliceThread *private_thread;
     avfilter_action_func *func;
 
     /* per-execute parameters */
@@ -53,6 +56,7 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
 static void slice_thread_uninit(ThreadContext *c)
 {
     avpriv_slicethread_free(&c->thread);
+    avpriv_slicethread_free(&c->private_thread);
 }
 
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -73,7 +77,8 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
 
 static int thread_init_internal(ThreadContext *c, int nb_threads)
 {
-    nb_threads = avpriv_slicethread_create(&c->thread, c, worker_func, NULL, nb_threads);
+    nb_threads = avpriv_slicethread_create_pool(&c->thread, c, worker_func, NULL, nb_threads,
+                                                c->graph->thread_pool);
     if (nb_threads <= 1)
         avpriv_slicethread_free(&c->thread);
     return FFMAX(nb_threads, 1);
@@ -82,6 +87,7 @@ static int thread_init_internal(ThreadContext *c, int nb_threads)
 int ff_graph_thread_init(FFFilterGraph *graphi)
 {
     AVFilterGraph *graph = &graphi->p;
+    ThreadContext *c;
     int ret;
 
     if (graph->nb_threads == 1) {
@@ -89,11 +95,12 @@ int ff_graph_thread_init(FFFilterGraph *graphi)
         return 0;
     }
 
-    graphi->thread = av_mallocz(sizeof(ThreadContext));
-    if (!graphi->thread)
+    graphi->thread = c = av_mallocz(sizeof(ThreadContext));
+    if (!c)
         return AVERROR(ENOMEM);
+    c->graph = graph;
 
-    ret = thread_init_internal(graphi->thread, graph->nb_threads);
+    ret = thread_init_internal(c, graph->nb_threads);
     if (ret <= 1) {
         av_freep(&graphi->thread);
         graph->thread_type = 0;
@@ -107,6 +114,39 @@ int ff_graph_thread_init(FFFilterGraph *graphi)
     return 0;
 }
 
+int ff_graph_thread_execute_concurrent(FFFilterGraph *graphi, AVFilterContext *ctx,
+                                       avfilter_action_func *func, void *arg,
+                                       int *ret, int nb_jobs)
+{
+    ThreadContext *c = graphi->thread;
+
+    // a user supplied execute callback gives no guarantee at all
+    if (!c)
+        return 0;
+
+    // each job gets a thread of its own
+    nb_jobs = FFMIN(nb_jobs, c->graph->nb_threads);
+    if (!c->graph->thread_pool) {
+        thread_execute(ctx, func, arg, ret, nb_jobs);
+        return nb_jobs;
+    }
+
+    /* The threads of a shared pool may all be busy with other work, so the
+     * jobs could end up waiting for each other forever. Use private threads,
+     * created the first time they are needed. */
+    if (!c->private_thread &&
+        avpriv_slicethread_create(&c->private_thread, c, worker_func, NULL,
+                                  c->graph->nb_threads) < 0)
+        return 0;
+
+    c->ctx  = ctx;
+    c->arg  = arg;
+    c->func = func;
+    c->rets = ret;
+    avpriv_slicethread_execute(c->private_thread, nb_jobs, 0);
+    return nb_jobs;
+}
+
 void ff_graph_thread_free(FFFilterGraph *graph)
 {
     if (graph->thread)
@@ -0,0 +1,237 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Frame difference measurement shared by the scene change detectors
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/dict.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+
+#include "filters.h"
+#include "scene_detect.h"
+
+typedef struct ThreadData {
+    SceneDetectContext *s;
+    const AVFrame *prev, *cur;
+} ThreadData;
+
+static uint64_t sad_decimated(const uint8_t *src1, ptrdiff_t stride1,
+                              const uint8_t *src2, ptrdiff_t stride2,
+                              ptrdiff_t width, ptrdiff_t height, int pixstep, int step)
+{
+    uint64_t sad = 0;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += pixstep * step)
+            for (int c = 0; c < pixstep; c++)
+                sad += FFABS(src1[x + c] - src2[x + c]);
+        src1 += stride1 * step;
+        src2 += stride2 * step;
+    }
+    return sad;
+}
+
+static uint64_t sad_decimated16(const uint8_t *src1, ptrdiff_t stride1,
+                                const uint8_t *src2, ptrdiff_t stride2,
+                                ptrdiff_t width, ptrdiff_t height, int pixstep, int step)
+{
+    uint64_t sad = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint16_t *src1w = (const uint16_t *)src1;
+        const uint16_t *src2w = (const uint16_t *)src2;
+
+        for (int x = 0; x < width; x += pixstep * step)
+            for (int c = 0; c < pixstep; c++)
+                sad += FFABS(src1w[x + c] - src2w[x + c]);
+        src1 += stride1 * step;
+        src2 += stride2 * step;
+    }
+    return sad;
+}
+
+static int sad_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ThreadData *td = arg;
+    SceneDetectContext *s = td->s;
+    uint64_t sad = 0;
+
+    for (int plane = 0; plane < s->nb_planes; plane++) {
+        const ptrdiff_t stride1 = td->prev->linesize[plane];
+        const ptrdiff_t stride2 = td->cur->linesize[plane];
+        const int rows  = (s->height[plane] + s->step - 1) / s->step;
+        const int start = (rows *  jobnr     ) / nb_jobs;
+        const int end   = (rows * (jobnr + 1)) / nb_jobs;
+        const uint8_t *src1 = td->prev->data[plane] + start * s->step * stride1;
+        const uint8_t *src2 = td->cur->data[plane]  + start * s->step * stride2;
+
+        if (end <= start)
+            continue;
+
+        if (s->step == 1) {
+            uint64_t plane_sad;
+            s->sad(src1, stride1, src2, stride2, s->width[plane], end - start, &plane_sad);
+            sad += plane_sad;
+        } else if (s->bitdepth > 8) {
+            sad += sad_decimated16(src1, stride1, src2, stride2, s->width[plane],
+                                   end - start, s->pixstep[plane], s->step);
+        } else {
+            sad += sad_decimated(src1, stride1, src2, stride2, s->width[plane],
+                                 end - start, s->pixstep[plane], s->step);
+        }
+    }
+
+    s->slice_sad[jobnr] = sad;
+    return 0;
+}
+
+int ff_scene_detect_config(AVFilterContext *ctx, SceneDetectContext *s, AVFilterLink *inlink)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
+    int is_yuv = !(desc->flags & AV_PIX_FMT_FLAG_RGB) &&
+                 (desc->flags & AV_PIX_FMT_FLAG_PLANAR) &&
+                 desc->nb_components >= 3;
+
+    s->step = FFMAX(s->step, 1);
+    s->bitdepth = desc->comp[0].depth;
+    s->nb_planes = is_yuv ? 1 : av_pix_fmt_count_planes(inlink->format);
+    s->count = 0;
+
+    for (int plane = 0; plane < s->nb_planes; plane++) {
+        ptrdiff_t line_size = av_image_get_linesize(inlink->format, inlink->w, plane);
+        int vsub = desc->log2_chroma_h;
+        int pixels;
+
+        s->width[plane] = line_size >> (s->bitdepth > 8);
+        s->height[plane] = plane == 1 || plane == 2 ?  AV_CEIL_RSHIFT(inlink->h, vsub) : inlink->h;
+
+        s->pixstep[plane] = 1;
+        for (int c = 0; c < desc->nb_components; c++)
+            if (desc->comp[c].plane == plane)
+                s->pixstep[plane] = desc->comp[c].step >> (s->bitdepth > 8);
+
+        pixels = s->width[plane] / s->pixstep[plane];
+        s->count += (uint64_t)((pixels + s->step - 1) / s->step) * s->pixstep[plane] *
+                    ((s->height[plane] + s->step - 1) / s->step);
+    }
+
+    s->sad = ff_scene_sad_get_fn(s->bitdepth == 8 ? 8 : 16);
+    if (!s->sad)
+        return AVERROR(EINVAL);
+
+    s->nb_threads = ff_filter_get_nb_threads(ctx);
+    av_freep(&s->slice_sad);
+    s->slice_sad = av_calloc(s->nb_threads, sizeof(*s->slice_sad));
+    if (!s->slice_sad)
+        return AVERROR(ENOMEM);
+
+    return 0;
+}
+
+static int import_sad(AVFilterContext *ctx, SceneDetectContext *s, const AVFrame *frame,
+                      uint64_t *sad)
+{
+    const AVDictionaryEntry *e_sad    = av_dict_get(frame->metadata, SCENE_DETECT_KEY_SAD,     NULL, 0);
+    const AVDictionaryEntry *e_count  = av_dict_get(frame->metadata, SCENE_DETECT_KEY_COUNT,   NULL, 0);
+    const AVDictionaryEntry *e_step   = av_dict_get(frame->metadata, SCENE_DETECT_KEY_STEP,    NULL, 0);
+    const AVDictionaryEntry *e_ref    = av_dict_get(frame->metadata, SCENE_DETECT_KEY_REF_PTS, NULL, 0);
+    const AVDictionaryEntry *e_filter = av_dict_get(frame->metadata, SCENE_DETECT_KEY_FILTER,  NULL, 0);
+    const AVFilterContext *src = ctx->inputs[0]->src;
+
+    if (!e_sad || !e_count || !e_step || !e_ref || !e_filter || s->ref_pts == AV_NOPTS_VALUE)
+        return 0;
+    /* a filter in between may have changed the pixels */
+    if (!src->name || strcmp(e_filter->value, src->name))
+        return 0;
+    if (strtoull(e_count->value, NULL, 10) != s->count ||
+        strtol(e_step->value, NULL, 10) != s->step ||
+        strtoll(e_ref->value, NULL, 10) != s->ref_pts)
+        return 0;
+
+    *sad = strtoull(e_sad->value, NULL, 10) >> FFMAX(16 - s->bitdepth, 0);
+    return 1;
+}
+
+int ff_scene_detect_sad(AVFilterContext *ctx, SceneDetectContext *s, AVFrame *frame,
+                        uint64_t *sad, uint64_t *count)
+{
+    AVFrame *prev_picref = s->prev_picref;
+    int ret = 0;
+
+    if (prev_picref &&
+        frame->height == prev_picref->height &&
+        frame->width  == prev_picref->width) {
+        s->ref_pts = prev_picref->pts;
+        *count = s->count;
+
+        if (!import_sad(ctx, s, frame, sad)) {
+            const int rows = (s->height[0] + s->step - 1) / s->step;
+            ThreadData td = { s, prev_picref, frame };
+            int nb_jobs = FFMAX(1, FFMIN(rows, s->nb_threads));
+
+            ff_filter_execute(ctx, sad_slice, &td, NULL, nb_jobs);
+            *sad = 0;
+            for (int i = 0; i < nb_jobs; i++)
+                *sad += s->slice_sad[i];
+        }
+        ret = 1;
+        av_frame_free(&prev_picref);
+    }
+    s->prev_picref = av_frame_clone(frame);
+    return ret;
+}
+
+int ff_scene_detect_export(AVFilterContext *ctx, SceneDetectContext *s, AVFrame *frame,
+                           uint64_t sad, uint64_t count)
+{
+    char buf[32];
+    int ret;
+
+    /* without a name, the importing filter cannot tell where the SAD was measured */
+    if (!ctx->name)
+        return 0;
+
+    snprintf(buf, sizeof(buf), "%"PRIu64, sad << FFMAX(16 - s->bitdepth, 0));
+    if ((ret = av_dict_set(&frame->metadata, SCENE_DETECT_KEY_SAD, buf, 0)) < 0)
+        return ret;
+    snprintf(buf, sizeof(buf), "%"PRIu64, count);
+    if ((ret = av_dict_set(&frame->metadata, SCENE_DETECT_KEY_COUNT, buf, 0)) < 0)
+        return ret;
+    snprintf(buf, sizeof(buf), "%d", s->step);
+    if ((ret = av_dict_set(&frame->metadata, SCENE_DETECT_KEY_STEP, buf, 0)) < 0)
+        return ret;
+    snprintf(buf, sizeof(buf), "%"PRId64, s->ref_pts);
+    if ((ret = av_dict_set(&frame->metadata, SCENE_DETECT_KEY_REF_PTS, buf, 0)) < 0)
+        return ret;
+    return av_dict_set(&frame->metadata, SCENE_DETECT_KEY_FILTER, ctx->name, 0);
+}
+
+void ff_scene_detect_uninit(SceneDetectContext *s)
+{
+    av_frame_free(&s->prev_picref);
+    av_freep(&s->slice_sad);
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Frame difference measurement shared by the scene change detectors
+ */
+
+#ifndef AVFILTER_SCENE_DETECT_H
+#define AVFILTER_SCENE_DETECT_H
+
+#include <stdint.h>
+
+#include "libavutil/frame.h"
+
+#include "avfilter.h"
+#include "scene_sad.h"
+
+/**
+ * Metadata keys of the exported frame difference. The SAD is scaled to
+ * 16-bit samples, the count is the number of compared samples, step the
+ * decimation step and ref_pts the timestamp of the frame the SAD was
+ * measured against. filter is the name of the exporting filter: any filter
+ * between it and the importing one may change the pixels, so the SAD is
+ * only reused by the filter directly after it.
+ */
+#define SCENE_DETECT_KEY_SAD     "lavfi.scene.sad"
+#define SCENE_DETECT_KEY_COUNT   "lavfi.scene.count"
+#define SCENE_DETECT_KEY_STEP    "lavfi.scene.step"
+#define SCENE_DETECT_KEY_REF_PTS "lavfi.scene.ref_pts"
+#define SCENE_DETECT_KEY_FILTER  "lavfi.scene.filter"
+
+typedef struct SceneDetectContext {
+    int step;                       ///< compare every step-th pixel of every step-th row
+    int bitdepth;
+    int nb_planes;                  ///< only the luma plane for YUV formats
+    int pixstep[4];                 ///< samples per pixel
+    ptrdiff_t width[4];             ///< plane width in samples
+    ptrdiff_t height[4];
+    uint64_t count;                 ///< number of compared samples
+    ff_scene_sad_fn sad;
+    AVFrame *prev_picref;
+    int64_t ref_pts;                ///< timestamp of the frame of the last measurement
+    uint64_t *slice_sad;            ///< SAD of each job
+    int nb_threads;
+} SceneDetectContext;
+
+/**
+ * Set up the measurement for the format and size of the link, the step
+ * must be set before.
+ */
+int ff_scene_detect_config(AVFilterContext *ctx, SceneDetectContext *s, AVFilterLink *inlink);
+
+/**
+ * Measure the sum of absolute differences between the frame and the
+ * previous one, slice threaded on ctx. The SAD exported by the detector
+ * directly upstream of ctx is used instead when it was measured on the
+ * same frames with the same step.
+ *
+ * @return 1 if sad and count were set, 0 if there is no previous frame to
+ *         compare against
+ */
+int ff_scene_detect_sad(AVFilterContext *ctx, SceneDetectContext *s, AVFrame *frame,
+                        uint64_t *sad, uint64_t *count);
+
+/**
+ * Attach the last measurement to the frame metadata, for the detector
+ * directly downstream of ctx.
+ */
+int ff_scene_detect_export(AVFilterContext *ctx, SceneDetectContext *s, AVFrame *frame,
+                           uint64_t sad, uint64_t count);
+
+void ff_scene_detect_uninit(SceneDetectContext *s);
+
+#endif /* AVFILTER_SCENE_DETECT_H */
@@ -116,6 +116,10 @@ typedef struct StreamContext {
     CoarseSignature* curcoarsesig1;
     CoarseSignature* curcoarsesig2;
 
+    /* first pixel column/row of each of the 32 block columns/rows */
+    int blockx[33];
+    int blocky[33];
+
     int coarsecount; /* counter from 0 to 89 */
     int midcoarse;   /* whether it is a coarsesignature beginning from 45 + i * 90 */
     uint32_t lastindex; /* helper to store amount of frames */
@@ -123,12 +127,38 @@ typedef struct StreamContext {
     int exported; /* boolean whether stream already exported */
 } StreamContext;
 
+typedef struct SignatureIndexEntry {
+    char *filename;
+    int nb_coarse;
+    int coarse_start; /* index of the first coarse signature in SignatureIndex.coarse */
+} SignatureIndexEntry;
+
+typedef struct SignatureIndex {
+    SignatureIndexEntry *entries;
+    int nb_entries;
+
+    CoarseSignature *coarse; /* coarse signatures of all entries, only data is set */
+    uint32_t *coarse_entry;  /* entry of every coarse signature */
+    int nb_coarse;
+
+    /* inverted index: the coarse signatures having bit b of word w set are
+     * postings[offsets[w*243+b]] to postings[offsets[w*243+b+1]-1] */
+    uint32_t offsets[5*243+1];
+    uint32_t *postings;
+
+    /* lookup helpers */
+    uint8_t *wordmask;  /* per coarse signature: words with common bits */
+    uint32_t *touched;
+    uint8_t *candidate; /* per entry */
+} SignatureIndex;
+
 typedef struct SignatureContext {
     const AVClass *class;
     /* input parameters */
     int mode;
     int nb_inputs;
     char *filename;
+    char *index_filename;
     int format;
     int thworddist;
     int thcomposdist;
@@ -139,6 +169,8 @@ typedef struct SignatureContext {
 
     uint8_t l1distlut[243*242/2]; /* 243 + 242 + 241 ... */
     StreamContext* streamcontexts;
+    SignatureIndex index;
+    int nb_jobs;
 } SignatureContext;
 
 
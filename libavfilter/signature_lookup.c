@@ -145,6 +145,62 @@ static int get_jaccarddist(SignatureContext *sc, CoarseSignature *first, CoarseS
     return 1;
 }
 
+/**
+ * marks every index entry which has a coarse signature forming a good pair
+ * with one of the coarse signatures of sc. Only coarse signatures sharing
+ * bits with the ones of sc are visited.
+ * @return number of candidate entries
+ */
+static int find_index_candidates(SignatureContext *sc, SignatureIndex *idx, StreamContext *stream)
+{
+    CoarseSignature *cs;
+    int i, w, b, nb_candidates = 0, min_words, max_empty;
+
+    memset(idx->candidate, 0, idx->nb_entries);
+
+    /* a word without common bits has a jaccard distance of 1 << 16 */
+    max_empty = sc->thworddist <= (1 << 16) ? 2 : 5;
+    max_empty = FFMIN(max_empty, sc->thcomposdist >> 16);
+    min_words = 5 - max_empty;
+    if (min_words <= 0) {
+        /* every pair may be good, nothing to prune */
+        memset(idx->candidate, 1, idx->nb_entries);
+        return idx->nb_entries;
+    }
+
+    for (cs = stream->coarsesiglist; cs; cs = cs->next) {
+        int nb_touched = 0;
+
+        for (w = 0; w < 5; w++) {
+            for (b = 0; b < 243; b++) {
+                const uint32_t *post     = idx->postings + idx->offsets[w*243 + b];
+                const uint32_t *post_end = idx->postings + idx->offsets[w*243 + b + 1];
+
+                if (!(cs->data[w][b >> 3] & (0x80 >> (b & 7))))
+                    continue;
+                for (; post < post_end; post++) {
+                    if (!idx->wordmask[*post])
+                        idx->touched[nb_touched++] = *post;
+                    idx->wordmask[*post] |= 1 << w;
+                }
+            }
+        }
+
+        for (i = 0; i < nb_touched; i++) {
+            uint32_t c = idx->touched[i];
+            uint32_t e = idx->coarse_entry[c];
+
+            if (!idx->candidate[e] && av_popcount(idx->wordmask[c]) >= min_words &&
+                get_jaccarddist(sc, cs, &idx->coarse[c])) {
+                idx->candidate[e] = 1;
+                nb_candidates++;
+            }
+            idx->wordmask[c] = 0;
+        }
+    }
+    return nb_candidates;
+}
+
 /**
  * step through the coarsesignatures as long as a good candidate is found
  * @return 0 if no candidate is found, 1 otherwise
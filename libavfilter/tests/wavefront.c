@@ -0,0 +1,124 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program runs filters whose slice jobs wait on each other, with
+ * more threads than a shared thread pool has. It checks that they finish,
+ * and that their output is the same as with threads private to the graph.
+ */
+
+#include <stdio.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/buffer.h"
+#include "libavutil/error.h"
+#include "libavutil/frame.h"
+#include "libavutil/log.h"
+#include "libavutil/threadpool.h"
+
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+#define NB_THREADS 8
+
+static const char *const graphs[] = {
+    "testsrc2=s=320x240:d=1,split[a][b];[b]palettegen[p];"
+    "[a][p]paletteuse=dither=floyd_steinberg,format=rgb24,buffersink@out",
+    "testsrc2=s=320x240:d=1,mestimate=method=epzs,codecview=mv=pf+bf,"
+    "format=rgb24,buffersink@out",
+    "testsrc2=s=320x240:d=0.4,minterpolate=fps=50:me=umh,format=rgb24,buffersink@out",
+};
+
+static int run(const char *desc, AVBufferRef *pool, unsigned *checksum)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *sink;
+    AVFrame *frame = av_frame_alloc();
+    int ret;
+
+    if (!graph || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    graph->nb_threads = NB_THREADS;
+    if (pool) {
+        graph->thread_pool = av_buffer_ref(pool);
+        if (!graph->thread_pool) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+
+    ret = avfilter_graph_parse_ptr(graph, desc, NULL, NULL, NULL);
+    if (ret < 0)
+        goto end;
+    ret = avfilter_graph_config(graph, NULL);
+    if (ret < 0)
+        goto end;
+    sink = avfilter_graph_get_filter(graph, "buffersink@out");
+
+    *checksum = 0;
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+        for (int y = 0; y < frame->height; y++)
+            *checksum = av_adler32_update(*checksum,
+                                          frame->data[0] + y * frame->linesize[0],
+                                          frame->width * 3);
+        av_frame_unref(frame);
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(void)
+{
+    AVBufferRef *pool = NULL;
+    int ret;
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    ret = av_thread_pool_alloc(&pool, 1);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to allocate the thread pool: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(graphs); i++) {
+        unsigned private, shared;
+
+        if ((ret = run(graphs[i], NULL, &private)) < 0 ||
+            (ret = run(graphs[i], pool, &shared)) < 0) {
+            fprintf(stderr, "Failed to run %s: %s\n", graphs[i], av_err2str(ret));
+            break;
+        }
+        if (private != shared) {
+            fprintf(stderr, "Output of %s differs: %08x with private threads, "
+                    "%08x on a shared pool\n", graphs[i], private, shared);
+            ret = AVERROR_BUG;
+            break;
+        }
+    }
+
+    av_buffer_unref(&pool);
+    return ret < 0;
+}
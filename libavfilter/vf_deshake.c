@@ -91,6 +91,8 @@ typedef struct DeshakeContext {
     int counts[2*MAX_R+1][2*MAX_R+1]; ///< Scratch buffer for motion search
     double *angles;            ///< Scratch buffer for block angles
     unsigned angles_size;
+    IntMotionVector *block_mvs; ///< Scratch buffer for the motion of each block
+    unsigned block_mvs_size;
     AVFrame *ref;              ///< Previous frame
     int rx;                    ///< Maximum horizontal shift
     int ry;                    ///< Maximum vertical shift
@@ -239,7 +241,7 @@ static void find_block_motion(DeshakeContext *deshake, uint8_t *src1,
  * really only care about the high contrast blocks, so using this method we
  * can actually skip blocks we don't care much about.
  */
-static int block_contrast(uint8_t *src, int x, int y, int stride, int blocksize)
+static int block_contrast_c(uint8_t *src, int x, int y, int stride, int blocksize)
 {
     int highest = 0;
     int lowest = 255;
@@ -260,6 +262,45 @@ static int block_contrast(uint8_t *src, int x, int y, int stride, int blocksize)
     return highest - lowest;
 }
 
+/**
+ * Same as block_contrast_c(), written as a plain minimum and maximum over
+ * 16 pixel wide rows, which compilers vectorize.
+ */
+static int block_contrast(uint8_t *src, int x, int y, int stride, int blocksize)
+{
+    uint8_t lo[16], hi[16];
+    int lowest, highest, rest = 0;
+    int i, j;
+
+    src += y * stride + x;
+
+    // The first pixel is excluded from the maximum, see below
+    memcpy(lo, src, 16);
+    memcpy(hi, src, 16);
+    hi[0] = 0;
+    for (i = 1; i <= blocksize * 2; i++) {
+        const uint8_t *row = src + i * stride;
+        for (j = 0; j < 16; j++) {
+            lo[j] = FFMIN(lo[j], row[j]);
+            hi[j] = FFMAX(hi[j], row[j]);
+        }
+    }
+
+    lowest  = lo[0];
+    for (j = 0; j < 16; j++) {
+        lowest = FFMIN(lowest, lo[j]);
+        rest   = FFMAX(rest,   hi[j]);
+    }
+
+    // The reference only misses the maximum when it is the first pixel and
+    // no other pixel reaches it, as that pixel is taken as the new minimum
+    if (rest < src[0] && src[0] < 255)
+        return block_contrast_c(src, 0, 0, stride, blocksize);
+
+    highest = FFMAX(rest, src[0]);
+    return highest - lowest;
+}
+
 /**
  * Find the rotation for a given block.
  */
@@ -284,19 +325,69 @@ static double block_angle(int x, int y, int cx, int cy, IntMotionVector *shift)
  * move one pixel to the right and two pixels down, this would yield a
  * motion vector (1, -2).
  */
-static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
-                        int width, int height, int stride, Transform *t)
+typedef struct ThreadData {
+    uint8_t *src1, *src2;
+    int stride;
+    int nb_cols, nb_rows;
+} ThreadData;
+
+/**
+ * Find the motion of a slice of block rows. Blocks that are skipped or
+ * have no match get (-1, -1).
+ */
+static int find_block_motion_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    int x, y;
+    DeshakeContext *deshake = ctx->priv;
+    const ThreadData *td = arg;
+    const int slice_start = (td->nb_rows *  jobnr     ) / nb_jobs;
+    const int slice_end   = (td->nb_rows * (jobnr + 1)) / nb_jobs;
+    // find_block_motion() may start from the previous vector, see find_motion()
     IntMotionVector mv = {0, 0};
+
+    for (int by = slice_start; by < slice_end; by++) {
+        const int y = deshake->ry + by * deshake->blocksize * 2;
+        IntMotionVector *mvs = &deshake->block_mvs[by * td->nb_cols];
+
+        for (int bx = 0; bx < td->nb_cols; bx++) {
+            const int x = deshake->rx + bx * 16;
+            // If the contrast is too low, just skip this block as it probably
+            // won't be very useful to us.
+            const int contrast = block_contrast(td->src2, x, y, td->stride, deshake->blocksize);
+
+            if (contrast > deshake->contrast) {
+                find_block_motion(deshake, td->src1, td->src2, x, y, td->stride, &mv);
+                mvs[bx] = mv;
+            } else {
+                mvs[bx].x = mvs[bx].y = -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int find_motion(AVFilterContext *ctx, uint8_t *src1, uint8_t *src2,
+                       int width, int height, int stride, Transform *t)
+{
+    DeshakeContext *deshake = ctx->priv;
+    int x, y;
     int count_max_value = 0;
-    int contrast;
+    ThreadData td;
+    int nb_jobs;
 
     int pos;
     int center_x = 0, center_y = 0;
     double p_x, p_y;
 
+    // We use a width of 16 here to match the sad function
+    td.nb_cols = FFMAX(width  - deshake->rx * 2 - 1, 0) / 16;
+    td.nb_rows = FFMAX(height - deshake->ry * 2 - 1, 0) / (deshake->blocksize * 2);
+
     av_fast_malloc(&deshake->angles, &deshake->angles_size, width * height / (16 * deshake->blocksize) * sizeof(*deshake->angles));
+    av_fast_malloc(&deshake->block_mvs, &deshake->block_mvs_size,
+                   td.nb_cols * td.nb_rows * sizeof(*deshake->block_mvs));
+    if (td.nb_cols && td.nb_rows && (!deshake->angles || !deshake->block_mvs))
+        return AVERROR(ENOMEM);
 
     // Reset counts to zero
     for (x = 0; x < deshake->rx * 2 + 1; x++) {
@@ -305,25 +396,32 @@ static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
         }
     }
 
+    // Find motion for every block, in parallel over block rows.
+    // The smart search starts from the vector of the previous block if its
+    // coarse pass is empty, so blocks then have to be searched in order.
+    td.src1   = src1;
+    td.src2   = src2;
+    td.stride = stride;
+    nb_jobs = FFMIN(ff_filter_get_nb_threads(ctx), td.nb_rows);
+    if (deshake->search == SMART_EXHAUSTIVE && (!deshake->rx || !deshake->ry))
+        nb_jobs = 1;
+    if (nb_jobs > 0)
+        ff_filter_execute(ctx, find_block_motion_slice, &td, NULL, nb_jobs);
+
+    // Store the motion vectors in the counts
     pos = 0;
-    // Find motion for every block and store the motion vector in the counts
-    for (y = deshake->ry; y < height - deshake->ry - (deshake->blocksize * 2); y += deshake->blocksize * 2) {
-        // We use a width of 16 here to match the sad function
-        for (x = deshake->rx; x < width - deshake->rx - 16; x += 16) {
-            // If the contrast is too low, just skip this block as it probably
-            // won't be very useful to us.
-            contrast = block_contrast(src2, x, y, stride, deshake->blocksize);
-            if (contrast > deshake->contrast) {
-                //av_log(NULL, AV_LOG_ERROR, "%d\n", contrast);
-                find_block_motion(deshake, src1, src2, x, y, stride, &mv);
-                if (mv.x != -1 && mv.y != -1) {
-                    deshake->counts[mv.x + deshake->rx][mv.y + deshake->ry] += 1;
-                    if (x > deshake->rx && y > deshake->ry)
-                        deshake->angles[pos++] = block_angle(x, y, 0, 0, &mv);
-
-                    center_x += mv.x;
-                    center_y += mv.y;
-                }
+    for (int by = 0; by < td.nb_rows; by++) {
+        y = deshake->ry + by * deshake->blocksize * 2;
+        for (int bx = 0; bx < td.nb_cols; bx++) {
+            IntMotionVector *mv = &deshake->block_mvs[by * td.nb_cols + bx];
+            x = deshake->rx + bx * 16;
+            if (mv->x != -1 && mv->y != -1) {
+                deshake->counts[mv->x + deshake->rx][mv->y + deshake->ry] += 1;
+                if (x > deshake->rx && y > deshake->ry)
+                    deshake->angles[pos++] = block_angle(x, y, 0, 0, mv);
+
+                center_x += mv->x;
+                center_y += mv->y;
             }
         }
     }
@@ -362,6 +460,7 @@ static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
     t->angle = av_clipf(t->angle, -0.1, 0.1);
 
     //av_log(NULL, AV_LOG_ERROR, "%d x %d\n", avg->x, avg->y);
+    return 0;
 }
 
 static int deshake_transform_c(AVFilterContext *ctx,
@@ -449,6 +548,8 @@ static av_cold void uninit(AVFilterContext *ctx)
     av_frame_free(&deshake->ref);
     av_freep(&deshake->angles);
     deshake->angles_size = 0;
+    av_freep(&deshake->block_mvs);
+    deshake->block_mvs_size = 0;
     if (deshake->fp)
         fclose(deshake->fp);
 }
@@ -485,7 +586,7 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
 
     if (deshake->cx < 0 || deshake->cy < 0 || deshake->cw < 0 || deshake->ch < 0) {
         // Find the most likely global motion for the current frame
-        find_motion(deshake, (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0], in->data[0], link->w, link->h, in->linesize[0], &t);
+        ret = find_motion(link->dst, (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0], in->data[0], link->w, link->h, in->linesize[0], &t);
     } else {
         uint8_t *src1 = (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0];
         uint8_t *src2 = in->data[0];
@@ -502,8 +603,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
         src1 += deshake->cy * in->linesize[0] + deshake->cx;
         src2 += deshake->cy * in->linesize[0] + deshake->cx;
 
-        find_motion(deshake, src1, src2, deshake->cw, deshake->ch, in->linesize[0], &t);
+        ret = find_motion(link->dst, src1, src2, deshake->cw, deshake->ch, in->linesize[0], &t);
     }
+    if (ret < 0)
+        goto fail;
 
 
     // Copy transform so we can output it later to compare to the smoothed value
@@ -599,4 +702,5 @@ const AVFilter ff_vf_deshake = {
     FILTER_OUTPUTS(ff_video_default_filterpad),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .priv_class    = &deshake_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -57,6 +57,7 @@ struct range_box {
 struct hist_node {
     struct color_ref *entries;
     int nb_entries;
+    unsigned int entries_size;
 };
 
 enum {
@@ -74,9 +75,13 @@ typedef struct PaletteGenContext {
     int max_colors;
     int reserve_transparent;
     int stats_mode;
+    int sample_stride;
 
     AVFrame *prev_frame;                    // previous frame used for the diff stats_mode
     struct hist_node histogram[HIST_SIZE];  // histogram/hashtable of the colors
+    struct hist_node *job_histograms;       // per job histograms, merged into histogram after each frame
+    int nb_jobs;
+    int *job_ret;                           // per job return codes
     struct color_ref **refs;                // references of all the colors used in the stream
     int nb_refs;                            // number of color references (or number of different colors)
     struct range_box boxes[256];            // define the segmentation of the colorspace (the final palette)
@@ -95,6 +100,7 @@ static const AVOption palettegen_options[] = {
         { "full", "compute full frame histograms", 0, AV_OPT_TYPE_CONST, {.i64=STATS_MODE_ALL_FRAMES}, INT_MIN, INT_MAX, FLAGS, .unit = "mode" },
         { "diff", "compute histograms only for the part that differs from previous frame", 0, AV_OPT_TYPE_CONST, {.i64=STATS_MODE_DIFF_FRAMES}, INT_MIN, INT_MAX, FLAGS, .unit = "mode" },
         { "single", "compute new histogram for each frame", 0, AV_OPT_TYPE_CONST, {.i64=STATS_MODE_SINGLE_FRAMES}, INT_MIN, INT_MAX, FLAGS, .unit = "mode" },
+    { "sample_stride", "only account every Nth pixel of every Nth line", OFFSET(sample_stride), AV_OPT_TYPE_INT, {.i64=1}, 1, 64, FLAGS },
     { NULL }
 };
 
@@ -391,6 +397,23 @@ static AVFrame *get_palette_frame(AVFilterContext *ctx)
     return out;
 }
 
+/**
+ * Append a new entry to the hash table bucket.
+ */
+static struct color_ref *node_add_entry(struct hist_node *node)
+{
+    struct color_ref *entries;
+
+    if (node->nb_entries >= INT_MAX / sizeof(*entries))
+        return NULL;
+    entries = av_fast_realloc(node->entries, &node->entries_size,
+                              (node->nb_entries + 1) * sizeof(*entries));
+    if (!entries)
+        return NULL;
+    node->entries = entries;
+    return &entries[node->nb_entries++];
+}
+
 /**
  * Locate the color in the hash table and increment its counter.
  */
@@ -408,8 +431,7 @@ static int color_inc(struct hist_node *hist, uint32_t color)
         }
     }
 
-    e = av_dynarray2_add((void**)&node->entries, &node->nb_entries,
-                         sizeof(*node->entries), NULL);
+    e = node_add_entry(node);
     if (!e)
         return AVERROR(ENOMEM);
     e->color = color;
@@ -422,15 +444,16 @@ static int color_inc(struct hist_node *hist, uint32_t color)
  * Update histogram when pixels differ from previous frame.
  */
 static int update_histogram_diff(struct hist_node *hist,
-                                 const AVFrame *f1, const AVFrame *f2)
+                                 const AVFrame *f1, const AVFrame *f2,
+                                 int y_start, int y_end, int stride)
 {
     int x, y, ret, nb_diff_colors = 0;
 
-    for (y = 0; y < f1->height; y++) {
+    for (y = y_start; y < y_end; y += stride) {
         const uint32_t *p = (const uint32_t *)(f1->data[0] + y*f1->linesize[0]);
         const uint32_t *q = (const uint32_t *)(f2->data[0] + y*f2->linesize[0]);
 
-        for (x = 0; x < f1->width; x++) {
+        for (x = 0; x < f1->width; x += stride) {
             if (p[x] == q[x])
                 continue;
             ret = color_inc(hist, p[x]);
@@ -445,14 +468,15 @@ static int update_histogram_diff(struct hist_node *hist,
 /**
  * Simple histogram of the frame.
  */
-static int update_histogram_frame(struct hist_node *hist, const AVFrame *f)
+static int update_histogram_frame(struct hist_node *hist, const AVFrame *f,
+                                  int y_start, int y_end, int stride)
 {
     int x, y, ret, nb_diff_colors = 0;
 
-    for (y = 0; y < f->height; y++) {
+    for (y = y_start; y < y_end; y += stride) {
         const uint32_t *p = (const uint32_t *)(f->data[0] + y*f->linesize[0]);
 
-        for (x = 0; x < f->width; x++) {
+        for (x = 0; x < f->width; x += stride) {
             ret = color_inc(hist, p[x]);
             if (ret < 0)
                 return ret;
@@ -462,6 +486,98 @@ static int update_histogram_frame(struct hist_node *hist, const AVFrame *f)
     return nb_diff_colors;
 }
 
+typedef struct ThreadData {
+    const AVFrame *in, *prev;
+} ThreadData;
+
+/**
+ * Build the histogram of a slice of sampled lines into the job histogram.
+ */
+static int update_histogram_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    PaletteGenContext *s = ctx->priv;
+    const ThreadData *td = arg;
+    const AVFrame *in = td->in;
+    struct hist_node *hist = &s->job_histograms[jobnr * HIST_SIZE];
+    const int stride = s->sample_stride;
+    const int nb_lines = (in->height + stride - 1) / stride;
+    const int y_start = stride * ((nb_lines *  jobnr     ) / nb_jobs);
+    const int y_end   = FFMIN(stride * ((nb_lines * (jobnr + 1)) / nb_jobs), in->height);
+
+    return td->prev ? update_histogram_diff(hist, td->prev, in, y_start, y_end, stride)
+                    : update_histogram_frame(hist, in, y_start, y_end, stride);
+}
+
+/**
+ * Move the job histogram entries into the main histogram. The jobs cover
+ * consecutive slices and are merged in order, so the colors end up in the
+ * same order as if the frame was processed by a single job.
+ */
+static int merge_histogram(struct hist_node *dst, struct hist_node *src)
+{
+    int nb_diff_colors = 0;
+
+    for (int j = 0; j < HIST_SIZE; j++) {
+        struct hist_node *node = &dst[j];
+        const struct hist_node *job_node = &src[j];
+
+        for (int k = 0; k < job_node->nb_entries; k++) {
+            const struct color_ref *ref = &job_node->entries[k];
+            struct color_ref *e = NULL;
+
+            for (int i = 0; i < node->nb_entries; i++) {
+                if (node->entries[i].color == ref->color) {
+                    e = &node->entries[i];
+                    break;
+                }
+            }
+            if (e) {
+                e->count += ref->count;
+                continue;
+            }
+
+            e = node_add_entry(node);
+            if (!e)
+                return AVERROR(ENOMEM);
+            *e = *ref;
+            nb_diff_colors++;
+        }
+        src[j].nb_entries = 0;
+    }
+    return nb_diff_colors;
+}
+
+static int update_histogram(AVFilterContext *ctx, const AVFrame *in)
+{
+    PaletteGenContext *s = ctx->priv;
+    const int stride = s->sample_stride;
+    const int nb_jobs = FFMIN(s->nb_jobs, (in->height + stride - 1) / stride);
+    ThreadData td = { .in = in, .prev = s->prev_frame };
+    int ret, nb_diff_colors = 0;
+
+    if (nb_jobs <= 1)
+        return s->prev_frame ? update_histogram_diff(s->histogram, s->prev_frame, in, 0, in->height, stride)
+                             : update_histogram_frame(s->histogram, in, 0, in->height, stride);
+
+    ret = ff_filter_execute(ctx, update_histogram_slice, &td, s->job_ret, nb_jobs);
+    for (int i = 0; i < nb_jobs; i++) {
+        if (!ret && s->job_ret[i] < 0)
+            ret = s->job_ret[i];
+        if (!ret) {
+            const int nb = merge_histogram(s->histogram, &s->job_histograms[i * HIST_SIZE]);
+            if (nb < 0)
+                ret = nb;
+            else
+                nb_diff_colors += nb;
+        } else {
+            /* drop the partial job histogram so the next frame starts clean */
+            for (int j = 0; j < HIST_SIZE; j++)
+                s->job_histograms[i * HIST_SIZE + j].nb_entries = 0;
+        }
+    }
+    return ret < 0 ? ret : nb_diff_colors;
+}
+
 /**
  * Update the histogram for each passing frame. No frame will be pushed here.
  */
@@ -474,8 +590,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
     if (in->color_trc != AVCOL_TRC_UNSPECIFIED && in->color_trc != AVCOL_TRC_IEC61966_2_1)
         av_log(ctx, AV_LOG_WARNING, "The input frame is not in sRGB, colors may be off\n");
 
-    ret = s->prev_frame ? update_histogram_diff(s->histogram, s->prev_frame, in)
-                        : update_histogram_frame(s->histogram, in);
+    ret = update_histogram(ctx, in);
     if (ret > 0)
         s->nb_refs += ret;
 
@@ -523,6 +638,31 @@ static int request_frame(AVFilterLink *outlink)
     return r;
 }
 
+static int config_input(AVFilterLink *inlink)
+{
+    AVFilterContext *ctx = inlink->dst;
+    PaletteGenContext *s = ctx->priv;
+    const int nb_jobs = FFMIN(ff_filter_get_nb_threads(ctx), inlink->h);
+    struct hist_node *hist;
+    int *job_ret;
+
+    if (nb_jobs <= s->nb_jobs)
+        return 0;
+
+    hist = av_realloc_array(s->job_histograms, nb_jobs * HIST_SIZE, sizeof(*hist));
+    if (!hist)
+        return AVERROR(ENOMEM);
+    s->job_histograms = hist;
+    job_ret = av_realloc_array(s->job_ret, nb_jobs, sizeof(*job_ret));
+    if (!job_ret)
+        return AVERROR(ENOMEM);
+    s->job_ret = job_ret;
+    memset(&s->job_histograms[s->nb_jobs * HIST_SIZE], 0,
+           (nb_jobs - s->nb_jobs) * HIST_SIZE * sizeof(*s->job_histograms));
+    s->nb_jobs = nb_jobs;
+    return 0;
+}
+
 /**
  * The output is one simple 16x16 squared-pixels palette.
  */
@@ -552,6 +692,10 @@ static av_cold void uninit(AVFilterContext *ctx)
 
     for (i = 0; i < HIST_SIZE; i++)
         av_freep(&s->histogram[i].entries);
+    for (i = 0; i < s->nb_jobs * HIST_SIZE; i++)
+        av_freep(&s->job_histograms[i].entries);
+    av_freep(&s->job_histograms);
+    av_freep(&s->job_ret);
     av_freep(&s->refs);
     av_frame_free(&s->prev_frame);
 }
@@ -560,6 +704,7 @@ static const AVFilterPad palettegen_inputs[] = {
     {
         .name         = "default",
         .type         = AVMEDIA_TYPE_VIDEO,
+        .config_props = config_input,
         .filter_frame = filter_frame,
     },
 };
@@ -583,4 +728,5 @@ const AVFilter ff_vf_palettegen = {
     FILTER_OUTPUTS(palettegen_outputs),
     FILTER_QUERY_FUNC2(query_formats),
     .priv_class    = &palettegen_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
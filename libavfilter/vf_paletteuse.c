@@ -83,12 +83,18 @@ struct cache_node {
 struct PaletteUseContext;
 
 typedef int (*set_frame_func)(struct PaletteUseContext *s, AVFrame *out, AVFrame *in,
-                              int x_start, int y_start, int width, int height);
+                              int x_start, int y_start, int width, int height,
+                              int jobnr, int nb_jobs);
+
+/* error diffusion rows are processed in chunks of this many pixels */
+#define WAVEFRONT_CHUNK 64
 
 typedef struct PaletteUseContext {
     const AVClass *class;
     FFFrameSync fs;
-    struct cache_node cache[CACHE_SIZE];    /* lookup cache */
+    struct cache_node *cache;               /* lookup cache, CACHE_SIZE entries per job */
+    int nb_caches;
+    int *rets;                              /* return value of each job */
     struct color_node map[AVPALETTE_COUNT]; /* 3D-Tree (KD-Tree with K=3) for reverse colormap */
     uint32_t palette[AVPALETTE_COUNT];
     int transparency_index; /* index in the palette of transparency. -1 if there is no transparency in the palette. */
@@ -103,6 +109,9 @@ typedef struct PaletteUseContext {
     AVFrame *last_in;
     AVFrame *last_out;
 
+    /* error diffusion wavefront */
+    FFWavefront *wf;                        /* pixels done in each row */
+
     /* debug options */
     char *dot_filename;
     int calc_mean_err;
@@ -239,11 +248,12 @@ struct stack_node {
  * Check if the requested color is in the cache already. If not, find it in the
  * color tree and cache it.
  */
-static av_always_inline int color_get(PaletteUseContext *s, uint32_t color)
+static av_always_inline int color_get(PaletteUseContext *s, struct cache_node *cache,
+                                      uint32_t color)
 {
     struct color_info clrinfo;
     const uint32_t hash = ff_lowbias32(color) & (CACHE_SIZE - 1);
-    struct cache_node *node = &s->cache[hash];
+    struct cache_node *node = &cache[hash];
     struct cached_color *e;
 
     // first, check for transparency
@@ -268,11 +278,11 @@ static av_always_inline int color_get(PaletteUseContext *s, uint32_t color)
     return e->pal_entry;
 }
 
-static av_always_inline int get_dst_color_err(PaletteUseContext *s,
+static av_always_inline int get_dst_color_err(PaletteUseContext *s, struct cache_node *cache,
                                               uint32_t c, int *er, int *eg, int *eb)
 {
     uint32_t dstc;
-    const int dstx = color_get(s, c);
+    const int dstx = color_get(s, cache, c);
     if (dstx < 0)
         return dstx;
     dstc = s->palette[dstx];
@@ -289,170 +299,219 @@ static av_always_inline int get_dst_color_err(PaletteUseContext *s,
     return dstx;
 }
 
-static av_always_inline int set_frame(PaletteUseContext *s, AVFrame *out, AVFrame *in,
-                                      int x_start, int y_start, int w, int h,
-                                      enum dithering_mode dither)
+/**
+ * Map the pixels x0..x1-1 of row y. The error diffusion is bounded by the
+ * processing window, which spans columns x_start..w-1 and ends before row h.
+ */
+static av_always_inline int set_row(PaletteUseContext *s, struct cache_node *cache,
+                                    uint32_t *src, int src_linesize, uint8_t *dst,
+                                    int x_start, int x0, int x1, int w, int y, int h,
+                                    enum dithering_mode dither)
 {
-    const int src_linesize = in ->linesize[0] >> 2;
-    const int dst_linesize = out->linesize[0];
-    uint32_t *src = ((uint32_t *)in ->data[0]) + y_start*src_linesize;
-    uint8_t  *dst =              out->data[0]  + y_start*dst_linesize;
-
-    w += x_start;
-    h += y_start;
+    for (int x = x0; x < x1; x++) {
+        int er, eg, eb;
+
+        if (dither == DITHERING_BAYER) {
+            const int d = s->ordered_dither[(y & 7)<<3 | (x & 7)];
+            const uint8_t a8 = src[x] >> 24;
+            const uint8_t r8 = src[x] >> 16 & 0xff;
+            const uint8_t g8 = src[x] >>  8 & 0xff;
+            const uint8_t b8 = src[x]       & 0xff;
+            const uint8_t r = av_clip_uint8(r8 + d);
+            const uint8_t g = av_clip_uint8(g8 + d);
+            const uint8_t b = av_clip_uint8(b8 + d);
+            const uint32_t color_new = (unsigned)(a8) << 24 | r << 16 | g << 8 | b;
+            const int color = color_get(s, cache, color_new);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+        } else if (dither == DITHERING_HECKBERT) {
+            const int right = x < w - 1, down = y < h - 1;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+            if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 3, 3);
+            if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 3, 3);
+            if (right && down) src[src_linesize + x + 1] = dither_color(src[src_linesize + x + 1], er, eg, eb, 2, 3);
+
+        } else if (dither == DITHERING_FLOYD_STEINBERG) {
+            const int right = x < w - 1, down = y < h - 1, left = x > x_start;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+            if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 7, 4);
+            if (left  && down) src[src_linesize + x - 1] = dither_color(src[src_linesize + x - 1], er, eg, eb, 3, 4);
+            if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 5, 4);
+            if (right && down) src[src_linesize + x + 1] = dither_color(src[src_linesize + x + 1], er, eg, eb, 1, 4);
+
+        } else if (dither == DITHERING_SIERRA2) {
+            const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
+            const int right2 = x < w - 2,                    left2 = x > x_start + 1;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+            if (right)          src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 4, 4);
+            if (right2)         src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 3, 4);
+
+            if (down) {
+                if (left2)      src[  src_linesize + x - 2] = dither_color(src[  src_linesize + x - 2], er, eg, eb, 1, 4);
+                if (left)       src[  src_linesize + x - 1] = dither_color(src[  src_linesize + x - 1], er, eg, eb, 2, 4);
+                if (1)          src[  src_linesize + x    ] = dither_color(src[  src_linesize + x    ], er, eg, eb, 3, 4);
+                if (right)      src[  src_linesize + x + 1] = dither_color(src[  src_linesize + x + 1], er, eg, eb, 2, 4);
+                if (right2)     src[  src_linesize + x + 2] = dither_color(src[  src_linesize + x + 2], er, eg, eb, 1, 4);
+            }
 
-    for (int y = y_start; y < h; y++) {
-        for (int x = x_start; x < w; x++) {
-            int er, eg, eb;
-
-            if (dither == DITHERING_BAYER) {
-                const int d = s->ordered_dither[(y & 7)<<3 | (x & 7)];
-                const uint8_t a8 = src[x] >> 24;
-                const uint8_t r8 = src[x] >> 16 & 0xff;
-                const uint8_t g8 = src[x] >>  8 & 0xff;
-                const uint8_t b8 = src[x]       & 0xff;
-                const uint8_t r = av_clip_uint8(r8 + d);
-                const uint8_t g = av_clip_uint8(g8 + d);
-                const uint8_t b = av_clip_uint8(b8 + d);
-                const uint32_t color_new = (unsigned)(a8) << 24 | r << 16 | g << 8 | b;
-                const int color = color_get(s, color_new);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-            } else if (dither == DITHERING_HECKBERT) {
-                const int right = x < w - 1, down = y < h - 1;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-                if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 3, 3);
-                if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 3, 3);
-                if (right && down) src[src_linesize + x + 1] = dither_color(src[src_linesize + x + 1], er, eg, eb, 2, 3);
-
-            } else if (dither == DITHERING_FLOYD_STEINBERG) {
-                const int right = x < w - 1, down = y < h - 1, left = x > x_start;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-                if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 7, 4);
-                if (left  && down) src[src_linesize + x - 1] = dither_color(src[src_linesize + x - 1], er, eg, eb, 3, 4);
-                if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 5, 4);
-                if (right && down) src[src_linesize + x + 1] = dither_color(src[src_linesize + x + 1], er, eg, eb, 1, 4);
-
-            } else if (dither == DITHERING_SIERRA2) {
-                const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
-                const int right2 = x < w - 2,                    left2 = x > x_start + 1;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-                if (right)          src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 4, 4);
-                if (right2)         src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 3, 4);
-
-                if (down) {
-                    if (left2)      src[  src_linesize + x - 2] = dither_color(src[  src_linesize + x - 2], er, eg, eb, 1, 4);
-                    if (left)       src[  src_linesize + x - 1] = dither_color(src[  src_linesize + x - 1], er, eg, eb, 2, 4);
-                    if (1)          src[  src_linesize + x    ] = dither_color(src[  src_linesize + x    ], er, eg, eb, 3, 4);
-                    if (right)      src[  src_linesize + x + 1] = dither_color(src[  src_linesize + x + 1], er, eg, eb, 2, 4);
-                    if (right2)     src[  src_linesize + x + 2] = dither_color(src[  src_linesize + x + 2], er, eg, eb, 1, 4);
+        } else if (dither == DITHERING_SIERRA2_4A) {
+            const int right = x < w - 1, down = y < h - 1, left = x > x_start;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+            if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 2, 2);
+            if (left  && down) src[src_linesize + x - 1] = dither_color(src[src_linesize + x - 1], er, eg, eb, 1, 2);
+            if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 1, 2);
+
+        } else if (dither == DITHERING_SIERRA3) {
+            const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
+            const int right2 = x < w - 2, down2 = y < h - 2, left2 = x > x_start + 1;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+
+            if (right)         src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 5, 5);
+            if (right2)        src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 3, 5);
+
+            if (down) {
+                if (left2)     src[src_linesize   + x - 2] = dither_color(src[src_linesize   + x - 2], er, eg, eb, 2, 5);
+                if (left)      src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 4, 5);
+                if (1)         src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 5, 5);
+                if (right)     src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 4, 5);
+                if (right2)    src[src_linesize   + x + 2] = dither_color(src[src_linesize   + x + 2], er, eg, eb, 2, 5);
+
+                if (down2) {
+                    if (left)  src[src_linesize*2 + x - 1] = dither_color(src[src_linesize*2 + x - 1], er, eg, eb, 2, 5);
+                    if (1)     src[src_linesize*2 + x    ] = dither_color(src[src_linesize*2 + x    ], er, eg, eb, 3, 5);
+                    if (right) src[src_linesize*2 + x + 1] = dither_color(src[src_linesize*2 + x + 1], er, eg, eb, 2, 5);
                 }
+            }
 
-            } else if (dither == DITHERING_SIERRA2_4A) {
-                const int right = x < w - 1, down = y < h - 1, left = x > x_start;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-                if (right)         src[               x + 1] = dither_color(src[               x + 1], er, eg, eb, 2, 2);
-                if (left  && down) src[src_linesize + x - 1] = dither_color(src[src_linesize + x - 1], er, eg, eb, 1, 2);
-                if (         down) src[src_linesize + x    ] = dither_color(src[src_linesize + x    ], er, eg, eb, 1, 2);
-
-            } else if (dither == DITHERING_SIERRA3) {
-                const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
-                const int right2 = x < w - 2, down2 = y < h - 2, left2 = x > x_start + 1;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
-
-                if (color < 0)
-                    return color;
-                dst[x] = color;
-
-                if (right)         src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 5, 5);
-                if (right2)        src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 3, 5);
-
-                if (down) {
-                    if (left2)     src[src_linesize   + x - 2] = dither_color(src[src_linesize   + x - 2], er, eg, eb, 2, 5);
-                    if (left)      src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 4, 5);
-                    if (1)         src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 5, 5);
-                    if (right)     src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 4, 5);
-                    if (right2)    src[src_linesize   + x + 2] = dither_color(src[src_linesize   + x + 2], er, eg, eb, 2, 5);
-
-                    if (down2) {
-                        if (left)  src[src_linesize*2 + x - 1] = dither_color(src[src_linesize*2 + x - 1], er, eg, eb, 2, 5);
-                        if (1)     src[src_linesize*2 + x    ] = dither_color(src[src_linesize*2 + x    ], er, eg, eb, 3, 5);
-                        if (right) src[src_linesize*2 + x + 1] = dither_color(src[src_linesize*2 + x + 1], er, eg, eb, 2, 5);
-                    }
-                }
+        } else if (dither == DITHERING_BURKES) {
+            const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
+            const int right2 = x < w - 2,                    left2 = x > x_start + 1;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
 
-            } else if (dither == DITHERING_BURKES) {
-                const int right  = x < w - 1, down  = y < h - 1, left  = x > x_start;
-                const int right2 = x < w - 2,                    left2 = x > x_start + 1;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
+            if (color < 0)
+                return color;
+            dst[x] = color;
 
-                if (color < 0)
-                    return color;
-                dst[x] = color;
+            if (right)      src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 8, 5);
+            if (right2)     src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 4, 5);
 
-                if (right)      src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 8, 5);
-                if (right2)     src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 4, 5);
+            if (down) {
+                if (left2)  src[src_linesize   + x - 2] = dither_color(src[src_linesize   + x - 2], er, eg, eb, 2, 5);
+                if (left)   src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 4, 5);
+                if (1)      src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 8, 5);
+                if (right)  src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 4, 5);
+                if (right2) src[src_linesize   + x + 2] = dither_color(src[src_linesize   + x + 2], er, eg, eb, 2, 5);
+            }
 
-                if (down) {
-                    if (left2)  src[src_linesize   + x - 2] = dither_color(src[src_linesize   + x - 2], er, eg, eb, 2, 5);
-                    if (left)   src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 4, 5);
-                    if (1)      src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 8, 5);
-                    if (right)  src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 4, 5);
-                    if (right2) src[src_linesize   + x + 2] = dither_color(src[src_linesize   + x + 2], er, eg, eb, 2, 5);
-                }
+        } else if (dither == DITHERING_ATKINSON) {
+            const int right  = x < w - 1, down  = y < h - 1, left = x > x_start;
+            const int right2 = x < w - 2, down2 = y < h - 2;
+            const int color = get_dst_color_err(s, cache, src[x], &er, &eg, &eb);
 
-            } else if (dither == DITHERING_ATKINSON) {
-                const int right  = x < w - 1, down  = y < h - 1, left = x > x_start;
-                const int right2 = x < w - 2, down2 = y < h - 2;
-                const int color = get_dst_color_err(s, src[x], &er, &eg, &eb);
+            if (color < 0)
+                return color;
+            dst[x] = color;
 
-                if (color < 0)
-                    return color;
-                dst[x] = color;
+            if (right)     src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 1, 3);
+            if (right2)    src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 1, 3);
 
-                if (right)     src[                 x + 1] = dither_color(src[                 x + 1], er, eg, eb, 1, 3);
-                if (right2)    src[                 x + 2] = dither_color(src[                 x + 2], er, eg, eb, 1, 3);
+            if (down) {
+                if (left)  src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 1, 3);
+                if (1)     src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 1, 3);
+                if (right) src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 1, 3);
+                if (down2) src[src_linesize*2 + x    ] = dither_color(src[src_linesize*2 + x    ], er, eg, eb, 1, 3);
+            }
 
-                if (down) {
-                    if (left)  src[src_linesize   + x - 1] = dither_color(src[src_linesize   + x - 1], er, eg, eb, 1, 3);
-                    if (1)     src[src_linesize   + x    ] = dither_color(src[src_linesize   + x    ], er, eg, eb, 1, 3);
-                    if (right) src[src_linesize   + x + 1] = dither_color(src[src_linesize   + x + 1], er, eg, eb, 1, 3);
-                    if (down2) src[src_linesize*2 + x    ] = dither_color(src[src_linesize*2 + x    ], er, eg, eb, 1, 3);
-                }
+        } else {
+            const int color = color_get(s, cache, src[x]);
+
+            if (color < 0)
+                return color;
+            dst[x] = color;
+        }
+    }
+    return 0;
+}
+
+static av_always_inline int set_frame(PaletteUseContext *s, AVFrame *out, AVFrame *in,
+                                      int x_start, int y_start, int w, int h,
+                                      int jobnr, int nb_jobs,
+                                      enum dithering_mode dither)
+{
+    struct cache_node *cache = s->cache + jobnr * CACHE_SIZE;
+    const int src_linesize = in ->linesize[0] >> 2;
+    const int dst_linesize = out->linesize[0];
+    uint32_t *src = (uint32_t *)in->data[0];
+    uint8_t  *dst = out->data[0];
+    int ret;
+
+    w += x_start;
+    h += y_start;
 
-            } else {
-                const int color = color_get(s, src[x]);
+    if (dither == DITHERING_NONE || dither == DITHERING_BAYER) {
+        const int slice_start = y_start + (h - y_start) *  jobnr      / nb_jobs;
+        const int slice_end   = y_start + (h - y_start) * (jobnr + 1) / nb_jobs;
 
-                if (color < 0)
-                    return color;
-                dst[x] = color;
+        for (int y = slice_start; y < slice_end; y++) {
+            ret = set_row(s, cache, src + y*src_linesize, src_linesize, dst + y*dst_linesize,
+                          x_start, x_start, w, w, y, h, dither);
+            if (ret < 0)
+                return ret;
+        }
+        return 0;
+    }
+
+    /*
+     * Error diffusion: rows are dealt to the jobs in turn, and a pixel is
+     * only mapped once the row above is done up to 4 pixels to its right.
+     * All the errors it receives are then final, and the ones it spreads
+     * below land in the same order as in a serial pass, so the output does
+     * not depend on the number of jobs.
+     */
+    for (int y = y_start + jobnr; y < h; y += nb_jobs) {
+        for (int x = x_start; x < w; x += WAVEFRONT_CHUNK) {
+            const int x1 = FFMIN(x + WAVEFRONT_CHUNK, w);
+
+            if (nb_jobs > 1 && y > y_start)
+                ff_wavefront_wait(s->wf, y - 1, FFMIN(x1 + 4, w));
+            ret = set_row(s, cache, src + y*src_linesize, src_linesize, dst + y*dst_linesize,
+                          x_start, x, x1, w, y, h, dither);
+            if (ret < 0) {
+                /* do not leave the following rows waiting */
+                for (; nb_jobs > 1 && y < h; y += nb_jobs)
+                    ff_wavefront_report(s->wf, y, w);
+                return ret;
             }
+            if (nb_jobs > 1)
+                ff_wavefront_report(s->wf, y, x1);
         }
-        src += src_linesize;
-        dst += dst_linesize;
     }
     return 0;
 }
@@ -767,9 +826,23 @@ static void set_processing_window(enum diff_mode diff_mode,
     *hp = height;
 }
 
+typedef struct ThreadData {
+    AVFrame *in, *out;
+    int x, y, w, h;
+} ThreadData;
+
+static int set_frame_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    PaletteUseContext *s = ctx->priv;
+    const ThreadData *td = arg;
+
+    return s->set_frame(s, td->out, td->in, td->x, td->y, td->w, td->h, jobnr, nb_jobs);
+}
+
 static int apply_palette(AVFilterLink *inlink, AVFrame *in, AVFrame **outf)
 {
-    int x, y, w, h, ret;
+    int x, y, w, h, nb_jobs, ret = 0;
+    ThreadData td;
     AVFilterContext *ctx = inlink->dst;
     PaletteUseContext *s = ctx->priv;
     AVFilterLink *outlink = inlink->dst->outputs[0];
@@ -795,7 +868,20 @@ static int apply_palette(AVFilterLink *inlink, AVFrame *in, AVFrame **outf)
     ff_dlog(ctx, "%dx%d rect: (%d;%d) -> (%d,%d) [area:%dx%d]\n",
             w, h, x, y, x+w, y+h, in->width, in->height);
 
-    ret = s->set_frame(s, out, in, x, y, w, h);
+    nb_jobs = FFMIN(h, s->nb_caches);
+
+    td.in  = in;
+    td.out = out;
+    td.x   = x;
+    td.y   = y;
+    td.w   = w;
+    td.h   = h;
+    if (s->dither >= DITHERING_HECKBERT)
+        nb_jobs = ff_filter_execute_wavefront(ctx, set_frame_slice, &td, s->wf, s->rets, nb_jobs);
+    else
+        ff_filter_execute(ctx, set_frame_slice, &td, s->rets, nb_jobs);
+    for (int i = 0; i < nb_jobs && ret >= 0; i++)
+        ret = s->rets[i];
     if (ret < 0) {
         av_frame_free(&out);
         *outf = NULL;
@@ -806,12 +892,31 @@ static int apply_palette(AVFilterLink *inlink, AVFrame *in, AVFrame **outf)
     return 0;
 }
 
+static void free_jobs(PaletteUseContext *s)
+{
+    for (int i = 0; i < s->nb_caches * CACHE_SIZE && s->cache; i++)
+        av_freep(&s->cache[i].entries);
+    av_freep(&s->cache);
+    av_freep(&s->rets);
+    ff_wavefront_free(&s->wf);
+}
+
 static int config_output(AVFilterLink *outlink)
 {
     int ret;
     AVFilterContext *ctx = outlink->src;
     PaletteUseContext *s = ctx->priv;
 
+    free_jobs(s);
+    s->nb_caches = ff_filter_get_nb_threads(ctx);
+    s->cache = av_calloc(s->nb_caches, CACHE_SIZE * sizeof(*s->cache));
+    s->rets  = av_calloc(s->nb_caches, sizeof(*s->rets));
+    if (!s->cache || !s->rets)
+        return AVERROR(ENOMEM);
+    ret = ff_wavefront_alloc(&s->wf, ctx->inputs[0]->h, s->nb_caches);
+    if (ret < 0)
+        return ret;
+
     ret = ff_framesync_init_dualinput(&s->fs, ctx);
     if (ret < 0)
         return ret;
@@ -854,9 +959,9 @@ static void load_palette(PaletteUseContext *s, const AVFrame *palette_frame)
     if (s->new) {
         memset(s->palette, 0, sizeof(s->palette));
         memset(s->map, 0, sizeof(s->map));
-        for (i = 0; i < CACHE_SIZE; i++)
+        for (i = 0; i < s->nb_caches * CACHE_SIZE; i++)
             av_freep(&s->cache[i].entries);
-        memset(s->cache, 0, sizeof(s->cache));
+        memset(s->cache, 0, s->nb_caches * CACHE_SIZE * sizeof(*s->cache));
     }
 
     i = 0;
@@ -905,9 +1010,10 @@ static int load_apply_palette(FFFrameSync *fs)
 
 #define DEFINE_SET_FRAME(name, value)                                           \
 static int set_frame_##name(PaletteUseContext *s, AVFrame *out, AVFrame *in,    \
-                            int x_start, int y_start, int w, int h)             \
+                            int x_start, int y_start, int w, int h,             \
+                            int jobnr, int nb_jobs)                             \
 {                                                                               \
-    return set_frame(s, out, in, x_start, y_start, w, h, value);                \
+    return set_frame(s, out, in, x_start, y_start, w, h, jobnr, nb_jobs, value);\
 }
 
 DEFINE_SET_FRAME(none,            DITHERING_NONE)
@@ -972,8 +1078,7 @@ static av_cold void uninit(AVFilterContext *ctx)
     PaletteUseContext *s = ctx->priv;
 
     ff_framesync_uninit(&s->fs);
-    for (int i = 0; i < CACHE_SIZE; i++)
-        av_freep(&s->cache[i].entries);
+    free_jobs(s);
     av_frame_free(&s->last_in);
     av_frame_free(&s->last_out);
 }
@@ -1008,4 +1113,5 @@ const AVFilter ff_vf_paletteuse = {
     FILTER_OUTPUTS(paletteuse_outputs),
     FILTER_QUERY_FUNC2(query_formats),
     .priv_class    = &paletteuse_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
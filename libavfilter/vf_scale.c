@@ -769,6 +769,9 @@ static int config_props(AVFilterLink *outlink)
             av_opt_set_int(s, "dst_h_chr_pos", h_chr_pos, 0);
             av_opt_set_int(s, "dst_v_chr_pos", v_chr_pos, 0);
 
+            if ((ret = sws_set_thread_pool(s, ctx->graph->thread_pool)) < 0)
+                return ret;
+
             if ((ret = sws_init_context(s, NULL, NULL)) < 0)
                 return ret;
 
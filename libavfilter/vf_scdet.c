@@ -21,29 +21,23 @@
  * video scene change detection filter
  */
 
-#include "libavutil/imgutils.h"
 #include "libavutil/opt.h"
-#include "libavutil/pixdesc.h"
 #include "libavutil/timestamp.h"
 
 #include "avfilter.h"
 #include "filters.h"
-#include "scene_sad.h"
+#include "scene_detect.h"
 #include "video.h"
 
 typedef struct SCDetContext {
     const AVClass *class;
 
-    ptrdiff_t width[4];
-    ptrdiff_t height[4];
-    int nb_planes;
-    int bitdepth;
-    ff_scene_sad_fn sad;
+    SceneDetectContext sd;
     double prev_mafd;
     double scene_score;
-    AVFrame *prev_picref;
     double threshold;
     int sc_pass;
+    int export_sad;
 } SCDetContext;
 
 #define OFFSET(x) offsetof(SCDetContext, x)
@@ -55,6 +49,8 @@ static const AVOption scdet_options[] = {
     { "t",           "set scene change detect threshold",        OFFSET(threshold),  AV_OPT_TYPE_DOUBLE,   {.dbl = 10.},     0,  100., V|F },
     { "sc_pass",     "Set the flag to pass scene change frames", OFFSET(sc_pass),    AV_OPT_TYPE_BOOL,     {.i64 = 0  },     0,    1,  V|F },
     { "s",           "Set the flag to pass scene change frames", OFFSET(sc_pass),    AV_OPT_TYPE_BOOL,     {.i64 = 0  },     0,    1,  V|F },
+    { "step",        "set the pixel and row step of the comparison", OFFSET(sd.step), AV_OPT_TYPE_INT,   {.i64 = 1  },     1,   16,  V|F },
+    { "export_sad",  "export the frame differences as metadata", OFFSET(export_sad), AV_OPT_TYPE_BOOL,     {.i64 = 0  },     0,    1,  V|F },
     {NULL}
 };
 
@@ -77,62 +73,33 @@ static int config_input(AVFilterLink *inlink)
 {
     AVFilterContext *ctx = inlink->dst;
     SCDetContext *s = ctx->priv;
-    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
-    int is_yuv = !(desc->flags & AV_PIX_FMT_FLAG_RGB) &&
-        (desc->flags & AV_PIX_FMT_FLAG_PLANAR) &&
-        desc->nb_components >= 3;
-
-    s->bitdepth = desc->comp[0].depth;
-    s->nb_planes = is_yuv ? 1 : av_pix_fmt_count_planes(inlink->format);
-
-    for (int plane = 0; plane < 4; plane++) {
-        ptrdiff_t line_size = av_image_get_linesize(inlink->format, inlink->w, plane);
-        s->width[plane] = line_size >> (s->bitdepth > 8);
-        s->height[plane] = inlink->h >> ((plane == 1 || plane == 2) ? desc->log2_chroma_h : 0);
-    }
-
-    s->sad = ff_scene_sad_get_fn(s->bitdepth == 8 ? 8 : 16);
-    if (!s->sad)
-        return AVERROR(EINVAL);
 
-    return 0;
+    return ff_scene_detect_config(ctx, &s->sd, inlink);
 }
 
 static av_cold void uninit(AVFilterContext *ctx)
 {
     SCDetContext *s = ctx->priv;
 
-    av_frame_free(&s->prev_picref);
+    ff_scene_detect_uninit(&s->sd);
 }
 
 static double get_scene_score(AVFilterContext *ctx, AVFrame *frame)
 {
     double ret = 0;
     SCDetContext *s = ctx->priv;
-    AVFrame *prev_picref = s->prev_picref;
+    uint64_t sad, count;
 
-    if (prev_picref && frame->height == prev_picref->height
-                    && frame->width  == prev_picref->width) {
-        uint64_t sad = 0;
+    if (ff_scene_detect_sad(ctx, &s->sd, frame, &sad, &count)) {
         double mafd, diff;
-        uint64_t count = 0;
-
-        for (int plane = 0; plane < s->nb_planes; plane++) {
-            uint64_t plane_sad;
-            s->sad(prev_picref->data[plane], prev_picref->linesize[plane],
-                    frame->data[plane], frame->linesize[plane],
-                    s->width[plane], s->height[plane], &plane_sad);
-            sad += plane_sad;
-            count += s->width[plane] * s->height[plane];
-        }
 
-        mafd = (double)sad * 100. / count / (1ULL << s->bitdepth);
+        mafd = (double)sad * 100. / count / (1ULL << s->sd.bitdepth);
         diff = fabs(mafd - s->prev_mafd);
         ret  = av_clipf(FFMIN(mafd, diff), 0, 100.);
         s->prev_mafd = mafd;
-        av_frame_free(&prev_picref);
+        if (s->export_sad)
+            ff_scene_detect_export(ctx, &s->sd, frame, sad, count);
     }
-    s->prev_picref = av_frame_clone(frame);
     return ret;
 }
 
@@ -199,7 +166,7 @@ const AVFilter ff_vf_scdet = {
     .priv_size     = sizeof(SCDetContext),
     .priv_class    = &scdet_class,
     .uninit        = uninit,
-    .flags         = AVFILTER_FLAG_METADATA_ONLY,
+    .flags         = AVFILTER_FLAG_METADATA_ONLY | AVFILTER_FLAG_SLICE_THREADS,
     FILTER_INPUTS(scdet_inputs),
     FILTER_OUTPUTS(ff_video_default_filterpad),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
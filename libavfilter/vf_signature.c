@@ -24,6 +24,7 @@
  * @see http://epubs.surrey.ac.uk/531590/1/MPEG-7%20Video%20Signature%20Author%27s%20Copy.pdf
  */
 
+#include "libavcodec/get_bits.h"
 #include "libavcodec/put_bits.h"
 #include "libavformat/avformat.h"
 #include "libavutil/mem.h"
@@ -39,6 +40,11 @@
 #define FLAGS AV_OPT_FLAG_FILTERING_PARAM | AV_OPT_FLAG_VIDEO_PARAM
 #define BLOCK_LCM (int64_t) 476985600
 
+/* sizes of the parts of the binary representation in bits */
+#define BINARY_HEADER_BITS  274
+#define BINARY_SEGMENT_BITS (4*32 + 1 + 5*243)
+#define BINARY_FRAME_BITS   (1 + 32 + 8 + 5*8 + SIGELEM_SIZE/5*8)
+
 static const AVOption signature_options[] = {
     { "detectmode", "set the detectmode",
         OFFSET(mode),         AV_OPT_TYPE_INT,    {.i64 = MODE_OFF}, 0, NB_LOOKUP_MODE-1, FLAGS, .unit = "mode" },
@@ -49,6 +55,8 @@ static const AVOption signature_options[] = {
         OFFSET(nb_inputs),    AV_OPT_TYPE_INT,    {.i64 = 1},        1, INT_MAX,          FLAGS },
     { "filename",   "filename for output files",
         OFFSET(filename),     AV_OPT_TYPE_STRING, {.str = ""},       0, NB_FORMATS-1,     FLAGS },
+    { "index",      "file listing binary signatures to match the inputs against",
+        OFFSET(index_filename), AV_OPT_TYPE_STRING, {.str = NULL},   0, 0,                FLAGS },
     { "format",     "set output format",
         OFFSET(format),       AV_OPT_TYPE_INT,    {.i64 = FORMAT_BINARY}, 0, 1,           FLAGS , .unit = "format" },
         { "binary", 0, 0, AV_OPT_TYPE_CONST, {.i64=FORMAT_BINARY}, 0, 0, FLAGS, .unit = "format" },
@@ -95,6 +103,44 @@ static int config_input(AVFilterLink *inlink)
     }
     sc->w = inlink->w;
     sc->h = inlink->h;
+
+    for (int i = 0; i <= 32; i++) {
+        sc->blockx[i] = ((int64_t)inlink->w * i + 31) / 32;
+        sc->blocky[i] = ((int64_t)inlink->h * i + 31) / 32;
+    }
+    sic->nb_jobs = FFMIN(32, ff_filter_get_nb_threads(ctx));
+    return 0;
+}
+
+typedef struct ThreadData {
+    const AVFrame *in;
+    const StreamContext *sc;
+    uint64_t (*intpic)[32];
+} ThreadData;
+
+/* sums up the pixels of every block of a range of block rows */
+static int block_sum_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ThreadData *td = arg;
+    const StreamContext *sc = td->sc;
+    const int start = (32 *  jobnr     ) / nb_jobs;
+    const int end   = (32 * (jobnr + 1)) / nb_jobs;
+
+    for (int bi = start; bi < end; bi++) {
+        uint64_t *row = td->intpic[bi];
+
+        for (int i = sc->blocky[bi]; i < sc->blocky[bi + 1]; i++) {
+            const uint8_t *p = td->in->data[0] + i * (ptrdiff_t)td->in->linesize[0];
+
+            for (int bj = 0; bj < 32; bj++) {
+                unsigned int sum = 0;
+
+                for (int j = sc->blockx[bj]; j < sc->blockx[bj + 1]; j++)
+                    sum += p[j];
+                row[bj] += sum;
+            }
+        }
+    }
     return 0;
 }
 
@@ -158,9 +204,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
     uint8_t wordt2b[5] = { 0, 0, 0, 0, 0 }; /* word ternary to binary */
     uint64_t intpic[32][32];
     uint64_t rowcount;
-    uint8_t *p = picref->data[0];
-    int inti, intj;
-    int *intjlut;
+    ThreadData td;
 
     uint64_t conflist[DIFFELEM_SIZE];
     int f = 0, g = 0, w = 0;
@@ -191,22 +235,10 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
     fs->index = sc->lastindex++;
 
     memset(intpic, 0, sizeof(uint64_t)*32*32);
-    intjlut = av_malloc_array(inlink->w, sizeof(int));
-    if (!intjlut)
-        return AVERROR(ENOMEM);
-    for (i = 0; i < inlink->w; i++) {
-        intjlut[i] = (i*32)/inlink->w;
-    }
-
-    for (i = 0; i < inlink->h; i++) {
-        inti = (i*32)/inlink->h;
-        for (j = 0; j < inlink->w; j++) {
-            intj = intjlut[j];
-            intpic[inti][intj] += p[j];
-        }
-        p += picref->linesize[0];
-    }
-    av_freep(&intjlut);
+    td.in     = picref;
+    td.sc     = sc;
+    td.intpic = intpic;
+    ff_filter_execute(ctx, block_sum_slice, &td, NULL, sic->nb_jobs);
 
     /* The following calculates a summed area table (intpic) and brings the numbers
      * in intpic to the same denominator.
@@ -555,6 +587,343 @@ static int binary_export(AVFilterContext *ctx, StreamContext *sc, const char* fi
     return 0;
 }
 
+static void free_stream(StreamContext *sc)
+{
+    FineSignature* finsig = sc->finesiglist;
+    CoarseSignature* cousig = sc->coarsesiglist;
+    void* tmp;
+
+    while (finsig) {
+        tmp = finsig;
+        finsig = finsig->next;
+        av_freep(&tmp);
+    }
+    sc->finesiglist = NULL;
+
+    while (cousig) {
+        tmp = cousig;
+        cousig = cousig->next;
+        av_freep(&tmp);
+    }
+    sc->coarsesiglist = NULL;
+}
+
+/**
+ * reads a signature in the binary representation written by binary_export()
+ * @param coarse_only if set, only the coarse signatures are read, without
+ *                    the associated fine signatures
+ */
+static int binary_import(AVFilterContext *ctx, StreamContext *sc, const char* filename, int coarse_only)
+{
+    FILE* f;
+    FineSignature* fs = NULL;
+    FineSignature** fsarr = NULL;
+    CoarseSignature* cs = NULL;
+    uint32_t* csidx = NULL;
+    uint32_t numofframes, numofsegments, timeunit;
+    uint8_t header[(BINARY_HEADER_BITS + 7) / 8 + AV_INPUT_BUFFER_PADDING_SIZE] = { 0 };
+    const int header_size = (BINARY_HEADER_BITS + 7) / 8;
+    uint8_t* buffer = NULL;
+    int64_t size;
+    GetBitContext gb;
+    int i, j, ret = AVERROR_INVALIDDATA;
+
+    f = avpriv_fopen_utf8(filename, "rb");
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(ctx, AV_LOG_ERROR, "cannot open file %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    if (fread(header, 1, header_size, f) != header_size)
+        goto end;
+    init_get_bits8(&gb, header, header_size);
+
+    skip_bits_long(&gb, 32 + 1 + 32); /* NumOfSpatial Regions, SpatialLocationFlag, PixelX,1 PixelY,1 */
+    sc->w = get_bits(&gb, 16) + 1;
+    sc->h = get_bits(&gb, 16) + 1;
+    skip_bits_long(&gb, 32); /* StartFrameOfSpatialRegion */
+    numofframes = get_bits_long(&gb, 32);
+    timeunit = get_bits(&gb, 16);
+    skip_bits_long(&gb, 1 + 32 + 32); /* MediaTimeFlagOfSpatialRegion, Start/EndMediaTimeOfSpatialRegion */
+    numofsegments = get_bits_long(&gb, 32);
+    sc->time_base = (AVRational){ 1, FFMAX(timeunit, 1) };
+    sc->lastindex = numofframes;
+
+    if (!numofframes || numofsegments != (numofframes + 44) / 45)
+        goto end;
+
+    /* read only as much as needed */
+    size = BINARY_HEADER_BITS + (int64_t)numofsegments * BINARY_SEGMENT_BITS;
+    if (!coarse_only)
+        size += 1 + (int64_t)numofframes * BINARY_FRAME_BITS;
+    size = (size + 7) / 8;
+    if (size > INT_MAX / 8 - AV_INPUT_BUFFER_PADDING_SIZE)
+        goto end;
+    buffer = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!buffer) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    memcpy(buffer, header, header_size);
+    if (fread(buffer + header_size, 1, size - header_size, f) != size - header_size)
+        goto end;
+    init_get_bits8(&gb, buffer, size);
+    skip_bits_long(&gb, BINARY_HEADER_BITS);
+
+    csidx = av_malloc_array(numofsegments, 2 * sizeof(*csidx));
+    if (!coarse_only)
+        fsarr = av_malloc_array(numofframes, sizeof(*fsarr));
+    if (!csidx || (!coarse_only && !fsarr)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* coarsesignatures */
+    for (i = 0; i < numofsegments; i++) {
+        CoarseSignature* next = av_mallocz(sizeof(CoarseSignature));
+        if (!next) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if (cs)
+            cs->next = next;
+        else
+            sc->coarsesiglist = next;
+        sc->coarseend = cs = next;
+
+        csidx[2*i]   = get_bits_long(&gb, 32); /* StartFrameOfSegment */
+        csidx[2*i+1] = get_bits_long(&gb, 32); /* EndFrameOfSegment */
+        skip_bits_long(&gb, 1 + 32 + 32); /* MediaTimeFlagOfSegment, Start/EndMediaTimeOfSegment */
+        for (j = 0; j < 5; j++) {
+            for (int k = 0; k < 30; k++)
+                cs->data[j][k] = get_bits(&gb, 8);
+            cs->data[j][30] = get_bits(&gb, 3) << 5;
+        }
+        if (csidx[2*i] > csidx[2*i+1] || csidx[2*i+1] >= numofframes)
+            goto end;
+    }
+    if (coarse_only) {
+        ret = 0;
+        goto end;
+    }
+
+    /* finesignatures */
+    skip_bits1(&gb); /* CompressionFlag */
+    for (i = 0; i < numofframes; i++) {
+        FineSignature* next = av_mallocz(sizeof(FineSignature));
+        if (!next) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if (fs) {
+            fs->next = next;
+            next->prev = fs;
+        } else {
+            sc->finesiglist = next;
+        }
+        fsarr[i] = fs = next;
+
+        skip_bits1(&gb); /* MediaTimeFlagOfFrame */
+        fs->pts = get_bits_long(&gb, 32);
+        fs->index = i;
+        fs->confidence = get_bits(&gb, 8);
+        for (j = 0; j < 5; j++)
+            fs->words[j] = get_bits(&gb, 8);
+        for (j = 0; j < SIGELEM_SIZE/5; j++)
+            fs->framesig[j] = get_bits(&gb, 8);
+    }
+    sc->curfinesig = fs;
+
+    for (i = 0, cs = sc->coarsesiglist; cs; i++, cs = cs->next) {
+        cs->first = fsarr[csidx[2*i]];
+        cs->last  = fsarr[csidx[2*i+1]];
+    }
+    ret = 0;
+
+end:
+    if (ret == AVERROR_INVALIDDATA)
+        av_log(ctx, AV_LOG_ERROR, "invalid signature file %s\n", filename);
+    if (ret < 0)
+        free_stream(sc);
+    av_free(fsarr);
+    av_free(csidx);
+    av_free(buffer);
+    fclose(f);
+    return ret;
+}
+
+static void index_free(SignatureIndex *idx)
+{
+    for (int i = 0; i < idx->nb_entries; i++)
+        av_freep(&idx->entries[i].filename);
+    av_freep(&idx->entries);
+    av_freep(&idx->coarse);
+    av_freep(&idx->coarse_entry);
+    av_freep(&idx->postings);
+    av_freep(&idx->wordmask);
+    av_freep(&idx->touched);
+    av_freep(&idx->candidate);
+    idx->nb_entries = idx->nb_coarse = 0;
+}
+
+/**
+ * loads the coarse signatures of all signature files listed in filename,
+ * one path per line, and builds the inverted index over their words
+ */
+static int index_load(AVFilterContext *ctx, SignatureIndex *idx, const char* filename)
+{
+    FILE* f;
+    char line[1024];
+    unsigned int coarse_size = 0;
+    int i, w, b, ret = 0;
+
+    f = avpriv_fopen_utf8(filename, "r");
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(ctx, AV_LOG_ERROR, "cannot open index %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        StreamContext sc = { 0 };
+        SignatureIndexEntry entry = { 0 };
+        CoarseSignature* cs;
+        void* tmp;
+
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        ret = binary_import(ctx, &sc, line, 1);
+        if (ret < 0)
+            goto end;
+
+        entry.coarse_start = idx->nb_coarse;
+        for (cs = sc.coarsesiglist; cs; cs = cs->next)
+            entry.nb_coarse++;
+        if (entry.nb_coarse > INT_MAX / sizeof(*idx->coarse) - idx->nb_coarse) {
+            free_stream(&sc);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+
+        tmp = av_fast_realloc(idx->coarse, &coarse_size,
+                              (idx->nb_coarse + entry.nb_coarse) * sizeof(*idx->coarse));
+        if (!tmp) {
+            free_stream(&sc);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        idx->coarse = tmp;
+        for (cs = sc.coarsesiglist; cs; cs = cs->next) {
+            memset(&idx->coarse[idx->nb_coarse], 0, sizeof(*idx->coarse));
+            memcpy(idx->coarse[idx->nb_coarse++].data, cs->data, sizeof(cs->data));
+        }
+        free_stream(&sc);
+
+        entry.filename = av_strdup(line);
+        if (!entry.filename ||
+            av_dynarray2_add((void **)&idx->entries, &idx->nb_entries,
+                             sizeof(entry), (uint8_t *)&entry) == NULL) {
+            av_free(entry.filename);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+
+    idx->coarse_entry = av_malloc_array(idx->nb_coarse, sizeof(*idx->coarse_entry));
+    idx->wordmask     = av_calloc(idx->nb_coarse, sizeof(*idx->wordmask));
+    idx->touched      = av_malloc_array(idx->nb_coarse, sizeof(*idx->touched));
+    idx->candidate    = av_malloc(idx->nb_entries);
+    if (idx->nb_coarse && (!idx->coarse_entry || !idx->wordmask || !idx->touched || !idx->candidate)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < idx->nb_entries; i++)
+        for (int c = 0; c < idx->entries[i].nb_coarse; c++)
+            idx->coarse_entry[idx->entries[i].coarse_start + c] = i;
+
+    /* inverted index, count the postings first */
+    memset(idx->offsets, 0, sizeof(idx->offsets));
+    for (i = 0; i < idx->nb_coarse; i++)
+        for (w = 0; w < 5; w++)
+            for (b = 0; b < 243; b++)
+                if (idx->coarse[i].data[w][b >> 3] & (0x80 >> (b & 7)))
+                    idx->offsets[w*243 + b + 1]++;
+    for (i = 1; i <= 5*243; i++) {
+        if (idx->offsets[i] > UINT32_MAX - idx->offsets[i-1]) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        idx->offsets[i] += idx->offsets[i-1];
+    }
+    idx->postings = av_malloc_array(idx->offsets[5*243], sizeof(*idx->postings));
+    if (idx->offsets[5*243] && !idx->postings) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < idx->nb_coarse; i++)
+        for (w = 0; w < 5; w++)
+            for (b = 0; b < 243; b++)
+                if (idx->coarse[i].data[w][b >> 3] & (0x80 >> (b & 7)))
+                    idx->postings[idx->offsets[w*243 + b]++] = i;
+    /* restore the offsets, which now point to the end of their lists */
+    memmove(idx->offsets + 1, idx->offsets, 5*243 * sizeof(*idx->offsets));
+    idx->offsets[0] = 0;
+
+    av_log(ctx, AV_LOG_VERBOSE, "index %s: %d signatures, %d coarse signatures\n",
+           filename, idx->nb_entries, idx->nb_coarse);
+
+end:
+    if (ret < 0)
+        index_free(idx);
+    fclose(f);
+    return ret;
+}
+
+/**
+ * matches the signature of an input against all signatures of the index,
+ * only the fine signatures of candidates found by the index are read
+ */
+static int index_lookup(AVFilterContext *ctx, StreamContext *sc, int input)
+{
+    SignatureContext *sic = ctx->priv;
+    SignatureIndex *idx = &sic->index;
+    MatchingInfo match;
+    int i, ret, nb_candidates, nb_matches = 0;
+
+    nb_candidates = find_index_candidates(sic, idx, sc);
+    av_log(ctx, AV_LOG_DEBUG, "input %d: %d of %d indexed signatures are candidates\n",
+           input, nb_candidates, idx->nb_entries);
+
+    for (i = 0; i < idx->nb_entries && nb_candidates; i++) {
+        StreamContext sc2 = { 0 };
+
+        if (!idx->candidate[i])
+            continue;
+        nb_candidates--;
+
+        ret = binary_import(ctx, &sc2, idx->entries[i].filename, 0);
+        if (ret < 0)
+            return ret;
+        match = lookup_signatures(ctx, sic, sc, &sc2, sic->mode);
+        if (match.score != 0) {
+            av_log(ctx, AV_LOG_INFO, "matching of video %d at %f and %s at %f, %d frames matching\n",
+                    input, ((double) match.first->pts * sc->time_base.num) / sc->time_base.den,
+                    idx->entries[i].filename,
+                    ((double) match.second->pts * sc2.time_base.num) / sc2.time_base.den,
+                    match.matchframes);
+            if (match.whole)
+                av_log(ctx, AV_LOG_INFO, "whole video matching\n");
+            nb_matches++;
+        }
+        free_stream(&sc2);
+    }
+    if (!nb_matches)
+        av_log(ctx, AV_LOG_INFO, "no matching of video %d in the index\n", input);
+    return 0;
+}
+
 static int export(AVFilterContext *ctx, StreamContext *sc, int input)
 {
     SignatureContext* sic = ctx->priv;
@@ -624,6 +993,11 @@ static int request_frame(AVFilterLink *outlink)
                     av_log(ctx, AV_LOG_INFO, "no matching of video %d and %d\n", i, j);
                 }
             }
+            if (sic->index.nb_entries) {
+                int err = index_lookup(ctx, sc, i);
+                if (err < 0)
+                    return err;
+            }
         }
     }
 
@@ -678,6 +1052,13 @@ static av_cold int init(AVFilterContext *ctx)
         return AVERROR(EINVAL);
     }
 
+    if (sic->index_filename) {
+        if (sic->mode == MODE_OFF)
+            av_log(ctx, AV_LOG_WARNING, "The index is only used if detectmode is enabled.\n");
+        else if ((ret = index_load(ctx, &sic->index, sic->index_filename)) < 0)
+            return ret;
+    }
+
     return 0;
 }
 
@@ -686,36 +1067,16 @@ static av_cold int init(AVFilterContext *ctx)
 static av_cold void uninit(AVFilterContext *ctx)
 {
     SignatureContext *sic = ctx->priv;
-    StreamContext *sc;
-    void* tmp;
-    FineSignature* finsig;
-    CoarseSignature* cousig;
     int i;
 
 
     /* free the lists */
     if (sic->streamcontexts != NULL) {
-        for (i = 0; i < sic->nb_inputs; i++) {
-            sc = &(sic->streamcontexts[i]);
-            finsig = sc->finesiglist;
-            cousig = sc->coarsesiglist;
-
-            while (finsig) {
-                tmp = finsig;
-                finsig = finsig->next;
-                av_freep(&tmp);
-            }
-            sc->finesiglist = NULL;
-
-            while (cousig) {
-                tmp = cousig;
-                cousig = cousig->next;
-                av_freep(&tmp);
-            }
-            sc->coarsesiglist = NULL;
-        }
+        for (i = 0; i < sic->nb_inputs; i++)
+            free_stream(&sic->streamcontexts[i]);
         av_freep(&sic->streamcontexts);
     }
+    index_free(&sic->index);
 }
 
 static int config_output(AVFilterLink *outlink)
@@ -753,5 +1114,5 @@ const AVFilter ff_vf_signature = {
     FILTER_OUTPUTS(signature_outputs),
     .inputs        = NULL,
     FILTER_PIXFMTS_ARRAY(pix_fmts),
-    .flags         = AVFILTER_FLAG_DYNAMIC_INPUTS,
+    .flags         = AVFILTER_FLAG_DYNAMIC_INPUTS | AVFILTER_FLAG_SLICE_THREADS,
 };
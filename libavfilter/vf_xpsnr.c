@@ -60,6 +60,7 @@ typedef struct XPSNRContext {
     /* XPSNR specific variables */
     double          *sse_luma;
     double          *weights;
+    double          *wsse_chroma; /* weighted SSE of the chroma blocks */
     AVBufferRef     *buf_org   [3];
     AVBufferRef     *buf_org_m1[3];
     AVBufferRef     *buf_org_m2[3];
@@ -266,6 +267,111 @@ static inline double get_avg_xpsnr (const double sqrt_wsse_val,  const double su
     return sum_xpsnr_val / (double) num_frames_64; /* older log-domain average */
 }
 
+typedef struct ThreadData {
+    const AVFrame *master, *ref;
+    int16_t  **org, **org_m1, **org_m2, **rec;
+    const int *stride_org;
+    uint32_t   b;   /* luma block size */
+    uint32_t   bx, by, w_blk_c, h_blk_c; /* chroma block size and count */
+} ThreadData;
+
+/* converts the 8-bit input pictures to the 16-bit XPSNR pictures */
+static int convert_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    XPSNRContext *const s = ctx->priv;
+    const ThreadData *td = arg;
+
+    for (int c = 0; c < s->num_comps; c++) {
+        const int m = s->line_sizes[c];  /* master stride */
+        const int r = td->ref->linesize[c]; /* ref/c stride */
+        const int o = s->plane_width[c]; /* XPSNR stride */
+        const int slice_start = (s->plane_height[c] *  jobnr     ) / nb_jobs;
+        const int slice_end   = (s->plane_height[c] * (jobnr + 1)) / nb_jobs;
+
+        for (int y = slice_start; y < slice_end; y++) {
+            for (int x = 0; x < s->plane_width[c]; x++) {
+                td->org[c][y * o + x] = (int16_t) td->master->data[c][y * m + x];
+                td->rec[c][y * o + x] = (int16_t)    td->ref->data[c][y * r + x];
+            }
+        }
+    }
+    return 0;
+}
+
+/* calculates the block SSE and perceptual weights of a range of luma block rows */
+static int luma_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    XPSNRContext *const s = ctx->priv;
+    const ThreadData *td = arg;
+    const uint32_t     w = s->plane_width [0];
+    const uint32_t     h = s->plane_height[0];
+    const uint32_t     b = td->b;
+    const uint32_t w_blk = (w + b - 1) / b;
+    const uint32_t h_blk = (h + b - 1) / b;
+    const uint32_t slice_start = (h_blk *  jobnr     ) / nb_jobs;
+    const uint32_t slice_end   = (h_blk * (jobnr + 1)) / nb_jobs;
+    const int16_t *p_org = td->org[0];
+    const uint32_t s_org = td->stride_org[0] / s->bpp;
+    const int16_t *p_rec = td->rec[0];
+    const uint32_t s_rec = s->plane_width[0];
+    int16_t    *p_org_m1 = td->org_m1[0]; /* pixel  */
+    int16_t    *p_org_m2 = td->org_m2[0]; /* memory */
+
+    for (uint32_t y_blk = slice_start; y_blk < slice_end; y_blk++) {
+        const uint32_t y = y_blk * b;
+        const uint32_t block_height = (y + b > h ? h - y : b);
+        uint32_t idx_blk = y_blk * w_blk;
+
+        for (uint32_t x = 0; x < w; x += b, idx_blk++) {
+            const uint32_t block_width = (x + b > w ? w - x : b);
+            double ms_act = 1.0;
+
+            s->sse_luma[idx_blk] = calc_squared_error_and_weight(s, p_org, s_org,
+                                                                 p_org_m1, p_org_m2,
+                                                                 p_rec, s_rec,
+                                                                 x, y,
+                                                                 block_width, block_height,
+                                                                 s->depth, s->frame_rate, &ms_act);
+            s->weights[idx_blk] = 1.0 / sqrt(ms_act);
+        }
+    }
+    return 0;
+}
+
+/* calculates the weighted SSE of a range of chroma block rows */
+static int chroma_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    XPSNRContext *const s = ctx->priv;
+    const ThreadData *td = arg;
+    const uint32_t slice_start = (td->h_blk_c *  jobnr     ) / nb_jobs;
+    const uint32_t slice_end   = (td->h_blk_c * (jobnr + 1)) / nb_jobs;
+
+    for (int c = 1; c < s->num_comps; c++) {
+        const int16_t *p_org = td->org[c];
+        const uint32_t s_org = td->stride_org[c] / s->bpp;
+        const int16_t *p_rec = td->rec[c];
+        const uint32_t s_rec = s->plane_width[c];
+        const uint32_t w_pln = s->plane_width[c];
+        const uint32_t h_pln = s->plane_height[c];
+        double *const wsse_chroma = s->wsse_chroma + (c - 1) * td->w_blk_c * td->h_blk_c;
+
+        for (uint32_t y_blk = slice_start; y_blk < slice_end; y_blk++) {
+            const uint32_t y = y_blk * td->by;
+            const uint32_t block_height = (y + td->by > h_pln ? h_pln - y : td->by);
+            uint32_t idx_blk = y_blk * td->w_blk_c;
+
+            for (uint32_t x = 0; x < w_pln; x += td->bx, idx_blk++) {
+                const uint32_t block_width = (x + td->bx > w_pln ? w_pln - x : td->bx);
+
+                wsse_chroma[idx_blk] = (double) calc_squared_error (s, p_org + y * s_org + x, s_org,
+                                                                    p_rec + y * s_rec + x, s_rec,
+                                                                    block_width, block_height) * s->weights[idx_blk];
+            }
+        }
+    }
+    return 0;
+}
+
 static int get_wsse(AVFilterContext *ctx, int16_t **org, int16_t **org_m1, int16_t **org_m2, int16_t **rec,
                     uint64_t *const wsse64)
 {
@@ -279,9 +385,14 @@ static int get_wsse(AVFilterContext *ctx, int16_t **org, int16_t **org_m1, int16
     const double   avg_act = sqrt(16.0 * (double) (1 << (2 * s->depth - 9)) / sqrt(FFMAX(0.00001,
                                                                                    r))); /* the sqrt(a_pic) */
     const int  *stride_org = (s->bpp == 1 ? s->plane_width : s->line_sizes);
+    const int   nb_threads = ff_filter_get_nb_threads(ctx);
     uint32_t x, y, idx_blk = 0; /* the "16.0" above is due to fixed-point code */
     double *const sse_luma = s->sse_luma;
     double *const  weights = s->weights;
+    ThreadData td = {
+        .org = org, .org_m1 = org_m1, .org_m2 = org_m2, .rec = rec,
+        .stride_org = stride_org, .b = b,
+    };
     int c;
 
     if (!wsse64 || (s->depth < 6) || (s->depth > 16) || (s->num_comps <= 0) ||
@@ -295,30 +406,17 @@ static int get_wsse(AVFilterContext *ctx, int16_t **org, int16_t **org_m1, int16
     }
 
     if (b >= 4) {
-        const int16_t *p_org = org[0];
-        const uint32_t s_org = stride_org[0] / s->bpp;
-        const int16_t *p_rec = rec[0];
-        const uint32_t s_rec = s->plane_width[0];
-        int16_t    *p_org_m1 = org_m1[0]; /* pixel  */
-        int16_t    *p_org_m2 = org_m2[0]; /* memory */
+        const uint32_t h_blk = (h + b - 1) / b;
         double     wsse_luma = 0.0;
 
-        for (y = 0; y < h; y += b) { /* calculate block SSE and perceptual weights */
-            const uint32_t block_height = (y + b > h ? h - y : b);
+        /* calculate block SSE and perceptual weights */
+        ff_filter_execute(ctx, luma_slice, &td, NULL, FFMIN(h_blk, nb_threads));
+
+        if (w * h <= 640 * 480) { /* "min-smoothing" as in paper, in block order */
+            for (y = idx_blk = 0; y < h; y += b) {
+                for (x = 0; x < w; x += b, idx_blk++) {
+                    double ms_act_prev;
 
-            for (x = 0; x < w; x += b, idx_blk++) {
-                const uint32_t block_width = (x + b > w ? w - x : b);
-                double ms_act = 1.0, ms_act_prev = 0.0;
-
-                sse_luma[idx_blk] = calc_squared_error_and_weight(s, p_org, s_org,
-                                                                  p_org_m1, p_org_m2,
-                                                                  p_rec, s_rec,
-                                                                  x, y,
-                                                                  block_width, block_height,
-                                                                  s->depth, s->frame_rate, &ms_act);
-                weights[idx_blk] = 1.0 / sqrt(ms_act);
-
-                if (w * h <= 640 * 480) { /* in-line "min-smoothing" as in paper */
                     if (x == 0) /* first column */
                         ms_act_prev = (idx_blk > 1 ? weights[idx_blk - 2] : 0);
                     else  /* after first column */
@@ -334,9 +432,9 @@ static int get_wsse(AVFilterContext *ctx, int16_t **org, int16_t **org_m1, int16
                         if (weights[idx_blk] > ms_act_prev)
                             weights[idx_blk] = ms_act_prev;
                     }
-                }
-            } /* for x */
-        } /* for y */
+                } /* for x */
+            } /* for y */
+        }
 
         for (y = idx_blk = 0; y < h; y += b) { /* calculate sum for luma (Y) XPSNR */
             for (x = 0; x < w; x += b, idx_blk++) {
@@ -344,39 +442,38 @@ static int get_wsse(AVFilterContext *ctx, int16_t **org, int16_t **org_m1, int16
             }
         }
         wsse64[0] = (wsse_luma <= 0.0 ? 0 : (uint64_t) (wsse_luma * avg_act + 0.5));
-    } /* b >= 4 */
 
-    for (c = 0; c < s->num_comps; c++) { /* finalize WSSE value for each component */
-        const int16_t *p_org = org[c];
-        const uint32_t s_org = stride_org[c] / s->bpp;
-        const int16_t *p_rec = rec[c];
-        const uint32_t s_rec = s->plane_width[c];
-        const uint32_t w_pln = s->plane_width[c];
-        const uint32_t h_pln = s->plane_height[c];
-
-        if (b < 4) /* picture is too small for XPSNR, calculate nonweighted PSNR */
-            wsse64[c] = calc_squared_error (s, p_org, s_org,
-                                            p_rec, s_rec,
-                                            w_pln, h_pln);
-        else if (c > 0) { /* b >= 4 so Y XPSNR has already been calculated above */
-            const uint32_t  bx = (b * w_pln) / w;
-            const uint32_t  by = (b * h_pln) / h;  /* up to chroma downsampling by 4 */
-            double wsse_chroma = 0.0;
+        if (s->num_comps > 1) { /* b >= 4 so Y XPSNR has already been calculated above */
+            td.bx = (b * s->plane_width [1]) / w;
+            td.by = (b * s->plane_height[1]) / h;  /* up to chroma downsampling by 4 */
+            td.w_blk_c = (s->plane_width [1] + td.bx - 1) / td.bx;
+            td.h_blk_c = (s->plane_height[1] + td.by - 1) / td.by;
+
+            if (!s->wsse_chroma)
+                s->wsse_chroma = av_malloc_array(2 * td.w_blk_c * td.h_blk_c, sizeof(double));
+            if (!s->wsse_chroma) {
+                av_log(ctx, AV_LOG_ERROR, "Failed to allocate temporary block memory.\n");
+                return AVERROR(ENOMEM);
+            }
 
-            for (y = idx_blk = 0; y < h_pln; y += by) { /* calc chroma (Cb/Cr) XPSNR */
-                const uint32_t block_height = (y + by > h_pln ? h_pln - y : by);
+            /* calc chroma (Cb/Cr) XPSNR */
+            ff_filter_execute(ctx, chroma_slice, &td, NULL, FFMIN(td.h_blk_c, nb_threads));
 
-                for (x = 0; x < w_pln; x += bx, idx_blk++) {
-                    const uint32_t block_width = (x + bx > w_pln ? w_pln - x : bx);
+            for (c = 1; c < s->num_comps; c++) {
+                const double *wsse_blk = s->wsse_chroma + (c - 1) * td.w_blk_c * td.h_blk_c;
+                double wsse_chroma = 0.0;
 
-                    wsse_chroma += (double) calc_squared_error (s, p_org + y * s_org + x, s_org,
-                                                                p_rec + y * s_rec + x, s_rec,
-                                                                block_width, block_height) * weights[idx_blk];
-                }
+                for (idx_blk = 0; idx_blk < td.w_blk_c * td.h_blk_c; idx_blk++)
+                    wsse_chroma += wsse_blk[idx_blk];
+                wsse64[c] = (wsse_chroma <= 0.0 ? 0 : (uint64_t) (wsse_chroma * avg_act + 0.5));
             }
-            wsse64[c] = (wsse_chroma <= 0.0 ? 0 : (uint64_t) (wsse_chroma * avg_act + 0.5));
         }
-    } /* for c */
+    } else { /* picture is too small for XPSNR, calculate nonweighted PSNR */
+        for (c = 0; c < s->num_comps; c++)
+            wsse64[c] = calc_squared_error (s, org[c], stride_org[c] / s->bpp,
+                                            rec[c], s->plane_width[c],
+                                            s->plane_width[c], s->plane_height[c]);
+    }
 
     return 0;
 }
@@ -442,11 +539,9 @@ static int do_xpsnr(FFFrameSync *fs)
     }
 
     if (s->bpp == 1) { /* 8 bit */
-        for (c = 0; c < s->num_comps; c++) { /* allocate org/rec buffer memory */
-            const int m = s->line_sizes[c];  /* master stride */
-            const int r = ref->linesize[c];  /* ref/c stride */
-            const int o = s->plane_width[c]; /* XPSNR stride */
+        ThreadData td = { .master = master, .ref = ref, .org = porg, .rec = prec };
 
+        for (c = 0; c < s->num_comps; c++) { /* allocate org/rec buffer memory */
             if (!s->buf_org[c])
                 s->buf_org[c] = av_buffer_allocz(s->plane_width[c] * s->plane_height[c] * sizeof(int16_t));
             if (!s->buf_rec[c])
@@ -454,14 +549,9 @@ static int do_xpsnr(FFFrameSync *fs)
 
             porg[c] = (int16_t *) s->buf_org[c]->data;
             prec[c] = (int16_t *) s->buf_rec[c]->data;
-
-            for (int y = 0; y < s->plane_height[c]; y++) {
-                for (int x = 0; x < s->plane_width[c]; x++) {
-                    porg[c][y * o + x] = (int16_t) master->data[c][y * m + x];
-                    prec[c][y * o + x] = (int16_t)    ref->data[c][y * r + x];
-                }
-            }
         }
+        ff_filter_execute(ctx, convert_slice, &td, NULL,
+                          FFMIN(s->plane_height[0], ff_filter_get_nb_threads(ctx)));
     } else {  /* 10, 12, 14 bit */
         for (c = 0; c < s->num_comps; c++) {
             porg[c] = (int16_t *) master->data[c];
@@ -691,6 +781,7 @@ static av_cold void uninit(AVFilterContext *ctx)
 
     av_freep(&s->sse_luma);
     av_freep(&s->weights );
+    av_freep(&s->wsse_chroma);
 
     for (c = 0; c < s->num_comps; c++) { /* free extra temporal org buf memory */
         if(s->buf_org_m1[c])
@@ -739,5 +830,6 @@ const AVFilter ff_vf_xpsnr = {
     FILTER_INPUTS (xpsnr_inputs),
     FILTER_OUTPUTS(xpsnr_outputs),
     FILTER_PIXFMTS_ARRAY(xpsnr_formats),
-    .flags        = AVFILTER_FLAG_SUPPORT_TIMELINE_INTERNAL | AVFILTER_FLAG_METADATA_ONLY
+    .flags        = AVFILTER_FLAG_SUPPORT_TIMELINE_INTERNAL | AVFILTER_FLAG_METADATA_ONLY |
+                    AVFILTER_FLAG_SLICE_THREADS,
 };
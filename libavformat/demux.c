@@ -1230,7 +1230,8 @@ static int parse_packet(AVFormatContext *s, AVPacket *pkt,
                                      st->time_base,
                                      AV_ROUND_DOWN);
             }
-        } else if (st->codecpar->codec_id == AV_CODEC_ID_GIF) {
+        } else if (st->codecpar->codec_id == AV_CODEC_ID_GIF ||
+                   st->codecpar->codec_id == AV_CODEC_ID_QMAGE) {
             if (st->time_base.num > 0 && st->time_base.den > 0 &&
                 sti->parser->duration) {
                 out_pkt->duration = sti->parser->duration;
@@ -22,12 +22,12 @@
 #include "avformat.h"
 #include "demux.h"
 #include "internal.h"
-#include "libavcodec/get_bits.h"
+#include "libavcodec/avcodec.h"
+#include "libavcodec/qmage_parse.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mem.h"
 
-#define QMAGE_MAGIC        0x514d
-#define QVERSION_1_43_LESS 0xb
+#define QMAGE_PACKET_SIZE  4096
 
 static int qmage_probe(const AVProbeData *p)
 {
@@ -37,166 +37,139 @@ static int qmage_probe(const AVProbeData *p)
     return AVPROBE_SCORE_EXTENSION / 4;
 }
 
+typedef struct QmageDemuxContext {
+    uint8_t *alpha_buf;
+    unsigned int alpha_buf_size;
+    int cur_frame;
+} QmageDemuxContext;
+
 /* keyframe alpha size is not stored in the bitstream, so we must parse the
  * bitstream to determine size
  */
 static int parse_a9ll_alpha_size(AVFormatContext * s, int width, int height)
 {
+    QmageDemuxContext *q = s->priv_data;
     AVIOContext *pb = s->pb;
-    int len1, len2, ret;
-    uint8_t * data;
-    GetBitContext gb1, gb2;
-    int64_t start = avio_tell(pb);
-
-    if ((width & 7) || (height & 3)) {
-        avpriv_request_sample(s, "unaligned alpha");
-        return AVERROR_PATCHWELCOME;
-    }
+    int len = 0, ret;
 
-    len1 = avio_rl32(pb);
-    len2 = avio_rl32(pb);
-    if (len1 < 8 || len2 < 8 || len1 > len2)
-        return AVERROR_INVALIDDATA;
+    for (;;) {
+        int size = FFMAX(2 * len, QMAGE_PACKET_SIZE);
+        uint8_t *tmp = NULL;
 
-    len1 -= 8;
-    len2 -= 8;
-    data = av_malloc(len2 + AV_INPUT_BUFFER_PADDING_SIZE);
-    if (!data)
-        return AVERROR(ENOMEM);
-    avio_read(pb, data, len2);
-    if ((ret = init_get_bits8(&gb1, data, len1)) < 0)
-        return ret;
-    if ((ret = init_get_bits8(&gb2, data + len1, len2 - len1)) < 0)
-        return ret;
+        if (len <= (INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) / 2)
+            tmp = av_fast_realloc(q->alpha_buf, &q->alpha_buf_size,
+                                  size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!tmp)
+            return AVERROR(ENOMEM);
+        q->alpha_buf = tmp;
 
-    for (int y = 0; y < height; y += 4) {
-        for (int x = 0; x < width; x += 8) {
-            int mode = get_bits(&gb1, 2);
-            if (mode < 3) {
-                int cbp = avio_rl16(pb);
-                for (int k = 0; k < 16; k++) {
-                    if (!(cbp & (1 << k))) {
-                        int nb_bits = get_bits(&gb2, 3);
-                        if (nb_bits == 7) {
-                            avio_skip(pb, 2);
-                        } else {
-                            skip_bits(&gb1, nb_bits + 1);
-                        }
-                    }
-                }
-            }
-        }
-    }
+        ret = avio_read(pb, q->alpha_buf + len, size - len);
+        if (ret == AVERROR_EOF)
+            return AVERROR_INVALIDDATA;
+        if (ret < 0)
+            return ret;
+        len += ret;
+        memset(q->alpha_buf + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
 
-    free(data);
-    return ((avio_tell(pb) + 3) & ~3) - start;
+        ret = ff_qmage_a9ll_alpha_size(q->alpha_buf, len, width, height, s);
+        if (ret)
+            return ret;
+    }
 }
 
-typedef struct {
-    int qversion;
-    int raw_type;
-    int transparency;
-    int mode;
-    int width;
-    int height;
-    int alpha_position;
-    int total_frame_number;
-    int current_frame_number;
-    int animation_delay_time;
-    int animation_no_repeat;
-    int header_size;
-} Header;
-
-static int read_header(AVFormatContext * s, Header * h)
+/* read the header of the frame at the current position, which is kept */
+static int read_header(AVFormatContext * s, FFQmageHeader * h)
 {
     AVIOContext *pb = s->pb;
+    uint8_t buf[QMAGE_HEADER_SIZE_MAX];
+    int64_t pos = avio_tell(pb);
+    int ret;
 
-    int magic = avio_rb16(pb);
-    if (avio_feof(pb))
-        return AVERROR_EOF;
-    if (magic != QMAGE_MAGIC) {
-        av_log(s, AV_LOG_ERROR, "unexpected magic 0x%x at 0x%" PRIx64 "\n", magic, avio_tell(pb) - 4);
-        return AVERROR_INVALIDDATA;
-    }
-
-    h->qversion = avio_r8(pb);
-    h->raw_type = avio_r8(pb);
-    switch (h->raw_type) {
-    case 0: //RGB565
-        h->transparency = 0;
-        break;
-    case 3: //RGBA5658
-    case 6: //RGBA
-        h->transparency = 1;
-        break;
-    default:
-        avpriv_request_sample(s, "raw_type=%d\n", h->raw_type);
-        return AVERROR_INVALIDDATA;
-    }
-
-    h->mode = !!(avio_r8(pb) & 0x80);
-    avio_skip(pb, 1);
-    h->width = avio_rl16(pb);
-    h->height = avio_rl16(pb);
-    avio_skip(pb, 2);
-
-    if (h->qversion == QVERSION_1_43_LESS) {
-        if (h->transparency || h->mode)
-            h->alpha_position = avio_rl32(pb);
-        else
-            h->alpha_position = -1;
-
-    } else if (h->qversion > QVERSION_1_43_LESS) {
-        h->alpha_position = avio_rl16(pb);
-        avio_skip(pb, 2);
-    } else {
-        avpriv_request_sample(s, "qversion=0x%x", h->qversion);
-        return AVERROR_INVALIDDATA;
-    }
+    ret = avio_read(pb, buf, sizeof(buf));
+    if (ret < 0)
+        return ret;
+    ret = ff_qmage_parse_header(h, buf, ret, s);
+    if (!ret)
+        ret = AVERROR_INVALIDDATA;
+    if (ret < 0)
+        return ret;
 
-    if (h->mode) {
-        h->total_frame_number = avio_rl16(pb);
-        h->current_frame_number = avio_rl16(pb);
-        h->animation_delay_time = avio_rl16(pb);
-        h->animation_no_repeat = avio_r8(pb);
-        avio_skip(pb, 1);
-        h->header_size = 24;
-    } else {
-        h->total_frame_number = h->current_frame_number = 1;
-        h->header_size = h->transparency ? 16 : 12;
-    }
+    return avio_seek(pb, pos, SEEK_SET);
+}
 
-    if (h->qversion > QVERSION_1_43_LESS) {
-        if (!h->mode || h->current_frame_number <= 1)
-            h->alpha_position *= 4;
-    }
+/* determine the size of the frame whose header starts at pos */
+static int frame_size(AVFormatContext * s, const FFQmageHeader * h, int64_t pos)
+{
+    AVIOContext *pb = s->pb;
+    int64_t ret;
 
     if (h->mode) {
-        if (h->alpha_position <= h->header_size)
-            return AVERROR_INVALIDDATA;
-
         if (h->transparency) {
             int alpha_size;
-            avio_seek(pb, h->alpha_position - h->header_size, SEEK_CUR);
+            if ((ret = avio_seek(pb, pos + h->alpha_position, SEEK_SET)) < 0)
+                return ret;
             if (h->current_frame_number == 1) {
                 alpha_size = parse_a9ll_alpha_size(s, h->width, h->height);
+                if (alpha_size < 0)
+                    return alpha_size;
             } else {
                 alpha_size = avio_rl32(pb);
                 if (alpha_size < 4)
                     return AVERROR_INVALIDDATA;
             }
+            if (alpha_size > INT_MAX - h->alpha_position)
+                return AVERROR_INVALIDDATA;
             return h->alpha_position + alpha_size;
         } else {
             return h->alpha_position;
         }
     }
 
-    return avio_size(pb);
+    ret = avio_size(pb);
+    if (ret < 0)
+        return ret;
+    return FFMIN(ret - pos, INT_MAX);
+}
+
+/* frame duration, in the same units as qmage_parse() in the parser */
+static int frame_delay(const FFQmageHeader *h)
+{
+    return h->mode && h->animation_delay_time > 0 ? h->animation_delay_time : 1;
+}
+
+/* walk the whole file once, so that packets can be read and seeked to
+ * without parsing any frame header again; returns the total duration
+ */
+static int64_t build_index(AVFormatContext *s, AVStream *st)
+{
+    AVIOContext *pb = s->pb;
+    int64_t pts = 0;
+    FFQmageHeader h;
+
+    for (;;) {
+        int64_t pos = avio_tell(pb);
+        int size = read_header(s, &h);
+        if (size >= 0)
+            size = frame_size(s, &h, pos);
+        if (size < 0) {
+            if (size != AVERROR_EOF)
+                av_log(s, AV_LOG_WARNING, "frame index truncated at 0x%" PRIx64 "\n", pos);
+            break;
+        }
+        if (av_add_index_entry(st, pos, pts, size, 0,
+                               h.current_frame_number <= 1 ? AVINDEX_KEYFRAME : 0) < 0)
+            break;
+        pts += frame_delay(&h);
+        if (avio_seek(pb, pos + size, SEEK_SET) < 0)
+            break;
+    }
+
+    return pts;
 }
 
 static int qmage_read_header(AVFormatContext *s)
 {
-    Header h;
+    FFQmageHeader h;
     int ret;
     AVStream * st;
 
@@ -212,33 +185,99 @@ static int qmage_read_header(AVFormatContext *s)
     st->codecpar->width = h.width;
     st->codecpar->height = h.height;
     st->nb_frames = h.total_frame_number;
-    avpriv_set_pts_info(st, 64, 1, 15);
 
-    avio_seek(s->pb, 0, SEEK_SET);
+    /* animation_delay_time is in milliseconds */
+    if (h.mode && h.animation_delay_time > 0)
+        avpriv_set_pts_info(st, 64, 1, 1000);
+    else
+        avpriv_set_pts_info(st, 64, 1, 15);
+
+    if ((ret = avio_seek(s->pb, 0, SEEK_SET)) < 0)
+        return ret;
+
+    if (s->pb->seekable & AVIO_SEEKABLE_NORMAL) {
+        st->duration = build_index(s, st);
+        if ((ret = avio_seek(s->pb, 0, SEEK_SET)) < 0)
+            return ret;
+    }
+    /* if not even the first frame could be indexed, leave it to the parser */
+    if (!avformat_index_get_entry(st, 0))
+        ffstream(st)->need_parsing = AVSTREAM_PARSE_FULL_RAW;
+
     return 0;
 }
 
 static int qmage_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
+    QmageDemuxContext *q = s->priv_data;
     AVIOContext *pb = s->pb;
-    Header h;
-    uint64_t pos;
-    int size;
+    AVStream *st = s->streams[0];
+    const AVIndexEntry *e = avformat_index_get_entry(st, q->cur_frame);
+    const AVIndexEntry *next;
+    int ret;
 
-    pos = avio_tell(pb);
-    size = read_header(s, &h);
-    if (size < 0)
-        return size;
+    /* without an index, the parser splits the stream into frames */
+    if (!e) {
+        if (q->cur_frame)
+            return AVERROR_EOF;
+        if ((ret = av_new_packet(pkt, QMAGE_PACKET_SIZE)) < 0)
+            return ret;
+        pkt->pos = avio_tell(pb);
+        ret = avio_read_partial(pb, pkt->data, QMAGE_PACKET_SIZE);
+        if (ret < 0)
+            return ret;
+        av_shrink_packet(pkt, ret);
+        return 0;
+    }
 
-    avio_seek(pb, pos, SEEK_SET);
-    return av_get_packet(pb, pkt, size);
+    if ((ret = avio_seek(pb, e->pos, SEEK_SET)) < 0)
+        return ret;
+    ret = av_get_packet(pb, pkt, e->size);
+    if (ret < 0)
+        return ret;
+
+    /* the index holds the running sum of the per-frame delays */
+    next = avformat_index_get_entry(st, q->cur_frame + 1);
+    pkt->pts      = e->timestamp;
+    pkt->duration = (next ? next->timestamp : st->duration) - e->timestamp;
+    if (e->flags & AVINDEX_KEYFRAME)
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    q->cur_frame++;
+    return 0;
+}
+
+static int qmage_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp, int flags)
+{
+    QmageDemuxContext *q = s->priv_data;
+    AVStream *st = s->streams[stream_index];
+    int index = av_index_search_timestamp(st, timestamp, flags);
+    int64_t ret;
+
+    if (index < 0)
+        return AVERROR(EINVAL);
+
+    if ((ret = avio_seek(s->pb, ffstream(st)->index_entries[index].pos, SEEK_SET)) < 0)
+        return ret;
+    q->cur_frame = index;
+    return 0;
+}
+
+static int qmage_read_close(AVFormatContext *s)
+{
+    QmageDemuxContext *q = s->priv_data;
+
+    av_freep(&q->alpha_buf);
+    return 0;
 }
 
 const FFInputFormat ff_qmage_demuxer = {
     .p.name         = "qmage",
     .p.long_name    = NULL_IF_CONFIG_SMALL("Quram Qmage"),
-    .p.flags        = AVFMT_GENERIC_INDEX,
+    .priv_data_size = sizeof(QmageDemuxContext),
+    .flags_internal = FF_INFMT_FLAG_INIT_CLEANUP,
     .read_probe     = qmage_probe,
     .read_header    = qmage_read_header,
     .read_packet    = qmage_read_packet,
+    .read_seek      = qmage_read_seek,
+    .read_close     = qmage_read_close,
 };
@@ -0,0 +1,107 @@
+/*
+ * Quram Qmage image format muxer
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#include "avformat.h"
+#include "mux.h"
+
+#define QMAGE_HEADER_SIZE_ANI 24
+
+typedef struct QmageMuxContext {
+    int64_t *frame_pos;
+    int nb_frames;
+    int nb_packets;
+} QmageMuxContext;
+
+static int qmage_write_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    QmageMuxContext *q = s->priv_data;
+
+    /* a file holds a single still; concatenated stills cannot be read back */
+    if (q->nb_packets++ && !(pkt->size > 4 && (pkt->data[4] & 0x80))) {
+        av_log(s, AV_LOG_ERROR, "Only one still image can be stored in a file, "
+               "use the animation encoder option or the image2 muxer\n");
+        return AVERROR(EINVAL);
+    }
+
+    /* animation frames carry the total frame number, which the encoder
+     * does not know; remember where to patch it */
+    if (pkt->size >= QMAGE_HEADER_SIZE_ANI && (pkt->data[4] & 0x80)) {
+        int64_t pos = avio_tell(s->pb);
+        if (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL))
+            q->nb_frames++;
+        else if (!av_dynarray2_add((void **)&q->frame_pos, &q->nb_frames,
+                                   sizeof(*q->frame_pos), (uint8_t *)&pos))
+            return AVERROR(ENOMEM);
+    }
+
+    avio_write(s->pb, pkt->data, pkt->size);
+    return 0;
+}
+
+static int qmage_write_trailer(AVFormatContext *s)
+{
+    QmageMuxContext *q = s->priv_data;
+    AVIOContext *pb = s->pb;
+    int64_t end = avio_tell(pb), ret;
+
+    if (!q->nb_frames)
+        return 0;
+
+    if (!(pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        av_log(s, AV_LOG_WARNING, "Output is not seekable, "
+               "the total frame number is not written\n");
+        return 0;
+    }
+
+    for (int i = 0; i < q->nb_frames; i++) {
+        if ((ret = avio_seek(pb, q->frame_pos[i] + 16, SEEK_SET)) < 0)
+            return ret;
+        avio_wl16(pb, FFMIN(q->nb_frames, UINT16_MAX));
+    }
+    if ((ret = avio_seek(pb, end, SEEK_SET)) < 0)
+        return ret;
+    return 0;
+}
+
+static void qmage_deinit(AVFormatContext *s)
+{
+    QmageMuxContext *q = s->priv_data;
+
+    av_freep(&q->frame_pos);
+}
+
+const FFOutputFormat ff_qmage_muxer = {
+    .p.name         = "qmage",
+    .p.long_name    = NULL_IF_CONFIG_SMALL("Quram Qmage"),
+    .p.extensions   = "qmg",
+    .priv_data_size = sizeof(QmageMuxContext),
+    .p.audio_codec  = AV_CODEC_ID_NONE,
+    .p.video_codec  = AV_CODEC_ID_QMAGE,
+    .p.subtitle_codec = AV_CODEC_ID_NONE,
+    .flags_internal   = FF_OFMT_FLAG_MAX_ONE_OF_EACH |
+                        FF_OFMT_FLAG_ONLY_DEFAULT_CODECS,
+    .write_packet   = qmage_write_packet,
+    .write_trailer  = qmage_write_trailer,
+    .deinit         = qmage_deinit,
+    .p.flags        = AVFMT_NOTIMESTAMPS,
+};
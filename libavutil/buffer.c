@@ -256,6 +256,106 @@ int av_buffer_replace(AVBufferRef **pdst, const AVBufferRef *src)
     return 0;
 }
 
+static void buffer_pool_cache_init(AVBufferPool *pool)
+{
+    for (size_t i = 0; i < BUFFER_POOL_CACHE_SIZE; i++)
+        atomic_init(&pool->cache[i].seq, i);
+    atomic_init(&pool->cache_recent, 0);
+    atomic_init(&pool->cache_put, 0);
+    atomic_init(&pool->cache_get, 0);
+}
+
+/*
+ * Try to store an entry in the lock-free queue.
+ * Returns 0 if the queue is full.
+ */
+static int buffer_pool_queue_put(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    size_t pos = atomic_load_explicit(&pool->cache_put, memory_order_relaxed);
+
+    while (1) {
+        BufferPoolSlot *slot = &pool->cache[pos & (BUFFER_POOL_CACHE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+
+        if (!diff) {
+            if (atomic_compare_exchange_weak_explicit(&pool->cache_put, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                slot->entry = buf;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else
+            pos = atomic_load_explicit(&pool->cache_put, memory_order_relaxed);
+    }
+}
+
+/*
+ * Take the oldest entry from the lock-free queue.
+ * Returns NULL if the queue is empty.
+ */
+static BufferPoolEntry *buffer_pool_queue_get(AVBufferPool *pool)
+{
+    size_t pos = atomic_load_explicit(&pool->cache_get, memory_order_relaxed);
+
+    while (1) {
+        BufferPoolSlot *slot = &pool->cache[pos & (BUFFER_POOL_CACHE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(seq - (pos + 1));
+
+        if (!diff) {
+            if (atomic_compare_exchange_weak_explicit(&pool->cache_get, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                BufferPoolEntry *buf = slot->entry;
+                atomic_store_explicit(&slot->seq, pos + BUFFER_POOL_CACHE_SIZE,
+                                      memory_order_release);
+                return buf;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else
+            pos = atomic_load_explicit(&pool->cache_get, memory_order_relaxed);
+    }
+}
+
+/*
+ * Store a released entry in the lock-free cache, displacing the previously
+ * most recent one into the queue.
+ * Returns the entry that did not fit in the cache, or NULL.
+ */
+static BufferPoolEntry *buffer_pool_cache_put(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    buf = (BufferPoolEntry *)atomic_exchange_explicit(&pool->cache_recent,
+                                                      (uintptr_t)buf,
+                                                      memory_order_acq_rel);
+    if (buf && buffer_pool_queue_put(pool, buf))
+        buf = NULL;
+    return buf;
+}
+
+/*
+ * Take an entry from the lock-free cache, the most recently released one
+ * first.
+ * Returns NULL if the cache is empty.
+ */
+static BufferPoolEntry *buffer_pool_cache_get(AVBufferPool *pool)
+{
+    BufferPoolEntry *buf = (BufferPoolEntry *)atomic_exchange_explicit(&pool->cache_recent, 0,
+                                                                       memory_order_acq_rel);
+    return buf ? buf : buffer_pool_queue_get(pool);
+}
+
+/* Check whether the lock-free cache may hold entries. */
+static int buffer_pool_cache_empty(AVBufferPool *pool)
+{
+    return !atomic_load(&pool->cache_recent) &&
+           atomic_load(&pool->cache_put) == atomic_load(&pool->cache_get);
+}
+
 AVBufferPool *av_buffer_pool_init2(size_t size, void *opaque,
                                    AVBufferRef* (*alloc)(void *opaque, size_t size),
                                    void (*pool_free)(void *opaque))
@@ -276,6 +376,7 @@ AVBufferPool *av_buffer_pool_init2(size_t size, void *opaque,
     pool->pool_free = pool_free;
 
     atomic_init(&pool->refcount, 1);
+    buffer_pool_cache_init(pool);
 
     return pool;
 }
@@ -295,14 +396,22 @@ AVBufferPool *av_buffer_pool_init(size_t size, AVBufferRef* (*alloc)(size_t size
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
 
     atomic_init(&pool->refcount, 1);
+    buffer_pool_cache_init(pool);
 
     return pool;
 }
 
 static void buffer_pool_flush(AVBufferPool *pool)
 {
+    BufferPoolEntry *buf;
+
+    while ((buf = buffer_pool_cache_get(pool))) {
+        buf->free(buf->opaque, buf->data);
+        av_freep(&buf);
+    }
+
     while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
+        buf = pool->pool;
         pool->pool = buf->next;
 
         buf->free(buf->opaque, buf->data);
@@ -347,10 +456,13 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    buf = buffer_pool_cache_put(pool, buf);
+    if (buf) {
+        ff_mutex_lock(&pool->mutex);
+        buf->next = pool->pool;
+        pool->pool = buf;
+        ff_mutex_unlock(&pool->mutex);
+    }
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -387,27 +499,67 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
     return ret;
 }
 
-AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
+static AVBufferRef *pool_reuse_buffer(AVBufferPool *pool, BufferPoolEntry *buf)
 {
     AVBufferRef *ret;
+
+    memset(&buf->buffer, 0, sizeof(buf->buffer));
+    ret = buffer_create(&buf->buffer, buf->data, pool->size,
+                        pool_release_buffer, buf, 0);
+    if (ret) {
+        buf->next = NULL;
+        buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
+    }
+    return ret;
+}
+
+AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
+{
+    AVBufferRef *ret = NULL;
     BufferPoolEntry *buf;
 
+    /* fast path: reuse a buffer from the cache without taking the lock */
+    buf = buffer_pool_cache_get(pool);
+    if (buf) {
+        ret = pool_reuse_buffer(pool, buf);
+        if (!ret && (buf = buffer_pool_cache_put(pool, buf))) {
+            ff_mutex_lock(&pool->mutex);
+            buf->next  = pool->pool;
+            pool->pool = buf;
+            ff_mutex_unlock(&pool->mutex);
+        }
+        goto end;
+    }
+
     ff_mutex_lock(&pool->mutex);
     buf = pool->pool;
     if (buf) {
-        memset(&buf->buffer, 0, sizeof(buf->buffer));
-        ret = buffer_create(&buf->buffer, buf->data, pool->size,
-                            pool_release_buffer, buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
-            buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
+        pool->pool = buf->next;
+        ret = pool_reuse_buffer(pool, buf);
+        if (!ret) {
+            buf->next  = pool->pool;
+            pool->pool = buf;
         }
     } else {
         ret = pool_alloc_buffer(pool);
+
+        /* Allocation may fail for pools with a fixed number of buffers.
+         * Retry the cache in case a buffer was released concurrently. */
+        while (!ret && !buffer_pool_cache_empty(pool)) {
+            buf = buffer_pool_cache_get(pool);
+            if (buf) {
+                ret = pool_reuse_buffer(pool, buf);
+                if (!ret) {
+                    buf->next  = pool->pool;
+                    pool->pool = buf;
+                }
+                break;
+            }
+        }
     }
     ff_mutex_unlock(&pool->mutex);
 
+end:
     if (ret)
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
 
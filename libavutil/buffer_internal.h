@@ -85,10 +85,43 @@ typedef struct BufferPoolEntry {
     AVBuffer buffer;
 } BufferPoolEntry;
 
+/**
+ * Number of released buffers kept in the lock-free cache of a pool, must be a
+ * power of two. Buffers released while the cache is full go to the
+ * mutex-protected list.
+ */
+#define BUFFER_POOL_CACHE_SIZE 64
+
+typedef struct BufferPoolSlot {
+    /*
+     * Sequence number of the slot: equal to the put position when the slot
+     * is free, to the get position + 1 when it holds an entry.
+     */
+    atomic_size_t    seq;
+    BufferPoolEntry *entry;
+} BufferPoolSlot;
+
 struct AVBufferPool {
     AVMutex mutex;
     BufferPoolEntry *pool;
 
+    /*
+     * Most recently released entry, handed out first so that reuse stays
+     * LIFO like the list above and the returned memory is likely still in
+     * the CPU caches. Taken and replaced with atomic exchanges only.
+     */
+    atomic_uintptr_t cache_recent;
+
+    /*
+     * Bounded lock-free MPMC queue of released entries displaced from
+     * cache_recent, used before falling back to the list above. The
+     * free-running put and get positions are placed on either side of the
+     * slots so that they do not share a cache line.
+     */
+    atomic_size_t  cache_put;
+    BufferPoolSlot cache[BUFFER_POOL_CACHE_SIZE];
+    atomic_size_t  cache_get;
+
     /*
      * This is used to track when the pool is to be freed.
      * The pointer to the pool itself held by the caller is considered to
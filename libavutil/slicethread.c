@@ -17,11 +17,14 @@
  */
 
 #include <stdatomic.h>
+#include "buffer.h"
 #include "cpu.h"
 #include "internal.h"
 #include "slicethread.h"
 #include "mem.h"
 #include "thread.h"
+#include "threadpool_internal.h"
+#include "trace.h"
 #include "avassert.h"
 
 #define MAX_AUTO_THREADS 16
@@ -36,6 +39,12 @@ typedef struct WorkerContext {
     int             done;
 } WorkerContext;
 
+typedef struct PoolHelper {
+    ThreadPoolTask  task;
+    AVSliceThread   *ctx;
+    int             queued;
+} PoolHelper;
+
 struct AVSliceThread {
     WorkerContext   *workers;
     int             nb_threads;
@@ -52,6 +61,12 @@ struct AVSliceThread {
     void            *priv;
     void            (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads);
     void            (*main_func)(void *priv);
+
+    /* shared thread pool mode, protected by done_mutex */
+    AVBufferRef     *pool;
+    PoolHelper      *helpers;
+    int             executing;
+    int             nb_running;
 };
 
 static int run_jobs(AVSliceThread *ctx)
@@ -62,7 +77,9 @@ static int run_jobs(AVSliceThread *ctx)
     unsigned current_job  = first_job;
 
     do {
+        av_trace_begin("slice", "job", current_job);
         ctx->worker_func(ctx->priv, current_job, first_job, nb_jobs, nb_active_threads);
+        av_trace_end();
     } while ((current_job = atomic_fetch_add_explicit(&ctx->current_job, 1, memory_order_acq_rel)) < nb_jobs);
 
     return current_job == nb_jobs + nb_active_threads - 1;
@@ -95,6 +112,169 @@ static void *attribute_align_arg thread_worker(void *v)
     }
 }
 
+/* Run jobs until none are left. The caller always runs as thread 0, pool
+ * helpers take the following thread numbers; a helper that comes late to a
+ * batch with all thread numbers taken has nothing to do. */
+static void pool_run_jobs(AVSliceThread *ctx, unsigned threadnr)
+{
+    unsigned nb_jobs           = ctx->nb_jobs;
+    unsigned nb_active_threads = ctx->nb_active_threads;
+    unsigned jobnr;
+
+    if (threadnr >= nb_active_threads)
+        return;
+
+    while ((jobnr = atomic_fetch_add_explicit(&ctx->current_job, 1, memory_order_acq_rel)) < nb_jobs) {
+        av_trace_begin("slice", "job", jobnr);
+        ctx->worker_func(ctx->priv, jobnr, threadnr, nb_jobs, nb_active_threads);
+        av_trace_end();
+    }
+}
+
+static void pool_helper_run(ThreadPoolTask *t)
+{
+    PoolHelper *h = (PoolHelper *)t;
+    AVSliceThread *ctx = h->ctx;
+
+    pthread_mutex_lock(&ctx->done_mutex);
+    h->queued = 0;
+    if (!ctx->executing) {
+        // queued for a batch that the caller has already completed
+        if (ctx->finished)
+            pthread_cond_signal(&ctx->done_cond);
+        pthread_mutex_unlock(&ctx->done_mutex);
+        return;
+    }
+    ctx->nb_running++;
+    pthread_mutex_unlock(&ctx->done_mutex);
+
+    pool_run_jobs(ctx, atomic_fetch_add_explicit(&ctx->first_job, 1, memory_order_acq_rel));
+
+    pthread_mutex_lock(&ctx->done_mutex);
+    if (!--ctx->nb_running)
+        pthread_cond_signal(&ctx->done_cond);
+    pthread_mutex_unlock(&ctx->done_mutex);
+}
+
+static void pool_execute(AVSliceThread *ctx, int nb_jobs)
+{
+    AVThreadPool *pool = (AVThreadPool *)ctx->pool->data;
+    int nb_helpers = 0;
+
+    pthread_mutex_lock(&ctx->done_mutex);
+    ctx->nb_jobs           = nb_jobs;
+    ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
+    atomic_store_explicit(&ctx->first_job, 1, memory_order_relaxed);
+    atomic_store_explicit(&ctx->current_job, 0, memory_order_relaxed);
+    ctx->executing = 1;
+
+    // helpers still queued from an earlier batch join this one
+    for (int i = 0; i < ctx->nb_threads - 1; i++)
+        nb_helpers += ctx->helpers[i].queued;
+    for (int i = 0; i < ctx->nb_threads - 1 && nb_helpers < ctx->nb_active_threads - 1; i++) {
+        PoolHelper *h = &ctx->helpers[i];
+        if (h->queued)
+            continue;
+        h->queued = 1;
+        ff_thread_pool_submit(pool, &h->task);
+        nb_helpers++;
+    }
+    pthread_mutex_unlock(&ctx->done_mutex);
+
+    // do not depend on the pool for progress, it may be busy with other work
+    pool_run_jobs(ctx, 0);
+
+    pthread_mutex_lock(&ctx->done_mutex);
+    ctx->executing = 0;
+    while (ctx->nb_running)
+        pthread_cond_wait(&ctx->done_cond, &ctx->done_mutex);
+    pthread_mutex_unlock(&ctx->done_mutex);
+}
+
+static int pool_helpers_queued(const AVSliceThread *ctx)
+{
+    for (int i = 0; i < ctx->nb_threads - 1; i++)
+        if (ctx->helpers[i].queued)
+            return 1;
+    return 0;
+}
+
+static void pool_free(AVSliceThread *ctx)
+{
+    pthread_mutex_lock(&ctx->done_mutex);
+    ctx->finished = 1;
+    while (ctx->nb_running || pool_helpers_queued(ctx))
+        pthread_cond_wait(&ctx->done_cond, &ctx->done_mutex);
+    pthread_mutex_unlock(&ctx->done_mutex);
+
+    pthread_cond_destroy(&ctx->done_cond);
+    pthread_mutex_destroy(&ctx->done_mutex);
+    av_buffer_unref(&ctx->pool);
+    av_freep(&ctx->helpers);
+}
+
+int avpriv_slicethread_create_pool(AVSliceThread **pctx, void *priv,
+                                   void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                   void (*main_func)(void *priv),
+                                   int nb_threads, AVBufferRef *pool)
+{
+    AVSliceThread *ctx;
+    int ret;
+
+    // main_func may wait for the workers, which the pool does not guarantee
+    // to run concurrently
+    if (!pool || main_func)
+        return avpriv_slicethread_create(pctx, priv, worker_func, main_func, nb_threads);
+
+    av_assert0(nb_threads >= 0);
+    if (!nb_threads)
+        nb_threads = FFMIN(av_thread_pool_get_nb_threads(pool) + 1, MAX_AUTO_THREADS);
+
+    *pctx = ctx = av_mallocz(sizeof(*ctx));
+    if (!ctx)
+        return AVERROR(ENOMEM);
+
+    ctx->priv        = priv;
+    ctx->worker_func = worker_func;
+    ctx->nb_threads  = nb_threads;
+    atomic_init(&ctx->first_job, 0);
+    atomic_init(&ctx->current_job, 0);
+
+    if (nb_threads > 1 && !(ctx->helpers = av_calloc(nb_threads - 1, sizeof(*ctx->helpers))))
+        goto fail;
+    for (int i = 0; i < nb_threads - 1; i++) {
+        ctx->helpers[i].task.run = pool_helper_run;
+        ctx->helpers[i].ctx      = ctx;
+    }
+
+    ctx->pool = av_buffer_ref(pool);
+    if (!ctx->pool)
+        goto fail;
+
+    ret = pthread_mutex_init(&ctx->done_mutex, NULL);
+    if (ret) {
+        av_buffer_unref(&ctx->pool);
+        av_freep(&ctx->helpers);
+        av_freep(pctx);
+        return AVERROR(ret);
+    }
+    ret = pthread_cond_init(&ctx->done_cond, NULL);
+    if (ret) {
+        pthread_mutex_destroy(&ctx->done_mutex);
+        av_buffer_unref(&ctx->pool);
+        av_freep(&ctx->helpers);
+        av_freep(pctx);
+        return AVERROR(ret);
+    }
+
+    return nb_threads;
+fail:
+    av_buffer_unref(&ctx->pool);
+    av_freep(&ctx->helpers);
+    av_freep(pctx);
+    return AVERROR(ENOMEM);
+}
+
 int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
                               void (*main_func)(void *priv),
@@ -192,6 +372,12 @@ void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_mai
     int nb_workers, i, is_last = 0;
 
     av_assert0(nb_jobs > 0);
+
+    if (ctx->pool) {
+        pool_execute(ctx, nb_jobs);
+        return;
+    }
+
     ctx->nb_jobs           = nb_jobs;
     ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
     atomic_store_explicit(&ctx->first_job, 0, memory_order_relaxed);
@@ -231,6 +417,13 @@ void avpriv_slicethread_free(AVSliceThread **pctx)
         return;
 
     ctx = *pctx;
+
+    if (ctx->pool) {
+        pool_free(ctx);
+        av_freep(pctx);
+        return;
+    }
+
     nb_workers = ctx->nb_threads;
     if (!ctx->main_func)
         nb_workers--;
@@ -268,6 +461,15 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return AVERROR(ENOSYS);
 }
 
+int avpriv_slicethread_create_pool(AVSliceThread **pctx, void *priv,
+                                   void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                   void (*main_func)(void *priv),
+                                   int nb_threads, AVBufferRef *pool)
+{
+    *pctx = NULL;
+    return AVERROR(ENOSYS);
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     av_assert0(0);
@@ -19,6 +19,8 @@
 #ifndef AVUTIL_SLICETHREAD_H
 #define AVUTIL_SLICETHREAD_H
 
+#include "buffer.h"
+
 typedef struct AVSliceThread AVSliceThread;
 
 /**
@@ -35,6 +37,22 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*main_func)(void *priv),
                               int nb_threads);
 
+/**
+ * Create slice threading context running on a shared thread pool.
+ * Same as avpriv_slicethread_create(), except that no threads are created;
+ * instead the jobs are run by the calling thread together with the threads
+ * of pool. Falls back to avpriv_slicethread_create() if pool is NULL or
+ * main_func is set.
+ * @param nb_threads maximum number of threads running jobs concurrently,
+ *                   including the calling thread, 0 for automatic
+ * @param pool reference to an AVThreadPool, a new reference is taken
+ * @return return number of threads or negative AVERROR on failure
+ */
+int avpriv_slicethread_create_pool(AVSliceThread **pctx, void *priv,
+                                   void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                   void (*main_func)(void *priv),
+                                   int nb_threads, AVBufferRef *pool);
+
 /**
  * Execute slice threading.
  * @param ctx slice threading context
@@ -0,0 +1,140 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program gets and releases buffers from one AVBufferPool in
+ * several threads at once and checks that no buffer is handed out twice.
+ * With -b it instead reports get/release throughput for 1 to 64 threads.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#define MAX_THREADS 64
+#define MAX_HELD     8
+
+typedef struct ThreadArg {
+    AVBufferPool *pool;
+    int           id;
+    int           iterations;
+    int           held;
+    int           errors;
+} ThreadArg;
+
+static void *thread_main(void *arg)
+{
+    ThreadArg *t = arg;
+    AVBufferRef *bufs[MAX_HELD] = { NULL };
+
+    for (int i = 0; i < t->iterations; i++) {
+        AVBufferRef **buf = &bufs[i % t->held];
+
+        if (*buf) {
+            // another thread got this buffer while we were holding it
+            if (AV_RN32A((*buf)->data) != t->id)
+                t->errors++;
+            av_buffer_unref(buf);
+        }
+
+        *buf = av_buffer_pool_get(t->pool);
+        if (!*buf) {
+            t->errors++;
+            break;
+        }
+        AV_WN32A((*buf)->data, t->id);
+    }
+
+    for (int i = 0; i < MAX_HELD; i++)
+        av_buffer_unref(&bufs[i]);
+
+    return NULL;
+}
+
+/* returns the elapsed time in microseconds or a negative value on failure */
+static int64_t run(int nb_threads, int iterations, int held)
+{
+    ThreadArg args[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    AVBufferPool *pool = av_buffer_pool_init(64, NULL);
+    int64_t t;
+    int errors = 0, ret;
+
+    if (!pool)
+        return -1;
+
+    t = av_gettime_relative();
+
+    for (int i = 0; i < nb_threads; i++) {
+        args[i] = (ThreadArg){ .pool = pool, .id = i + 1, .iterations = iterations,
+                               .held = held };
+        ret = pthread_create(&threads[i], NULL, thread_main, &args[i]);
+        if (ret) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            nb_threads = i;
+            errors++;
+            break;
+        }
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        pthread_join(threads[i], NULL);
+        errors += args[i].errors;
+    }
+
+    t = av_gettime_relative() - t;
+
+    av_buffer_pool_uninit(&pool);
+
+    if (errors) {
+        fprintf(stderr, "%d errors with %d threads\n", errors, nb_threads);
+        return -1;
+    }
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        printf("threads  held      ns/op\n");
+        for (int nb_threads = 1; nb_threads <= MAX_THREADS; nb_threads *= 2) {
+            for (int held = 1; held <= MAX_HELD; held *= 8) {
+                int iterations = 4000000 / nb_threads;
+                int64_t t = run(nb_threads, iterations, held);
+
+                if (t < 0)
+                    return 1;
+                printf("%7d %5d %10.2f\n", nb_threads, held,
+                       t * 1000.0 / ((int64_t)iterations * nb_threads));
+            }
+        }
+        return 0;
+    }
+
+    for (int nb_threads = 1; nb_threads <= 8; nb_threads *= 2) {
+        if (run(nb_threads, 20000, 1) < 0 ||
+            run(nb_threads, 20000, MAX_HELD) < 0)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program runs slice threaded batches from several threads at
+ * once, each with its own slice threading context, either with private
+ * threads or on one shared thread pool. It checks that every job runs
+ * exactly once and that no two jobs run concurrently with the same thread
+ * number. With -b it instead reports the time taken for both modes.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/cpu.h"
+#include "libavutil/slicethread.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadpool.h"
+#include "libavutil/time.h"
+
+#define MAX_CALLERS 64
+#define MAX_JOBS    64
+
+typedef struct Caller {
+    AVSliceThread *slicethread;
+    int            nb_threads;
+    int            iterations;
+    int            work;
+    atomic_int     errors;
+
+    atomic_int     runs[MAX_JOBS];
+    atomic_int     busy[MAX_JOBS];
+} Caller;
+
+static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    Caller *c = priv;
+    volatile unsigned sum = 0;
+
+    if (threadnr >= nb_threads || nb_threads > c->nb_threads ||
+        atomic_fetch_add(&c->busy[threadnr], 1)) {
+        atomic_fetch_add(&c->errors, 1);
+        return;
+    }
+
+    for (int i = 0; i < c->work; i++)
+        sum += i;
+    atomic_fetch_add(&c->runs[jobnr], 1);
+
+    atomic_fetch_sub(&c->busy[threadnr], 1);
+}
+
+static void *caller_main(void *arg)
+{
+    Caller *c = arg;
+
+    for (int i = 0; i < c->iterations; i++) {
+        int nb_jobs = 1 + i % MAX_JOBS;
+
+        for (int j = 0; j < nb_jobs; j++)
+            atomic_store(&c->runs[j], 0);
+
+        avpriv_slicethread_execute(c->slicethread, nb_jobs, 0);
+
+        for (int j = 0; j < nb_jobs; j++)
+            if (atomic_load(&c->runs[j]) != 1)
+                atomic_fetch_add(&c->errors, 1);
+    }
+
+    return NULL;
+}
+
+/* returns the elapsed time in microseconds or a negative value on failure */
+static int64_t run(int nb_callers, int pool_threads, int nb_threads,
+                   int iterations, int work)
+{
+    static Caller callers[MAX_CALLERS];
+    pthread_t threads[MAX_CALLERS];
+    AVBufferRef *pool = NULL;
+    int64_t t = 0;
+    int errors = 0, ret;
+
+    if (pool_threads && av_thread_pool_alloc(&pool, pool_threads) < 0)
+        return -1;
+
+    for (int i = 0; i < nb_callers; i++) {
+        Caller *c = &callers[i];
+
+        memset(c, 0, sizeof(*c));
+        c->iterations = iterations;
+        c->work       = work;
+        ret = avpriv_slicethread_create_pool(&c->slicethread, c, worker_func, NULL,
+                                             nb_threads, pool);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to create slice threading context\n");
+            nb_callers = i;
+            errors++;
+            goto end;
+        }
+        c->nb_threads = ret;
+    }
+    // the contexts hold their own references
+    av_buffer_unref(&pool);
+
+    t = av_gettime_relative();
+
+    for (int i = 0; i < nb_callers; i++) {
+        ret = pthread_create(&threads[i], NULL, caller_main, &callers[i]);
+        if (ret) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            for (int j = 0; j < i; j++)
+                pthread_join(threads[j], NULL);
+            errors++;
+            goto end;
+        }
+    }
+    for (int i = 0; i < nb_callers; i++)
+        pthread_join(threads[i], NULL);
+
+    t = av_gettime_relative() - t;
+
+end:
+    for (int i = 0; i < nb_callers; i++) {
+        errors += atomic_load(&callers[i].errors);
+        avpriv_slicethread_free(&callers[i].slicethread);
+    }
+    av_buffer_unref(&pool);
+
+    if (errors) {
+        fprintf(stderr, "%d errors with %d callers, %d pool threads, %d threads\n",
+                errors, nb_callers, pool_threads, nb_threads);
+        return -1;
+    }
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        printf("callers      private(ms)   pool(ms)\n");
+        for (int nb_callers = 1; nb_callers <= MAX_CALLERS; nb_callers *= 4) {
+            int iterations = 4000 / nb_callers;
+            int64_t t_private = run(nb_callers, 0, 0, iterations, 20000);
+            int64_t t_pool    = run(nb_callers, av_cpu_count(), 0, iterations, 20000);
+
+            if (t_private < 0 || t_pool < 0)
+                return 1;
+            printf("%7d %16.3f %10.3f\n", nb_callers,
+                   t_private / 1000.0, t_pool / 1000.0);
+        }
+        return 0;
+    }
+
+    for (int nb_callers = 1; nb_callers <= 8; nb_callers *= 2) {
+        if (run(nb_callers, 0, 4, 200, 100) < 0 ||
+            run(nb_callers, 1, 4, 200, 100) < 0 ||
+            run(nb_callers, 3, 8, 200, 100) < 0 ||
+            run(nb_callers, 3, 2, 200, 0) < 0)
+            return 1;
+    }
+
+    return 0;
+}
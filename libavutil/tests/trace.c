@@ -0,0 +1,152 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program records nested spans from several named threads, one of
+ * which overflows its ring buffer, writes the trace to the file given on the
+ * command line and checks the number of events in it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/error.h"
+#include "libavutil/thread.h"
+#include "libavutil/trace.h"
+
+#define NB_EVENTS     64
+#define NB_THREADS    4
+#define NB_ITERATIONS 10
+#define NB_WRAP       1000
+
+static void *thread_main(void *arg)
+{
+    int idx = (intptr_t)arg;
+    char name[16];
+
+    snprintf(name, sizeof(name), "worker%d", idx);
+    av_trace_set_thread_name(name);
+
+    for (int i = 0; i < NB_ITERATIONS; i++) {
+        av_trace_begin("test", "outer", i);
+        av_trace_begin("test", "inner", i);
+        av_trace_end();
+        av_trace_end();
+    }
+
+    return NULL;
+}
+
+static void *wrap_main(void *arg)
+{
+    av_trace_set_thread_name("wrap");
+
+    for (int i = 0; i < NB_WRAP; i++) {
+        av_trace_begin("test", "wrap", i);
+        av_trace_end();
+    }
+
+    return NULL;
+}
+
+static int count(const char *buf, const char *needle)
+{
+    int n = 0;
+    for (const char *p = buf; (p = strstr(p, needle)); p++)
+        n++;
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static char buf[1 << 16];
+    pthread_t threads[NB_THREADS + 1];
+    const int nb_begin = NB_THREADS * NB_ITERATIONS * 2 + NB_EVENTS / 2;
+    FILE *f;
+    size_t size;
+    int ret;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <output file>\n", argv[0]);
+        return 1;
+    }
+
+    // nothing must be recorded while tracing is off
+    av_trace_begin("test", "off", 0);
+    av_trace_end();
+
+    ret = av_trace_start(NB_EVENTS);
+    if (ret < 0) {
+        fprintf(stderr, "av_trace_start failed: %s\n", av_err2str(ret));
+        return 1;
+    }
+    if (!av_trace_enabled() || av_trace_start(0) != AVERROR(EBUSY)) {
+        fprintf(stderr, "Tracing not enabled after av_trace_start()\n");
+        return 1;
+    }
+
+    for (int i = 0; i <= NB_THREADS; i++) {
+        ret = pthread_create(&threads[i], NULL, i < NB_THREADS ? thread_main : wrap_main,
+                             (void *)(intptr_t)i);
+        if (ret) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (int i = 0; i <= NB_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    ret = av_trace_stop(argv[1]);
+    if (ret < 0) {
+        fprintf(stderr, "av_trace_stop failed: %s\n", av_err2str(ret));
+        return 1;
+    }
+    if (av_trace_enabled()) {
+        fprintf(stderr, "Tracing still enabled after av_trace_stop()\n");
+        return 1;
+    }
+
+    f = fopen(argv[1], "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    size = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[size] = 0;
+
+    if (count(buf, "\"ph\":\"B\"") != nb_begin ||
+        count(buf, "\"ph\":\"E\"") != nb_begin ||
+        count(buf, "\"ph\":\"M\"") != NB_THREADS + 1 ||
+        count(buf, "\"name\":\"off\"") ||
+        !strstr(buf, "\"name\":\"wrap\"") ||
+        !strstr(buf, "\"name\":\"worker3\"")) {
+        fprintf(stderr, "Unexpected trace contents:\n%s", buf);
+        return 1;
+    }
+
+    // a new session starts empty and may be discarded
+    if (av_trace_start(0) < 0)
+        return 1;
+    av_trace_begin("test", "discarded", 0);
+    av_trace_end();
+    if (av_trace_stop(NULL) < 0)
+        return 1;
+
+    return 0;
+}
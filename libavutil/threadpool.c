@@ -0,0 +1,112 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "buffer.h"
+#include "cpu.h"
+#include "error.h"
+#include "executor.h"
+#include "mem.h"
+#include "threadpool.h"
+#include "threadpool_internal.h"
+
+struct AVThreadPool {
+    AVExecutor *e;
+    int nb_threads;
+};
+
+static int task_priority_higher(const AVTask *a, const AVTask *b)
+{
+    // first in, first out
+    return 1;
+}
+
+static int task_ready(const AVTask *t, void *user_data)
+{
+    return 1;
+}
+
+static int task_run(AVTask *t, void *local_context, void *user_data)
+{
+    ThreadPoolTask *pt = (ThreadPoolTask *)t;
+    pt->run(pt);
+    return 0;
+}
+
+static void thread_pool_free(void *opaque, uint8_t *data)
+{
+    AVThreadPool *pool = (AVThreadPool *)data;
+
+    av_executor_free(&pool->e);
+    av_free(pool);
+}
+
+int av_thread_pool_alloc(AVBufferRef **ppool, int nb_threads)
+{
+    AVTaskCallbacks cb = {
+        .priority_higher = task_priority_higher,
+        .ready           = task_ready,
+        .run             = task_run,
+    };
+    AVThreadPool *pool;
+    AVBufferRef *buf;
+
+    *ppool = NULL;
+
+    if (!HAVE_THREADS)
+        return AVERROR(ENOSYS);
+    if (nb_threads < 0)
+        return AVERROR(EINVAL);
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+
+    pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return AVERROR(ENOMEM);
+    pool->nb_threads = nb_threads;
+
+    // the executor requires non-NULL user data, which none of the
+    // callbacks use
+    cb.user_data = pool;
+    pool->e = av_executor_alloc(&cb, nb_threads);
+    if (!pool->e) {
+        av_free(pool);
+        return AVERROR(ENOMEM);
+    }
+
+    buf = av_buffer_create((uint8_t *)pool, sizeof(*pool), thread_pool_free, NULL, 0);
+    if (!buf) {
+        av_executor_free(&pool->e);
+        av_free(pool);
+        return AVERROR(ENOMEM);
+    }
+
+    *ppool = buf;
+    return 0;
+}
+
+int av_thread_pool_get_nb_threads(const AVBufferRef *pool)
+{
+    return ((const AVThreadPool *)pool->data)->nb_threads;
+}
+
+void ff_thread_pool_submit(AVThreadPool *pool, ThreadPoolTask *t)
+{
+    av_executor_execute(pool->e, &t->task);
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_H
+#define AVUTIL_THREADPOOL_H
+
+#include "buffer.h"
+
+/**
+ * @file
+ * Shared thread pool.
+ *
+ * By default every codec, filtergraph and scaling context that uses slice
+ * threading spawns its own private worker threads. A thread pool can be
+ * attached to any number of such contexts instead (see
+ * AVCodecContext.thread_pool, AVFilterGraph.thread_pool and
+ * sws_set_thread_pool()), which then run their slices on the threads of the
+ * pool. The thread calling into the context always takes part in the work
+ * as well, and idle pool threads pick up the remaining slices of whichever
+ * context is busy, so a pool that is smaller than the total number of
+ * threads requested by its users still makes progress.
+ *
+ * The pool is reference counted through AVBufferRef; its threads are
+ * stopped once the last reference is dropped.
+ */
+
+typedef struct AVThreadPool AVThreadPool;
+
+/**
+ * Allocate a thread pool and start its threads.
+ *
+ * @param pool       on success, a reference to the newly created pool is
+ *                   written here; its data points to an AVThreadPool
+ * @param nb_threads number of worker threads, 0 for the number of CPUs
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int av_thread_pool_alloc(AVBufferRef **pool, int nb_threads);
+
+/**
+ * @return the number of worker threads of the pool referenced by pool
+ */
+int av_thread_pool_get_nb_threads(const AVBufferRef *pool);
+
+#endif /* AVUTIL_THREADPOOL_H */
@@ -0,0 +1,39 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_INTERNAL_H
+#define AVUTIL_THREADPOOL_INTERNAL_H
+
+#include "executor.h"
+#include "threadpool.h"
+
+typedef struct ThreadPoolTask ThreadPoolTask;
+
+struct ThreadPoolTask {
+    AVTask task;
+    void (*run)(ThreadPoolTask *t);
+};
+
+/**
+ * Queue a task to be run by one of the pool threads. Tasks are run in
+ * submission order. The task must stay valid until its run() callback
+ * has been called.
+ */
+void ff_thread_pool_submit(AVThreadPool *pool, ThreadPoolTask *t);
+
+#endif /* AVUTIL_THREADPOOL_INTERNAL_H */
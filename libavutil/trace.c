@@ -0,0 +1,369 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "avstring.h"
+#include "error.h"
+#include "file_open.h"
+#include "mem.h"
+#include "thread.h"
+#include "time.h"
+#include "trace.h"
+
+#if HAVE_PTHREADS
+
+#define TRACE_NAME_SIZE       40
+#define TRACE_THREAD_NAME_SIZE 32
+#define TRACE_DEFAULT_EVENTS  (1 << 16)
+#define TRACE_MAX_EVENTS      (1 << 24)
+
+typedef struct TraceEvent {
+    int64_t     ts;         ///< nanoseconds
+    int64_t     arg;
+    const char *category;   ///< NULL for the end of a span
+    char        name[TRACE_NAME_SIZE];
+} TraceEvent;
+
+/* One per thread and recording session, only written by its thread.
+ * Buffers outlive their threads until av_trace_stop(). */
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    TraceEvent *events;
+    unsigned    mask;
+    uint64_t    nb_written;
+    int         tid;
+    char        thread_name[TRACE_THREAD_NAME_SIZE];
+} TraceBuffer;
+
+/* Thread-specific data, freed when the thread exits. */
+typedef struct TraceThread {
+    TraceBuffer *buf;
+    unsigned     generation;
+    char         name[TRACE_THREAD_NAME_SIZE];
+} TraceThread;
+
+static atomic_int    trace_enabled;
+static atomic_uint   trace_generation;
+
+static AVMutex       trace_lock = AV_MUTEX_INITIALIZER;
+static TraceBuffer  *trace_buffers;
+static int           trace_nb_threads;
+static unsigned      trace_nb_events;
+static int64_t       trace_start_time;
+
+static pthread_key_t trace_key;
+static AVOnce        trace_key_once = AV_ONCE_INIT;
+static int           trace_key_err;
+
+static void trace_thread_free(void *opaque)
+{
+    av_free(opaque);
+}
+
+static void trace_key_init(void)
+{
+    trace_key_err = pthread_key_create(&trace_key, trace_thread_free);
+}
+
+static int64_t trace_time(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return av_gettime_relative() * 1000;
+}
+
+static TraceThread *trace_get_thread(void)
+{
+    TraceThread *t;
+
+    if (ff_thread_once(&trace_key_once, trace_key_init) || trace_key_err)
+        return NULL;
+
+    t = pthread_getspecific(trace_key);
+    if (!t) {
+        t = av_mallocz(sizeof(*t));
+        if (!t)
+            return NULL;
+        if (pthread_setspecific(trace_key, t)) {
+            av_free(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+static TraceBuffer *trace_get_buffer(void)
+{
+    TraceThread *t = pthread_getspecific(trace_key);
+    TraceBuffer *buf;
+
+    if (t && t->buf &&
+        t->generation == atomic_load_explicit(&trace_generation, memory_order_relaxed))
+        return t->buf;
+
+    t = trace_get_thread();
+    if (!t)
+        return NULL;
+
+    ff_mutex_lock(&trace_lock);
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        goto fail;
+
+    buf = av_mallocz(sizeof(*buf));
+    if (!buf)
+        goto fail;
+    buf->events = av_malloc_array(trace_nb_events, sizeof(*buf->events));
+    if (!buf->events) {
+        av_free(buf);
+        goto fail;
+    }
+    buf->mask = trace_nb_events - 1;
+    buf->tid  = ++trace_nb_threads;
+    av_strlcpy(buf->thread_name, t->name, sizeof(buf->thread_name));
+
+    buf->next     = trace_buffers;
+    trace_buffers = buf;
+
+    t->buf        = buf;
+    t->generation = atomic_load_explicit(&trace_generation, memory_order_relaxed);
+    ff_mutex_unlock(&trace_lock);
+
+    return buf;
+fail:
+    ff_mutex_unlock(&trace_lock);
+    return NULL;
+}
+
+static void trace_record(const char *category, const char *name, int64_t arg)
+{
+    TraceBuffer *buf = trace_get_buffer();
+    TraceEvent *ev;
+
+    if (!buf)
+        return;
+
+    ev = &buf->events[buf->nb_written++ & buf->mask];
+    ev->ts       = trace_time();
+    ev->arg      = arg;
+    ev->category = category;
+    if (name)
+        av_strlcpy(ev->name, name, sizeof(ev->name));
+}
+
+static void write_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int trace_write(const char *filename, const TraceBuffer *buffers,
+                       int64_t start_time)
+{
+    FILE *f = avpriv_fopen_utf8(filename, "w");
+    const char *sep = "\n";
+
+    if (!f)
+        return AVERROR(errno);
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (const TraceBuffer *buf = buffers; buf; buf = buf->next) {
+        uint64_t first = buf->nb_written > buf->mask ? buf->nb_written - buf->mask - 1 : 0;
+        int depth = 0;
+
+        if (buf->thread_name[0]) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":", sep, buf->tid);
+            write_string(f, buf->thread_name);
+            fprintf(f, "}}");
+            sep = ",\n";
+        }
+
+        for (uint64_t i = first; i < buf->nb_written; i++) {
+            const TraceEvent *ev = &buf->events[i & buf->mask];
+            double ts = (ev->ts - start_time) / 1000.0;
+
+            if (ev->category) {
+                fprintf(f, "%s{\"name\":", sep);
+                write_string(f, ev->name);
+                fprintf(f, ",\"cat\":");
+                write_string(f, ev->category);
+                fprintf(f, ",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"arg\":%"PRId64"}}", ts, buf->tid, ev->arg);
+                depth++;
+            } else {
+                // the beginning of this span was overwritten or not recorded
+                if (!depth)
+                    continue;
+                fprintf(f, "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                        sep, ts, buf->tid);
+                depth--;
+            }
+            sep = ",\n";
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (ferror(f)) {
+        fclose(f);
+        return AVERROR(EIO);
+    }
+    return fclose(f) ? AVERROR(errno) : 0;
+}
+
+int av_trace_start(int nb_events)
+{
+    if (nb_events < 0)
+        return AVERROR(EINVAL);
+    if (ff_thread_once(&trace_key_once, trace_key_init) || trace_key_err)
+        return AVERROR(trace_key_err ? trace_key_err : EINVAL);
+
+    ff_mutex_lock(&trace_lock);
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        ff_mutex_unlock(&trace_lock);
+        return AVERROR(EBUSY);
+    }
+
+    trace_nb_events = TRACE_DEFAULT_EVENTS;
+    if (nb_events) {
+        trace_nb_events = 1;
+        while (trace_nb_events < nb_events && trace_nb_events < TRACE_MAX_EVENTS)
+            trace_nb_events <<= 1;
+    }
+    trace_start_time = trace_time();
+
+    atomic_store_explicit(&trace_enabled, 1, memory_order_relaxed);
+    ff_mutex_unlock(&trace_lock);
+
+    return 0;
+}
+
+int av_trace_stop(const char *filename)
+{
+    TraceBuffer *buffers;
+    int ret = 0;
+
+    ff_mutex_lock(&trace_lock);
+    atomic_store_explicit(&trace_enabled, 0, memory_order_relaxed);
+    // make threads drop their buffers before they can record again
+    atomic_fetch_add_explicit(&trace_generation, 1, memory_order_relaxed);
+    buffers          = trace_buffers;
+    trace_buffers    = NULL;
+    trace_nb_threads = 0;
+    ff_mutex_unlock(&trace_lock);
+
+    if (filename)
+        ret = trace_write(filename, buffers, trace_start_time);
+
+    while (buffers) {
+        TraceBuffer *next = buffers->next;
+        av_free(buffers->events);
+        av_free(buffers);
+        buffers = next;
+    }
+
+    return ret;
+}
+
+int av_trace_enabled(void)
+{
+    return atomic_load_explicit(&trace_enabled, memory_order_relaxed);
+}
+
+void av_trace_set_thread_name(const char *name)
+{
+    TraceThread *t;
+
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+
+    t = trace_get_thread();
+    if (!t)
+        return;
+
+    av_strlcpy(t->name, name, sizeof(t->name));
+    ff_mutex_lock(&trace_lock);
+    if (t->buf &&
+        t->generation == atomic_load_explicit(&trace_generation, memory_order_relaxed))
+        av_strlcpy(t->buf->thread_name, name, sizeof(t->buf->thread_name));
+    ff_mutex_unlock(&trace_lock);
+}
+
+void av_trace_begin(const char *category, const char *name, int64_t arg)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+    trace_record(category, name ? name : "", arg);
+}
+
+void av_trace_end(void)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+    trace_record(NULL, NULL, 0);
+}
+
+#else /* HAVE_PTHREADS */
+
+int av_trace_start(int nb_events)
+{
+    return AVERROR(ENOSYS);
+}
+
+int av_trace_stop(const char *filename)
+{
+    return 0;
+}
+
+int av_trace_enabled(void)
+{
+    return 0;
+}
+
+void av_trace_set_thread_name(const char *name)
+{
+}
+
+void av_trace_begin(const char *category, const char *name, int64_t arg)
+{
+}
+
+void av_trace_end(void)
+{
+}
+
+#endif /* HAVE_PTHREADS */
@@ -0,0 +1,87 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_TRACE_H
+#define AVUTIL_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Event tracing.
+ *
+ * Records timestamped begin/end events into a ring buffer per thread, and
+ * writes them out in the Chrome trace event format, which can be viewed in
+ * Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+ *
+ * The libraries record events for filter activations and slice threading
+ * jobs; applications may add their own. While recording is off, which is the
+ * default, recording an event costs a function call and an atomic load.
+ *
+ * Recording is only supported in builds with pthreads.
+ */
+
+/**
+ * Start recording events.
+ *
+ * @param nb_events number of events kept per thread, 0 for a default;
+ *                  once a thread's buffer is full, its oldest events are
+ *                  overwritten
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int av_trace_start(int nb_events);
+
+/**
+ * Stop recording events, write all recorded events to filename and free
+ * them. Should only be called once no other thread records events anymore.
+ *
+ * @param filename file to write the trace to, or NULL to discard the events
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int av_trace_stop(const char *filename);
+
+/**
+ * @return nonzero if events are being recorded
+ */
+int av_trace_enabled(void);
+
+/**
+ * Set the name of the calling thread shown in the trace.
+ * The name is copied and may be truncated. It is ignored if tracing is not
+ * enabled.
+ */
+void av_trace_set_thread_name(const char *name);
+
+/**
+ * Record the beginning of a span on the calling thread. Spans on one thread
+ * must be properly nested.
+ *
+ * @param category a string with static storage duration, e.g. a literal
+ * @param name     name of the span; copied and possibly truncated
+ * @param arg      an arbitrary value shown with the span, e.g. a timestamp
+ *                 or a job number
+ */
+void av_trace_begin(const char *category, const char *name, int64_t arg);
+
+/**
+ * Record the end of the innermost span begun by av_trace_begin() on the
+ * calling thread.
+ */
+void av_trace_end(void);
+
+#endif /* AVUTIL_TRACE_H */
@@ -263,6 +263,18 @@ int sws_isSupportedEndiannessConversion(enum AVPixelFormat pix_fmt);
 av_warn_unused_result
 int sws_init_context(SwsContext *sws_context, SwsFilter *srcFilter, SwsFilter *dstFilter);
 
+/**
+ * Run slice threading on a shared thread pool instead of threads private
+ * to this context. Must be called before sws_init_context(). Only has an
+ * effect when the "threads" option is not 1; 0 then uses as many threads as
+ * the pool has, plus the calling thread.
+ *
+ * @param pool a reference to an AVThreadPool (see libavutil/threadpool.h);
+ *             a new reference is created, the caller keeps its own
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int sws_set_thread_pool(SwsContext *sws_context, AVBufferRef *pool);
+
 /**
  * Free the swscaler context swsContext.
  * If swsContext is NULL, then does nothing.
@@ -702,6 +702,9 @@ struct SwsInternal {
     atomic_int   data_unaligned_warned;
 
     Half2FloatTables *h2f_tables;
+
+    // shared thread pool for slicethread, see sws_set_thread_pool()
+    AVBufferRef *thread_pool;
 };
 //FIXME check init (where 0)
 
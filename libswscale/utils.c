@@ -2033,8 +2033,9 @@ static int context_init_threaded(SwsContext *sws,
     SwsInternal *c = sws_internal(sws);
     int ret;
 
-    ret = avpriv_slicethread_create(&c->slicethread, (void*) sws,
-                                    ff_sws_slice_worker, NULL, c->nb_threads);
+    ret = avpriv_slicethread_create_pool(&c->slicethread, (void*) sws,
+                                         ff_sws_slice_worker, NULL, c->nb_threads,
+                                         c->thread_pool);
     if (ret == AVERROR(ENOSYS)) {
         c->nb_threads = 1;
         return 0;
@@ -2078,6 +2079,18 @@ static int context_init_threaded(SwsContext *sws,
     return 0;
 }
 
+int sws_set_thread_pool(SwsContext *sws, AVBufferRef *pool)
+{
+    SwsInternal *c = sws_internal(sws);
+
+    av_buffer_unref(&c->thread_pool);
+    if (!pool)
+        return 0;
+
+    c->thread_pool = av_buffer_ref(pool);
+    return c->thread_pool ? 0 : AVERROR(ENOMEM);
+}
+
 av_cold int sws_init_context(SwsContext *sws, SwsFilter *srcFilter,
                              SwsFilter *dstFilter)
 {
@@ -2456,6 +2469,7 @@ void sws_freeContext(SwsContext *sws)
     av_freep(&c->slice_err);
 
     avpriv_slicethread_free(&c->slicethread);
+    av_buffer_unref(&c->thread_pool);
 
     for (i = 0; i < 4; i++)
         av_freep(&c->dither_error[i]);
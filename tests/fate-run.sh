@@ -492,6 +492,35 @@ refcmp_metadata_transcode(){
     refcmp_metadata_files $tencfile $tsrcfile "$@"
 }
 
+signature_threads(){
+    src=$1
+    sigfile1="${outdir}/${test}.1.sig"
+    sigfile4="${outdir}/${test}.4.sig"
+    cleanfiles="$cleanfiles $sigfile1 $sigfile4"
+    ffmpeg -filter_threads 1 -f lavfi -i "$src" -vf signature=filename=$(target_path $sigfile1) -f null - || return
+    ffmpeg -filter_threads 4 -f lavfi -i "$src" -vf signature=filename=$(target_path $sigfile4) -f null - || return
+    do_md5sum $sigfile1 | awk '{print $1}'
+    cmp $sigfile1 $sigfile4
+}
+
+signature_index(){
+    src=$1
+    shift
+    idxfile="${outdir}/${test}.idx"
+    cleanfiles="$cleanfiles $idxfile"
+    : > $idxfile
+    i=0
+    for sigsrc in "$@"; do
+        sigfile="${outdir}/${test}.$i.sig"
+        cleanfiles="$cleanfiles $sigfile"
+        ffmpeg -f lavfi -i "$sigsrc" -vf signature=filename=$(target_path $sigfile) -f null - || return
+        echo $(target_path $sigfile) >> $idxfile
+        i=$((i + 1))
+    done
+    ffmpeg -f lavfi -i "$src" -vf signature=detectmode=full:index=$(target_path $idxfile) -f null - 2>&1 |
+        sed -n -e "s,$(target_path $outdir)/,," -e "s,^\[Parsed_signature_0 @ [^]]*\] ,,p"
+}
+
 pixfmt_conversion(){
     conversion="${test#pixfmt-}"
     outdir="tests/data/pixfmt"
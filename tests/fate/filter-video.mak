@@ -799,6 +799,30 @@ FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER SPLIT_FILTER AVGBLUR_FILTER        \
                            METADATA_FILTER WRAPPED_AVFRAME_ENCODER NULL_MUXER \
                            PIPE_PROTOCOL) += $(FATE_FILTER_REFCMP_METADATA-yes)
 
+SIGNATURE_SRC = testsrc2=s=320x240:r=25:d=20
+
+FATE_FILTER_SIGNATURE += fate-filter-signature-threads
+fate-filter-signature-threads: CMD = signature_threads $(SIGNATURE_SRC)
+
+# the signature read back from the binary file matches the one computed
+FATE_FILTER_SIGNATURE += fate-filter-signature-import
+fate-filter-signature-import: CMD = signature_index $(SIGNATURE_SRC) $(SIGNATURE_SRC)
+
+FATE_FILTER_SIGNATURE += fate-filter-signature-index
+fate-filter-signature-index: CMD = signature_index $(SIGNATURE_SRC),trim=start=3 mptestsrc=r=25:d=20 $(SIGNATURE_SRC)
+
+FATE_FILTER-$(call ALLYES, LAVFI_INDEV MPTESTSRC_FILTER TESTSRC2_FILTER    \
+                           TRIM_FILTER SIGNATURE_FILTER WRAPPED_AVFRAME_ENCODER \
+                           NULL_MUXER FILE_PROTOCOL PIPE_PROTOCOL) += $(FATE_FILTER_SIGNATURE)
+
+FATE_FILTER_WAVEFRONT-$(call ALLYES, TESTSRC2_FILTER SPLIT_FILTER PALETTEGEN_FILTER  \
+                                     PALETTEUSE_FILTER MESTIMATE_FILTER CODECVIEW_FILTER \
+                                     MINTERPOLATE_FILTER FORMAT_FILTER) += fate-filter-wavefront
+FATE_FILTER-$(HAVE_THREADS) += $(FATE_FILTER_WAVEFRONT-yes)
+fate-filter-wavefront: libavfilter/tests/wavefront$(EXESUF)
+fate-filter-wavefront: CMD = run libavfilter/tests/wavefront$(EXESUF)
+fate-filter-wavefront: CMP = null
+
 FATE_SAMPLES_FFPROBE += $(FATE_METADATA_FILTER-yes)
 FATE_SAMPLES_FFMPEG += $(FATE_FILTER_SAMPLES-yes)
 FATE_FFMPEG += $(FATE_FILTER-yes)
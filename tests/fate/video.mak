@@ -408,6 +408,30 @@ fate-qmage-w2_pass: CMD = framecrc -i $(TARGET_SAMPLES)/qmage/w2_pass.qmg
 
 fate-qmage: fate-qmage-ani_alpha fate-qmage-dynamic_table fate-qmage-w2_pass
 
+FATE_QMAGE_FFMPEG_FFPROBE-$(call TRANSCODE, QMAGE, QMAGE, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER) += fate-qmage-enc-still
+fate-qmage-enc-still: CMD = transcode "lavfi -graph testsrc2=s=64x48:r=10:d=0.1,format=rgb565" "foo" qmage "-c:v qmage" "" "-show_entries packet=pts,duration,flags"
+
+FATE_QMAGE_FFMPEG_FFPROBE-$(call TRANSCODE, QMAGE, QMAGE, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER) += fate-qmage-enc-ani
+fate-qmage-enc-ani: CMD = transcode "lavfi -graph testsrc2=s=64x48:r=10:d=0.5,format=rgb565" "foo" qmage "-c:v qmage -animation 1" "" "-show_entries packet=pts,duration,flags"
+
+FATE_QMAGE_FFMPEG_FFPROBE-$(call TRANSCODE, QMAGE, QMAGE, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER) += fate-qmage-enc-still-tall
+fate-qmage-enc-still-tall: CMD = transcode "lavfi -graph testsrc2=s=64x96:r=10:d=0.1,format=rgb565" "foo" qmage "-c:v qmage"
+fate-qmage-enc-still-tall: KEEP_FILES ?= 1
+
+# Stills decode with frame threads by default. With slice threads, the still
+# above is cut into W2-pass bands, which must decode to the same picture.
+FATE_QMAGE_STILL-$(call FRAMECRC, QMAGE, QMAGE) += fate-qmage-still-serial fate-qmage-still-slice
+fate-qmage-still-serial: CMD = threads=1 framecrc -i $(TARGET_PATH)/tests/data/fate/qmage-enc-still-tall.qmage
+fate-qmage-still-slice: CMD = threads=4 thread_type=slice framecrc -i $(TARGET_PATH)/tests/data/fate/qmage-enc-still-tall.qmage
+fate-qmage-still-slice: REF = $(SRC_PATH)/tests/ref/fate/qmage-still-serial
+
+FATE_QMAGE_STILL := $(if $(filter fate-qmage-enc-still-tall, $(FATE_QMAGE_FFMPEG_FFPROBE-yes)),$(FATE_QMAGE_STILL-yes))
+$(FATE_QMAGE_STILL): fate-qmage-enc-still-tall
+
+FATE_FFMPEG_FFPROBE += $(FATE_QMAGE_FFMPEG_FFPROBE-yes)
+FATE_FFMPEG += $(FATE_QMAGE_STILL)
+fate-qmage-enc: $(FATE_QMAGE_FFMPEG_FFPROBE-yes) $(FATE_QMAGE_STILL)
+
 FATE_VIDEO += $(FATE_VIDEO-yes)
 
 FATE_SAMPLES_FFMPEG += $(FATE_VIDEO)
@@ -0,0 +1,272 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Qmage decoder benchmark
+ *
+ * Decodes every file in a directory, e.g. a sample collection or a fuzzing
+ * corpus, and reports throughput per encoder_mode/depth/mode combination.
+ * Files that fail to demux or decode are counted, not fatal.
+ *
+ * Stages:
+ *  demux   opening the file, frame indexing and reading all packets
+ *  decode  bitstream decode and RGB565 reconstruction; the decoder
+ *          reconstructs blocks as it parses them, so these cannot be told
+ *          apart from outside
+ *  recon   extra time for alpha plane reconstruction and RGBA output on
+ *          transparent files (decode with -alpha 1 minus decode without)
+ *
+ * MPix/s is computed over the decode stage.
+ *
+ * Usage: qmage_bench <directory> [<iterations> [<threads>]]
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/dict.h"
+#include "libavutil/error.h"
+#include "libavutil/frame.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+#include "libavformat/avformat.h"
+
+#include "libavcodec/avcodec.h"
+
+#define MAX_CLASSES 64
+
+typedef struct Class {
+    int encoder_mode, depth, mode;
+    int files, frames, errors;
+    int64_t pixels;
+    int64_t t_demux, t_decode, t_recon;
+} Class;
+
+static Class classes[MAX_CLASSES];
+static int nb_classes;
+static int nb_skipped;
+
+static Class *get_class(const AVPacket *pkt)
+{
+    int qversion, flags4, flags5, encoder_mode, depth, mode;
+
+    if (pkt->size < 6)
+        return NULL;
+
+    qversion = pkt->data[2];
+    flags4   = pkt->data[4];
+    flags5   = pkt->data[5];
+    mode     = !!(flags4 & 0x80);
+    depth    = (flags5 & 0x40) ? 2 : 1;
+    encoder_mode = qversion == 0xb ? flags5 & 0x7  :
+                   qversion >  0xb ? flags5 & 0xf  : 0;
+
+    for (int i = 0; i < nb_classes; i++) {
+        Class *c = &classes[i];
+        if (c->encoder_mode == encoder_mode && c->depth == depth && c->mode == mode)
+            return c;
+    }
+    if (nb_classes == MAX_CLASSES)
+        return NULL;
+
+    classes[nb_classes].encoder_mode = encoder_mode;
+    classes[nb_classes].depth        = depth;
+    classes[nb_classes].mode         = mode;
+    return &classes[nb_classes++];
+}
+
+static int is_transparent(const AVPacket *pkt)
+{
+    return pkt->size >= 4 && (pkt->data[3] == 3 || pkt->data[3] == 6);
+}
+
+static AVCodecContext *open_decoder(const AVCodecParameters *par, int threads,
+                                    int alpha)
+{
+    const AVCodec *codec = avcodec_find_decoder_by_name("qmage");
+    AVCodecContext *dec;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if (!codec)
+        return NULL;
+    dec = avcodec_alloc_context3(codec);
+    if (!dec)
+        return NULL;
+
+    ret = avcodec_parameters_to_context(dec, par);
+    if (ret < 0)
+        goto fail;
+    dec->thread_count = threads;
+    av_dict_set_int(&opts, "alpha", alpha, 0);
+    ret = avcodec_open2(dec, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        goto fail;
+
+    return dec;
+fail:
+    avcodec_free_context(&dec);
+    return NULL;
+}
+
+/* decode all packets once; returns the elapsed time in microseconds */
+static int64_t decode_all(AVCodecContext *dec, AVPacket **pkts, int nb_pkts,
+                          AVFrame *frame, int *frames, int64_t *pixels, int *errors)
+{
+    int64_t t = av_gettime_relative();
+    int ret;
+
+    for (int i = 0; i <= nb_pkts; i++) {
+        ret = avcodec_send_packet(dec, i < nb_pkts ? pkts[i] : NULL);
+        if (ret < 0)
+            (*errors)++;
+        while ((ret = avcodec_receive_frame(dec, frame)) >= 0) {
+            (*frames)++;
+            *pixels += (int64_t)frame->width * frame->height;
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            (*errors)++;
+    }
+    t = av_gettime_relative() - t;
+
+    avcodec_flush_buffers(dec);
+    return t;
+}
+
+static void bench_file(const char *path, int iterations, int threads)
+{
+    const AVInputFormat *ifmt = av_find_input_format("qmage");
+    AVFormatContext *fmt = NULL;
+    AVCodecContext *dec = NULL, *dec_alpha = NULL;
+    AVPacket **pkts = NULL;
+    AVFrame *frame = NULL;
+    Class *c;
+    int nb_pkts = 0, ret;
+    int64_t t;
+
+    t = av_gettime_relative();
+    ret = avformat_open_input(&fmt, path, ifmt, NULL);
+    if (ret < 0) {
+        nb_skipped++;
+        return;
+    }
+    while (1) {
+        AVPacket *pkt = av_packet_alloc();
+        if (!pkt)
+            goto fail;
+        ret = av_read_frame(fmt, pkt);
+        if (ret < 0 ||
+            av_dynarray_add_nofree(&pkts, &nb_pkts, pkt) < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+    }
+    t = av_gettime_relative() - t;
+
+    if (!nb_pkts || !(c = get_class(pkts[0]))) {
+        nb_skipped++;
+        goto fail;
+    }
+    c->files++;
+    c->t_demux += t;
+
+    frame = av_frame_alloc();
+    dec   = open_decoder(fmt->streams[0]->codecpar, threads, 0);
+    if (is_transparent(pkts[0]))
+        dec_alpha = open_decoder(fmt->streams[0]->codecpar, threads, 1);
+    if (!frame || !dec || (is_transparent(pkts[0]) && !dec_alpha)) {
+        c->errors++;
+        goto fail;
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        int frames = 0, errors = 0;
+        int64_t pixels = 0;
+
+        t = decode_all(dec, pkts, nb_pkts, frame, &frames, &c->pixels, &c->errors);
+        c->t_decode += t;
+        c->frames   += frames;
+        frames = 0;
+        if (dec_alpha)
+            c->t_recon += FFMAX(decode_all(dec_alpha, pkts, nb_pkts, frame,
+                                           &frames, &pixels, &errors) - t, 0);
+    }
+
+fail:
+    for (int i = 0; i < nb_pkts; i++)
+        av_packet_free(&pkts[i]);
+    av_freep(&pkts);
+    av_frame_free(&frame);
+    avcodec_free_context(&dec);
+    avcodec_free_context(&dec_alpha);
+    avformat_close_input(&fmt);
+}
+
+int main(int argc, char **argv)
+{
+    DIR *dir;
+    struct dirent *ent;
+    int iterations = 1, threads = 1;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <directory> [<iterations> [<threads>]]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        iterations = FFMAX(atoi(argv[2]), 1);
+    if (argc > 3)
+        threads = FFMAX(atoi(argv[3]), 0);
+
+    av_log_set_level(AV_LOG_PANIC);
+
+    dir = opendir(argv[1]);
+    if (!dir) {
+        fprintf(stderr, "Cannot open directory %s\n", argv[1]);
+        return 1;
+    }
+    while ((ent = readdir(dir))) {
+        char *path;
+
+        if (ent->d_name[0] == '.')
+            continue;
+        path = av_asprintf("%s/%s", argv[1], ent->d_name);
+        if (!path)
+            break;
+        bench_file(path, iterations, threads);
+        av_free(path);
+    }
+    closedir(dir);
+
+    printf("mode depth encoder_mode  files frames errors  demux(ms) decode(ms) recon(ms)  MPix/s\n");
+    for (int i = 0; i < nb_classes; i++) {
+        const Class *c = &classes[i];
+        printf("%4d %5d %12d  %5d %6d %6d  %9.3f %10.3f %9.3f  %6.2f\n",
+               c->mode, c->depth, c->encoder_mode,
+               c->files, c->frames, c->errors,
+               c->t_demux / 1000.0, c->t_decode / 1000.0, c->t_recon / 1000.0,
+               c->t_decode ? (double)c->pixels / c->t_decode : 0.0);
+    }
+    if (nb_skipped)
+        printf("%d file(s) skipped\n", nb_skipped);
+
+    return 0;
+}
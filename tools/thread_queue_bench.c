@@ -0,0 +1,157 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* fftools thread queue benchmark
+ *
+ * Passes packets from one producer thread to one consumer thread through a
+ * ThreadQueue, once with the default locked FIFO and once with the
+ * single-producer ring, and reports the throughput of both. The packets
+ * carry no data, so this measures the queue overhead only.
+ *
+ * Usage: thread_queue_bench [<packets> [<queue size>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "libavcodec/packet.h"
+
+#include "fftools/objpool.h"
+#include "fftools/thread_queue.h"
+
+typedef struct Producer {
+    ThreadQueue *tq;
+    int          nb_packets;
+    int          ret;
+} Producer;
+
+static void pkt_move(void *dst, void *src)
+{
+    av_packet_move_ref(dst, src);
+}
+
+static void *producer_thread(void *arg)
+{
+    Producer *p = arg;
+    AVPacket *pkt = av_packet_alloc();
+
+    if (!pkt) {
+        p->ret = AVERROR(ENOMEM);
+        goto finish;
+    }
+
+    for (int i = 0; i < p->nb_packets; i++) {
+        pkt->pts = i;
+        p->ret = tq_send(p->tq, 0, pkt);
+        if (p->ret < 0)
+            break;
+    }
+
+finish:
+    tq_send_finish(p->tq, 0);
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+/* returns the elapsed time in microseconds or a negative error code */
+static int64_t run(int flags, int nb_packets, int queue_size)
+{
+    Producer p = { .nb_packets = nb_packets };
+    ObjPool *op;
+    AVPacket *pkt;
+    pthread_t thread;
+    int64_t t, expected = 0;
+    int stream_idx, ret;
+
+    op = objpool_alloc_packets();
+    if (!op)
+        return AVERROR(ENOMEM);
+    p.tq = tq_alloc(1, queue_size, flags, op, pkt_move);
+    if (!p.tq) {
+        objpool_free(&op);
+        return AVERROR(ENOMEM);
+    }
+    pkt = av_packet_alloc();
+    if (!pkt) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    t = av_gettime_relative();
+
+    ret = pthread_create(&thread, NULL, producer_thread, &p);
+    if (ret) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    while ((ret = tq_receive(p.tq, &stream_idx, pkt)) >= 0) {
+        if (pkt->pts != expected++) {
+            fprintf(stderr, "Packet %"PRId64" received out of order\n", expected - 1);
+            tq_receive_finish(p.tq, 0);
+        }
+        av_packet_unref(pkt);
+    }
+    pthread_join(thread, NULL);
+
+    t = av_gettime_relative() - t;
+
+    ret = p.ret < 0 ? p.ret : expected == nb_packets ? 0 : AVERROR_BUG;
+
+fail:
+    av_packet_free(&pkt);
+    tq_free(&p.tq);
+    return ret < 0 ? ret : t;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int         flags;
+    } modes[] = {
+        { "locked", 0                  },
+        { "ring",   TQ_SINGLE_PRODUCER },
+    };
+    int nb_packets = 1000000, queue_size = 8;
+
+    if (argc > 1)
+        nb_packets = FFMAX(atoi(argv[1]), 1);
+    if (argc > 2)
+        queue_size = FFMAX(atoi(argv[2]), 1);
+
+    printf("mode     packets  queue   time(ms)  Mpkt/s\n");
+    for (int i = 0; i < FF_ARRAY_ELEMS(modes); i++) {
+        int64_t t = run(modes[i].flags, nb_packets, queue_size);
+
+        if (t < 0) {
+            fprintf(stderr, "%s: %s\n", modes[i].name, av_err2str(t));
+            return 1;
+        }
+        printf("%-6s %9d  %5d %10.3f  %6.2f\n", modes[i].name,
+               nb_packets, queue_size, t / 1000.0,
+               t ? (double)nb_packets / t : 0.0);
+    }
+
+    return 0;
+}